@@ -5,6 +5,495 @@
  */
 
 #include "FormBuilder.h"
+#include <mbedtls/version.h>
+#include <mbedtls/sha256.h>
+
+#if defined(ESP32)
+#include <lwip/sockets.h>
+#if __has_include(<esp_random.h>)
+#include <esp_random.h>
+#else
+#include <esp_system.h>
+#endif
+#else
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <errno.h>
+#endif
+
+#if defined(FORMBUILDER_TRACE) && !defined(ESP32)
+#include <chrono>
+#endif
+
+#ifdef FORMBUILDER_ALLOC_STATS
+#if defined(ESP32)
+#include <esp_heap_caps.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#define FB_ALLOC_SIZE(p) heap_caps_get_allocated_size(p)
+#else
+#include <malloc.h>
+#define FB_ALLOC_SIZE(p) malloc_usable_size(p)
+#endif
+
+/**
+ * Allocation hooks - the linker routes malloc/realloc/free here when built
+ * with -Wl,--wrap=malloc,--wrap=realloc,--wrap=free. Only allocations made
+ * while a request is being handled (and, on ESP32, from the task handling
+ * it) are attributed to the current phase.
+ */
+static FormAllocStats* fbAllocTarget = nullptr;
+static volatile uint8_t fbAllocPhase = FB_PHASE_IDLE;
+static uint32_t fbLiveBytes = 0;
+#if defined(ESP32)
+static TaskHandle_t fbAllocTask = nullptr;
+#define FB_ALLOC_TRACKED() (fbAllocTarget && xTaskGetCurrentTaskHandle() == fbAllocTask)
+#else
+#define FB_ALLOC_TRACKED() (fbAllocTarget != nullptr)
+#endif
+
+// Blocks allocated before the request may be freed during it; live bytes
+// stop at 0 rather than go negative and hide the request's own peak
+static void fbNoteFree(size_t size) {
+    fbLiveBytes = size < fbLiveBytes ? fbLiveBytes - size : 0;
+}
+
+static void fbNoteAlloc(size_t newSize, size_t oldSize) {
+    fbNoteFree(oldSize);
+    fbLiveBytes += newSize;
+    fbAllocTarget->allocCount[fbAllocPhase]++;
+    if (fbLiveBytes > fbAllocTarget->peakBytes[fbAllocPhase]) {
+        fbAllocTarget->peakBytes[fbAllocPhase] = fbLiveBytes;
+    }
+}
+
+extern "C" {
+void* __real_malloc(size_t size);
+void* __real_realloc(void* ptr, size_t size);
+void __real_free(void* ptr);
+
+void* __wrap_malloc(size_t size) {
+    void* p = __real_malloc(size);
+    if (p && FB_ALLOC_TRACKED()) fbNoteAlloc(FB_ALLOC_SIZE(p), 0);
+    return p;
+}
+
+void* __wrap_realloc(void* ptr, size_t size) {
+    bool tracked = FB_ALLOC_TRACKED();
+    size_t oldSize = (ptr && tracked) ? FB_ALLOC_SIZE(ptr) : 0;
+    void* p = __real_realloc(ptr, size);
+    if (p && tracked) {
+        fbNoteAlloc(FB_ALLOC_SIZE(p), oldSize);
+    } else if (tracked && size == 0) {
+        fbNoteFree(oldSize);    // realloc(ptr, 0) freed ptr
+    }
+    return p;
+}
+
+void __wrap_free(void* ptr) {
+    if (ptr && FB_ALLOC_TRACKED()) fbNoteFree(FB_ALLOC_SIZE(ptr));
+    __real_free(ptr);
+}
+}
+#endif
+
+// Static page shell. Kept as single constants so each is sent with one
+// write and its size is known at compile time (see the budget below).
+static const char FB_HTML_HEADERS[] PROGMEM =
+    "HTTP/1.1 200 OK\r\n"
+    "Content-type:text/html\r\n"
+    "Connection: close\r\n"
+    "\r\n";
+
+// Headers of a measured page, up to its length
+static const char FB_HTML_HEADERS_LENGTH[] PROGMEM =
+    "HTTP/1.1 200 OK\r\n"
+    "Content-type:text/html\r\n"
+    "Content-Length: ";
+
+#ifdef FORMBUILDER_DEFLATE
+static const char FB_HTML_HEADERS_GZIP[] PROGMEM =
+    "HTTP/1.1 200 OK\r\n"
+    "Content-type:text/html\r\n"
+    "Content-Encoding: gzip\r\n"
+    "Vary: Accept-Encoding\r\n"
+    "Connection: close\r\n"
+    "\r\n";
+#endif
+
+// Document head, up to where the stylesheet is linked or inlined
+static const char FB_PAGE_HEAD[] PROGMEM =
+    "<!DOCTYPE html>\n"
+    "<html lang=\"en\">\n"
+    "<head>\n"
+    "<meta charset=\"UTF-8\">\n"
+    "<meta name=\"viewport\" content=\"width=device-width, initial-scale=1.0\">\n";
+
+// Built-in stylesheet - inlined, or served once at FB_ASSET_CSS_PATH
+// when the builder is attached to a FormDispatcher
+const char FB_STYLE[] PROGMEM =
+    // Enhanced CSS with modern styling
+    ":root {\n"
+    "  --primary-color: #2563eb;\n"
+    "  --primary-hover: #1d4ed8;\n"
+    "  --success-color: #059669;\n"
+    "  --background: #f8fafc;\n"
+    "  --card-bg: #ffffff;\n"
+    "  --text-primary: #1e293b;\n"
+    "  --text-secondary: #475569;\n"
+    "  --border: #e2e8f0;\n"
+    "  --border-focus: #3b82f6;\n"
+    "  --shadow: 0 4px 6px -1px rgba(0, 0, 0, 0.1);\n"
+    "  --shadow-lg: 0 10px 15px -3px rgba(0, 0, 0, 0.1);\n"
+    "}\n"
+
+    "* { box-sizing: border-box; }\n"
+
+    "body {\n"
+    "  font-family: -apple-system, BlinkMacSystemFont, 'Segoe UI', Roboto, sans-serif;\n"
+    "  background: linear-gradient(135deg, var(--background) 0%, #e2e8f0 100%);\n"
+    "  margin: 0; padding: 20px; color: var(--text-primary); line-height: 1.6;\n"
+    "}\n"
+
+    "#container {\n"
+    "  max-width: 800px; margin: 0 auto; background: var(--card-bg);\n"
+    "  border-radius: 16px; box-shadow: var(--shadow-lg); overflow: hidden;\n"
+    "}\n"
+
+    "#header {\n"
+    "  background: linear-gradient(135deg, var(--primary-color) 0%, var(--primary-hover) 100%);\n"
+    "  color: white; text-align: center; font-size: 1.7rem;\n"
+    "  font-weight: 700; margin: 0; letter-spacing: -0.5px;\n"
+    "  border-radius: 16px 16px 0 0; padding: 15px; display: flex; align-items: center; justify-content: center;\n"
+    "}\n"
+
+    "#inputs { padding: 20px 40px; margin-top: 0; }\n"
+
+    ".subheading {\n"
+    "  font-size: 1.5rem; font-weight: 600; color: var(--text-primary);\n"
+    "  margin: 15px 0 20px 0; padding-bottom: 10px;\n"
+    "  border-bottom: 2px solid var(--border);\n"
+    "}\n"
+    ".subheading:first-child { margin-top: 0; }\n"
+
+    ".field-group { margin-bottom: 24px; overflow: hidden; }\n"
+
+    ".field-label {\n"
+    "  display: block; font-size: 1.1rem; font-weight: 500;\n"
+    "  color: var(--text-primary); margin-bottom: 8px;\n"
+    "}\n"
+
+    "input[type=\"text\"], input[type=\"password\"], input[type=\"number\"], input[type=\"time\"], select {\n"
+    "  width: 100%; height: 48px; padding: 12px; font-size: 1.1rem;\n"
+    "  border: 2px solid var(--border); border-radius: 8px;\n"
+    "  background: var(--card-bg); transition: all 0.2s ease; outline: none;\n"
+    "}\n"
+
+    "input[type=\"text\"]:focus, input[type=\"password\"]:focus, input[type=\"number\"]:focus, input[type=\"time\"]:focus, select:focus {\n"
+    "  border-color: var(--border-focus);\n"
+    "  box-shadow: 0 0 0 3px rgba(59, 130, 246, 0.1);\n"
+    "}\n"
+
+    // Password container styling
+    ".password-container {\n"
+    "  display: flex; align-items: center; gap: 12px;\n"
+    "}\n"
+
+    ".password-container input[type=\"password\"], .password-container input[type=\"text\"] {\n"
+    "  flex: 1;\n"
+    "}\n"
+
+    ".show-password-label {\n"
+    "  display: flex; align-items: center; cursor: pointer; font-size: 0.9rem;\n"
+    "  color: var(--text-secondary); white-space: nowrap; margin: 0;\n"
+    "}\n"
+
+    ".show-password-label input[type=\"checkbox\"] {\n"
+    "  width: 16px; height: 16px; margin-right: 6px;\n"
+    "}\n"
+
+    "input[type=\"color\"] {\n"
+    "  width: 100%; height: 40px; padding: 2px;\n"
+    "  border: 2px solid var(--border); border-radius: 8px;\n"
+    "  cursor: pointer; transition: all 0.2s ease;\n"
+    "  appearance: none; -webkit-appearance: none;\n"
+    "}\n"
+    "input[type=\"color\"]::-webkit-color-swatch-wrapper { padding: 0; }\n"
+    "input[type=\"color\"]::-webkit-color-swatch { border: none; border-radius: 6px; }\n"
+
+    "input[type=\"color\"]:hover {\n"
+    "  border-color: var(--border-focus);\n"
+    "}\n"
+
+    // Range slider styling
+    ".range-container {\n"
+    "  display: flex; align-items: center; gap: 15px;\n"
+    "}\n"
+
+    "input[type=\"range\"] {\n"
+    "  flex: 1; height: 6px; appearance: none; background: var(--border);\n"
+    "  border-radius: 3px; outline: none;\n"
+    "}\n"
+
+    "input[type=\"range\"]::-webkit-slider-thumb {\n"
+    "  appearance: none; width: 20px; height: 20px; background: var(--primary-color);\n"
+    "  border-radius: 50%; cursor: pointer;\n"
+    "}\n"
+
+    ".range-value {\n"
+    "  background: var(--primary-color); color: white; padding: 4px 12px;\n"
+    "  border-radius: 12px; font-weight: 600; min-width: 40px; text-align: center;\n"
+    "}\n"
+
+    // Time input styling - constrain width for iOS Safari
+    "input[type=\"time\"] {\n"
+    "  width: 100%; max-width: 100%; box-sizing: border-box;\n"
+    "  height: 48px; padding: 12px; font-size: 1.1rem;\n"
+    "  border: 2px solid var(--border); border-radius: 8px;\n"
+    "  background: var(--card-bg); outline: none;\n"
+    "}\n"
+
+    // Checkbox and radio styling
+    ".checkbox-group, .radio-group {\n"
+    "  margin-bottom: 4px;\n"
+    "}\n"
+
+    ".checkbox-label, .radio-label {\n"
+    "  display: flex; align-items: center; cursor: pointer; font-size: 1.1rem;\n"
+    "  font-weight: 500; color: var(--text-primary); padding: 2px 0;\n"
+    "}\n"
+    ".bitmask-grid {\n"
+    "  display: grid; grid-template-columns: repeat(auto-fill, minmax(110px, 1fr));\n"
+    "}\n"
+
+    "input[type=\"checkbox\"], input[type=\"radio\"] {\n"
+    "  width: 18px; height: 18px; margin-right: 12px; cursor: pointer;\n"
+    "}\n"
+
+    // Add the separator line above save button
+    ".button-separator {\n"
+    "  width: 100%; height: 1px;\n"
+    "  background: var(--border);\n"
+    "  margin: 30px 0 20px 0;\n"
+    "}\n"
+
+    ".save-button {\n"
+    "  width: 100%; padding: 20px; font-size: 1.2rem; font-weight: 600;\n"
+    "  color: white; background: linear-gradient(135deg, var(--success-color) 0%, #047857 100%);\n"
+    "  border: none; border-radius: 12px; cursor: pointer;\n"
+    "  transition: all 0.2s ease; margin-top: 20px; box-shadow: var(--shadow);\n"
+    "}\n"
+
+    ".save-button:hover {\n"
+    "  transform: translateY(-2px); box-shadow: var(--shadow-lg);\n"
+    "}\n"
+
+    ".save-button:active { transform: translateY(0); }\n"
+
+    ".success-message {\n"
+    "  position: fixed; top: 50%; left: 50%; transform: translate(-50%, -50%);\n"
+    "  background: rgba(5,150,105,0.95); color: white; padding: 30px 50px;\n"
+    "  border-radius: 16px; font-size: 1.6rem; font-weight: 700;\n"
+    "  box-shadow: 0 20px 40px rgba(0,0,0,0.3); z-index: 1000;\n"
+    "  transition: opacity 0.6s ease; pointer-events: none; white-space: nowrap;\n"
+    "}\n"
+
+    "@media (max-width: 600px) {\n"
+    "  body { padding: 10px; }\n"
+    "  #header { padding: 15px; }\n"
+    "  #inputs { padding: 20px; }\n"
+    "}\n";
+
+// Save button closing the form body
+static const char FB_PAGE_BUTTON[] PROGMEM =
+    // Add the separator line before the save button
+    "<div class=\"button-separator\"></div>\n"
+    "<button type=\"button\" class=\"save-button\" onclick=\"SendText()\">Save Configuration</button>\n"
+    "</div></div>\n";
+
+// Built-in script - inlined, or served once at FB_ASSET_JS_PATH.
+// Field range and submit URL come from the per-page fbFirst/fbLast/fbAction.
+const char FB_SCRIPT[] PROGMEM =
+    // Range slider update function
+    "function updateRangeValue(fieldId, value) {\n"
+    "  document.getElementById(fieldId + '_value').textContent = value;\n"
+    "}\n"
+
+    // Password visibility toggle function
+    "function togglePassword(fieldId) {\n"
+    "  var field = document.getElementById(fieldId);\n"
+    "  field.type = field.type === 'password' ? 'text' : 'password';\n"
+    "}\n"
+
+    // Current value of field tag i, or null if the page has no such field
+    "function fbValue(i) {\n"
+    "  var field = document.getElementById('x' + i);\n"
+    "  if (field) {\n"
+    "    if (field.type === 'checkbox') return field.checked ? 'true' : 'false';\n"
+    "    if (field.className === 'bitmask-grid') {\n"
+    "      var mask = 0;\n"
+    "      field.querySelectorAll(':checked').forEach(function(b) { mask += Math.pow(2, b.value); });\n"
+    "      return String(mask);\n"
+    "    }\n"
+    "    return field.value || '';\n"
+    "  }\n"
+    "  var rc = document.querySelector('input[name=\"group_x' + i + '\"]:checked');\n"
+    "  return rc ? rc.value : null;\n"
+    "}\n"
+
+    // Visibility rules: [control, value, first, last] shows first..last
+    // only while the control field holds value
+    "function fbShown(i) {\n"
+    "  for (var r = 0; r < fbRules.length; r++) {\n"
+    "    var rule = fbRules[r];\n"
+    "    if (i >= rule[2] && i <= rule[3] && fbValue(rule[0]) !== rule[1]) return false;\n"
+    "  }\n"
+    "  return true;\n"
+    "}\n"
+    "function fbApplyRules() {\n"
+    "  for (var i = fbFirst; i <= fbLast; i++) {\n"
+    "    var el = document.getElementById('x' + i) || document.querySelector('input[name=\"group_x' + i + '\"]');\n"
+    "    var group = el && el.closest('.field-group');\n"
+    "    if (group) group.style.display = fbShown(i) ? '' : 'none';\n"
+    "  }\n"
+    "}\n"
+
+    // JavaScript SendText() function - compact generic loop. Missing and
+    // hidden fields leave an empty slot, which the device skips.
+    "function SendText() {\n"
+    "  var request = new XMLHttpRequest();\n"
+    "  var sep = '__SEP__';\n"
+    "  var netText = '?';\n"
+    "  var first = true;\n"
+    "  for (var i = fbFirst; i <= fbLast; i++) {\n"
+    "    if (!first) netText += sep;\n"
+    "    first = false;\n"
+    "    var value = fbValue(i);\n"
+    "    if (value !== null && fbShown(i)) {\n"
+    "      netText += 'x' + i + '=' + encodeURIComponent(value);\n"
+    "    }\n"
+    "  }\n"
+
+    // Clear form and show success overlay (style matches LiveFormBuilder)
+    "  document.body.innerHTML = '';\n"
+    "  var o = document.createElement('div');\n"
+    "  o.className = 'success-message';\n"
+    "  o.textContent = '\\u2713 Settings Saved';\n"
+    "  document.body.appendChild(o);\n"
+
+    // Send the AJAX request with collected data
+    "  if (!netText.endsWith('?') && !netText.endsWith('&')) {\n"
+    "    netText += '&';\n"
+    "  }\n"
+    "  var nocache = 'nocache=' + Math.random() * 1000000;\n"
+    "  request.open('GET', fbAction + netText + nocache, true);\n"
+    // A lapsed login: reloading the page leads back through /fb/login
+    "  request.onload = function() { if (request.status === 401) location.reload(); };\n"
+    "  request.send(null);\n"
+    "}\n"
+
+    // Apply visibility rules now and whenever a field changes
+    "if (fbRules.length) {\n"
+    "  fbApplyRules();\n"
+    "  document.addEventListener('change', fbApplyRules);\n"
+    "}\n";
+
+static const char FB_PAGE_END[] PROGMEM =
+    "</body>\n"
+    "</html>\n";
+
+// Wire-size budget for the static shell - growing the built-in CSS or
+// script past this fails the build. Raise it deliberately, not by accident.
+#ifndef FORMBUILDER_STATIC_BYTES_BUDGET
+#define FORMBUILDER_STATIC_BYTES_BUDGET 7680
+#endif
+static_assert(sizeof(FB_PAGE_HEAD) + sizeof(FB_STYLE) + sizeof(FB_PAGE_BUTTON) +
+              sizeof(FB_SCRIPT) + sizeof(FB_PAGE_END) - 5 <= FORMBUILDER_STATIC_BYTES_BUDGET,
+              "FormBuilder static page shell exceeds FORMBUILDER_STATIC_BYTES_BUDGET");
+
+/**
+ * 32-bit FNV-1a hash, used for asset ETags and content-hashed URLs
+ */
+uint32_t fbHash(const char* data, size_t length) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (uint8_t)data[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// Route labels for metrics and the access log, indexed by FormRoute
+static const char* const FB_ROUTE_NAMES[FB_ROUTE_COUNT] = { "form", "submit", "static", "metrics", "debug", "probe", "login", "other" };
+
+// Connectivity-check paths requested by operating systems on joining a
+// network; answered with a redirect in captive-portal mode
+static const char* const FB_PROBE_PATHS[] = {
+    "/generate_204",                 // Android, ChromeOS
+    "/gen_204",                      // Android
+    "/hotspot-detect.html",          // Apple
+    "/library/test/success.html",    // Apple, older releases
+    "/connecttest.txt",              // Windows 10 and later
+    "/ncsi.txt",                     // Windows 7 and 8
+    "/redirect",                     // Windows
+    "/canonical.html",               // Firefox
+    "/success.txt",                  // Firefox
+};
+
+// Key for login tokens and password digests, drawn once per boot. It is
+// shared by every builder, so behind a FormDispatcher a token from the
+// builder answering /fb/login is accepted by the others.
+static uint8_t fbLoginKey[32];
+static bool fbLoginKeyReady = false;
+
+#if MBEDTLS_VERSION_MAJOR >= 3
+#define FB_SHA256_STARTS mbedtls_sha256_starts
+#define FB_SHA256_UPDATE mbedtls_sha256_update
+#define FB_SHA256_FINISH mbedtls_sha256_finish
+#else
+#define FB_SHA256_STARTS mbedtls_sha256_starts_ret
+#define FB_SHA256_UPDATE mbedtls_sha256_update_ret
+#define FB_SHA256_FINISH mbedtls_sha256_finish_ret
+#endif
+
+/**
+ * HMAC-SHA256 under the login key (RFC 2104)
+ * The SHA-256 context lives on the stack, so nothing is allocated.
+ */
+static void fbHmac(const uint8_t* data, size_t length, uint8_t mac[32]) {
+    mbedtls_sha256_context sha;
+    uint8_t pad[64];
+    mbedtls_sha256_init(&sha);
+
+    for (int i = 0; i < 64; i++) pad[i] = (i < 32 ? fbLoginKey[i] : 0) ^ 0x36;
+    FB_SHA256_STARTS(&sha, 0);
+    FB_SHA256_UPDATE(&sha, pad, sizeof(pad));
+    FB_SHA256_UPDATE(&sha, data, length);
+    FB_SHA256_FINISH(&sha, mac);
+
+    for (int i = 0; i < 64; i++) pad[i] = (i < 32 ? fbLoginKey[i] : 0) ^ 0x5c;
+    FB_SHA256_STARTS(&sha, 0);
+    FB_SHA256_UPDATE(&sha, pad, sizeof(pad));
+    FB_SHA256_UPDATE(&sha, mac, 32);
+    FB_SHA256_FINISH(&sha, mac);
+    mbedtls_sha256_free(&sha);
+}
+
+/**
+ * Login token for an issue time: the time as 8 hex digits, then the first
+ * 16 bytes of their HMAC in hex
+ */
+static void fbMakeToken(uint32_t issued, char* token) {
+    static const char hex[] = "0123456789abcdef";
+    uint8_t mac[32];
+    for (int i = 0; i < 8; i++) token[i] = hex[(issued >> (28 - 4 * i)) & 0x0f];
+    fbHmac((const uint8_t*)token, 8, mac);
+    for (int i = 0; i < 16; i++) {
+        token[8 + 2 * i] = hex[mac[i] >> 4];
+        token[9 + 2 * i] = hex[mac[i] & 0x0f];
+    }
+    token[FB_TOKEN_LENGTH] = '\0';
+}
 
 /**
  * Constructor
@@ -12,17 +501,101 @@
 FormBuilder::FormBuilder() {
     _server = nullptr;
     _callback = nullptr;
+    _bitmaskCallback = nullptr;
     _formBuilderCallback = nullptr;
     _formCompleteCallback = nullptr;
     _fieldTag = START_FIELD_TAG;
     _numberFields = 0;
+    _ruleCount = 0;
     _pageTitle = "Default Title";
     _customCSS = "";
+    _customCSSHash = 0;
+    _customCSSPath[0] = '\0';
+    _phase = FB_PHASE_IDLE;
+    _phaseStart = 0;
+    memset(_phaseMicros, 0, sizeof(_phaseMicros));
+    memset(&_blockStats, 0, sizeof(_blockStats));
+    _bytesOut = 0;
+    _markupBytes = 0;
+    _fragmentCount = 0;
+    _arenaUsed = 0;
+    _gathering = false;
+    _noDelay = true;
+    _io = &_client;
+#ifdef FORMBUILDER_TLS
+    _tls = nullptr;
+#endif
+    _flushPoints = 0;
+    _worstDecodeNsPerByte = 0;
+    memset(&_latency, 0, sizeof(_latency));
+    for (int r = 0; r < FB_ROUTE_COUNT; r++) {
+        for (int c = 0; c < METRIC_STATUS_COUNT; c++) _metrics.requests[r][c] = 0;
+    }
+    _metrics.bytesIn = 0;
+    _metrics.bytesOut = 0;
+    _metrics.rejected = 0;
+    _metrics.rateLimited = 0;
+    memset(&_metrics.render, 0, sizeof(_metrics.render));
+    memset(&_metrics.decode, 0, sizeof(_metrics.decode));
+    _metricsEnabled = false;
+    _debugEnabled = false;
+    _captivePortal = false;
+    _loginEnabled = false;
+    memset(_loginDigest, 0, sizeof(_loginDigest));
+    _loginFailedAt = 0;
+    _loginBackoff = false;
+#ifdef FORMBUILDER_DEFLATE
+    _compress = false;
+    _deflating = false;
+    _customCSSGzip = nullptr;
+    _customCSSGzipLength = 0;
+#endif
+    _mountCount = 0;
+    _stylesheet = nullptr;
+    _headers.acceptEncodings = 0;
+    _headers.token[0] = '\0';
+    _headers.contentLength = 0;
+    _formCount = 0;
+    _renderedForm = FORM_NONE;
+    _noForm = { "/", "", nullptr, nullptr, nullptr };
+    _activeForm = &_noForm;
+    _silent = false;
+    _measure = false;
+    _sizing = false;
+    _bodyLength = 0;
+    _keepAlive = false;
+    _sharedAssets = false;
+    _slot = 0;
+    _slotCount = 1;
+    _slotsInUse = 0;
+    _accessHead = 0;
+    _accessCount = 0;
+#ifdef FORMBUILDER_FIELD_PROFILE
+    _fieldCostCount = 0;
+#endif
+#if FORMBUILDER_LOG_LEVEL > FB_LOG_NONE
+    _logHead = 0;
+    _logCount = 0;
+#endif
+    _closeLingerMs = 3000;
+    _acceptMicros = 0;
+    _firstByteSent = false;
+#ifdef FORMBUILDER_TRACE
+    _traceHead = 0;
+    _traceCount = 0;
+    _traceCallback = nullptr;
+#endif
+#ifdef FORMBUILDER_ALLOC_STATS
+    memset(&_allocStats, 0, sizeof(_allocStats));
+    _allocBudgetCount = 0;
+    _allocBudgetBytes = 0;
+#endif
     
     // Initialize default values array
     for (int i = 0; i < MAX_FORM_FIELDS; i++) {
         _fieldDefaults[i] = "";
     }
+    memset(_bitmaskFields, 0, sizeof(_bitmaskFields));
     
     clearSettings();
 }
@@ -59,23 +632,562 @@ void FormBuilder::setFormCompleteCallback(FormCompleteCallback callback) {
  * Handle incoming client connections and form submissions
  */
 void FormBuilder::handleClient() {
+    // Time the whole call - this is how long loop() is held up
+    unsigned long callStart = micros();
+    _phase = FB_PHASE_IDLE;
+    _phaseStart = callStart;
+    memset(_phaseMicros, 0, sizeof(_phaseMicros));
+
+    acceptClient();
+    recordBlock(callStart);
+}
+
+/**
+ * Record how long one call held up loop(), and its slowest phase
+ */
+void FormBuilder::recordBlock(unsigned long callStart) {
+    setPhase(FB_PHASE_IDLE);
+    uint32_t elapsed = micros() - callStart;
+    _blockStats.calls.record(elapsed);
+    if (elapsed >= _blockStats.maxMicros) {
+        uint8_t worst = FB_PHASE_IDLE;
+        for (uint8_t i = 1; i < FB_PHASE_COUNT; i++) {
+            if (_phaseMicros[i] > _phaseMicros[worst]) worst = i;
+        }
+        _blockStats.maxMicros = elapsed;
+        _blockStats.maxPhase = (FormPhase)worst;
+    }
+}
+
+/**
+ * Accept and serve one pending client, if any
+ */
+void FormBuilder::acceptClient() {
     if (!_server) return;
     if (!_server->hasClient()) return;
     
+#ifdef FORMBUILDER_ALLOC_STATS
+    beginAllocStats();
+#endif
+    setPhase(FB_PHASE_ACCEPT);
+    _bytesOut = 0;
+    _markupBytes = 0;
+    _firstByteSent = false;
+    _acceptMicros = micros();
+    _slot = 0;
     _client = _server->accept();
     if (_client) {
+        _client.setNoDelay(_noDelay);
+#ifdef FORMBUILDER_TLS
+        // The handshake is timed on its own; request latency starts after it
+        if (_tls) {
+            unsigned long handshakeStart = micros();
+            if (!_tls->accept(_client)) {
+                FB_LOGW("TLS handshake failed after %d ms", (int)((micros() - handshakeStart) / 1000));
+                _latency.errors++;
+                _client.stop();
+                setPhase(FB_PHASE_IDLE);
+#ifdef FORMBUILDER_ALLOC_STATS
+                endAllocStats();
+#endif
+                return;
+            }
+            _acceptMicros = micros();
+            _latency.handshake.record(_acceptMicros - handshakeStart);
+            if (_tls->wasResumed()) _latency.resumed++;
+            _io = _tls;
+        }
+#endif
+        FB_TRACE_BEGIN(FB_TRACE_ACCEPT, 0);
+        _latency.requests++;
         unsigned long waitStart = millis();
-        while (!_client.available() && _client.connected()) {
+        while (!_io->available() && _io->connected()) {
             if (millis() - waitStart > 2000) break;
             yield();
         }
-        if (_client.available()) {
+        if (_io->available()) {
+            FB_TRACE_INSTANT(FB_TRACE_FIRST_BYTE_IN);
             getParameters();
         } else {
-            _client.stop();
+            FB_LOGW("client sent nothing within %d ms", 2000);
+            _latency.errors++;
+            _io->stop();
+        }
+        FB_TRACE_END(FB_TRACE_ACCEPT, 0);
+        _io = &_client;
+    }
+    setPhase(FB_PHASE_IDLE);
+#ifdef FORMBUILDER_ALLOC_STATS
+    endAllocStats();
+#endif
+}
+
+/**
+ * Serve a request accepted and read by a FormDispatcher
+ * @param client Connection, left open for the dispatcher to release
+ * @param requestLine HTTP request line; headers have already been consumed
+ * @param slot Dispatcher connection slot, recorded in the access log
+ * @param acceptMicros micros() when the dispatcher accepted the connection
+ * @param keepAlive The client allows the connection to be reused
+ * @return true if the response leaves the connection open for another request
+ */
+bool FormBuilder::serveDispatched(WiFiClient& client, const String& requestLine, uint8_t slot,
+                                  unsigned long acceptMicros, bool keepAlive) {
+    unsigned long callStart = micros();
+    _phase = FB_PHASE_HEADERS;
+    _phaseStart = callStart;
+    memset(_phaseMicros, 0, sizeof(_phaseMicros));
+#ifdef FORMBUILDER_ALLOC_STATS
+    beginAllocStats();
+#endif
+    _client = client;
+    _client.setNoDelay(_noDelay);
+    _slot = slot;
+    _bytesOut = 0;
+    _markupBytes = 0;
+    _firstByteSent = false;
+    _acceptMicros = acceptMicros;
+    _keepAlive = keepAlive;
+    _latency.requests++;
+    FB_TRACE_BEGIN(FB_TRACE_ACCEPT, slot);
+    handleRequest(requestLine);
+    FB_TRACE_END(FB_TRACE_ACCEPT, slot);
+    bool open = _keepAlive && _io->connected();
+    _keepAlive = false;
+    _client = WiFiClient();
+#ifdef FORMBUILDER_ALLOC_STATS
+    endAllocStats();
+#endif
+    recordBlock(callStart);
+    return open;
+}
+
+/**
+ * Get request latency histograms and error counts
+ */
+const FormLatencyStats& FormBuilder::getLatencyStats() const {
+    return _latency;
+}
+
+/**
+ * Clear latency histograms and counters
+ */
+void FormBuilder::resetLatencyStats() {
+    memset(&_latency, 0, sizeof(_latency));
+}
+
+#ifdef FORMBUILDER_TRACE
+/**
+ * Forward every trace record to a callback as it happens
+ */
+void FormBuilder::setTraceCallback(FormTraceCallback callback) {
+    _traceCallback = callback;
+}
+
+/**
+ * Append a trace record to the ring buffer
+ */
+void FormBuilder::traceEvent(FormTraceEvent event, char phase, uint16_t arg) {
+#if defined(ESP32)
+    uint32_t now = ESP.getCycleCount();
+#else
+    uint32_t now = (uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+    TraceRecord& rec = _trace[_traceHead];
+    rec.timestamp = now;
+    rec.arg = arg;
+    rec.event = event;
+    rec.phase = phase;
+    _traceHead = (_traceHead + 1) % FORMBUILDER_TRACE_SIZE;
+    if (_traceCount < FORMBUILDER_TRACE_SIZE) _traceCount++;
+
+    if (_traceCallback) _traceCallback(event, phase, now, arg);
+}
+
+/**
+ * Write the trace ring buffer as Chrome trace JSON
+ * Timestamps are relative to the oldest record, in microseconds
+ */
+void FormBuilder::dumpTrace(Print& out) {
+    static const char* const names[FB_TRACE_EVENT_COUNT] = {
+        "accept", "first_byte_in", "headers_parsed", "builder",
+        "first_byte_out", "last_byte_out", "decode", "callback"
+    };
+#if defined(ESP32)
+    uint32_t ticksPerMicro = getCpuFrequencyMhz();
+#else
+    uint32_t ticksPerMicro = 1;
+#endif
+    uint16_t first = (_traceHead + FORMBUILDER_TRACE_SIZE - _traceCount) % FORMBUILDER_TRACE_SIZE;
+    uint32_t origin = _trace[first].timestamp;
+
+    out.print("{\"traceEvents\":[");
+    for (uint16_t i = 0; i < _traceCount; i++) {
+        const TraceRecord& rec = _trace[(first + i) % FORMBUILDER_TRACE_SIZE];
+        uint32_t ticks = rec.timestamp - origin;
+        out.printf("%s\n{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%u.%02u,\"pid\":1,\"tid\":1",
+                   i ? "," : "", names[rec.event], rec.phase,
+                   (unsigned)(ticks / ticksPerMicro),
+                   (unsigned)((ticks % ticksPerMicro) * 100 / ticksPerMicro));
+        if (rec.phase == 'i') out.print(",\"s\":\"t\"");
+        if (rec.arg) out.printf(",\"args\":{\"field\":%u}", rec.arg);
+        out.print("}");
+    }
+    out.println("\n]}");
+}
+#endif
+
+/**
+ * Enable or disable the /fb/metrics endpoint
+ */
+void FormBuilder::enableMetrics(bool enable) {
+    _metricsEnabled = enable;
+}
+
+// Status codes tracked per route; the final 0 slot collects any other code
+constexpr uint16_t FormBuilder::METRIC_STATUS_CODES[];
+
+/**
+ * Enable or disable the /fb/ diagnostic endpoints
+ */
+void FormBuilder::enableDebugEndpoints(bool enable) {
+    _debugEnabled = enable;
+}
+
+#ifdef FORMBUILDER_DEFLATE
+/**
+ * Gzip form pages for browsers that accept it
+ */
+void FormBuilder::enableCompression(bool enable) {
+    _compress = enable;
+}
+#endif
+
+/**
+ * Answer captive-portal probes
+ */
+void FormBuilder::enableCaptivePortal(bool enable) {
+    _captivePortal = enable;
+}
+
+/**
+ * Require a login before the form is shown or a submit is accepted
+ */
+void FormBuilder::enableLogin(const char* password) {
+    _loginEnabled = password && password[0];
+    if (!_loginEnabled) return;
+    if (!fbLoginKeyReady) {
+        esp_fill_random(fbLoginKey, sizeof(fbLoginKey));
+        fbLoginKeyReady = true;
+    }
+    fbHmac((const uint8_t*)password, strlen(password), _loginDigest);
+}
+
+#ifdef FORMBUILDER_FIELD_PROFILE
+/**
+ * Record the cost of the field just rendered
+ */
+void FormBuilder::recordFieldCost(FormFieldType type, unsigned long start, size_t startBytes) {
+    if (_silent || _fieldCostCount >= FORMBUILDER_FIELD_PROFILE_SIZE) return;
+    FormFieldCost& cost = _fieldCosts[_fieldCostCount++];
+    cost.fieldIndex = (type == FB_FIELD_SUBHEADING) ? 0 : _numberFields;
+    cost.type = type;
+    cost.bytes = _markupBytes - startBytes;
+    cost.micros = micros() - start;
+}
+
+/**
+ * Get the render cost of each field in the most recent page
+ */
+const FormFieldCost* FormBuilder::getFieldCosts(uint16_t& count) const {
+    count = _fieldCostCount;
+    return _fieldCosts;
+}
+
+/**
+ * Write the field cost report, sorted by bytes (then time), largest first
+ */
+size_t FormBuilder::printFieldCosts(Print& out) {
+    static const char* const typeNames[FB_FIELD_TYPE_COUNT] = {
+        "subheading", "text", "password", "dropdown", "dropdown_range", "number",
+        "range", "color", "time", "checkbox", "radio", "hidden", "bitmask"
+    };
+
+    // Sort an index array rather than the entries, so form order is kept
+    uint16_t order[FORMBUILDER_FIELD_PROFILE_SIZE];
+    uint32_t totalBytes = 0;
+    uint32_t totalMicros = 0;
+    for (uint16_t i = 0; i < _fieldCostCount; i++) {
+        const FormFieldCost& cost = _fieldCosts[i];
+        uint16_t j = i;
+        while (j > 0) {
+            const FormFieldCost& prev = _fieldCosts[order[j - 1]];
+            if (prev.bytes > cost.bytes || (prev.bytes == cost.bytes && prev.micros >= cost.micros)) break;
+            order[j] = order[j - 1];
+            j--;
         }
+        order[j] = i;
+        totalBytes += cost.bytes;
+        totalMicros += cost.micros;
+    }
+
+    size_t n = out.printf("%-5s %-6s %-15s %8s %8s\n", "rank", "field", "type", "bytes", "us");
+    for (uint16_t i = 0; i < _fieldCostCount; i++) {
+        const FormFieldCost& cost = _fieldCosts[order[i]];
+        n += out.printf("%-5u %-6u %-15s %8u %8u\n", (unsigned)(i + 1), (unsigned)cost.fieldIndex,
+                        typeNames[cost.type], (unsigned)cost.bytes, (unsigned)cost.micros);
+    }
+    n += out.printf("total %u fields, %u bytes, %u us\n", (unsigned)_fieldCostCount,
+                    (unsigned)totalBytes, (unsigned)totalMicros);
+    return n;
+}
+#endif
+
+#if FORMBUILDER_LOG_LEVEL > FB_LOG_NONE
+/**
+ * Append a log record; the message is formatted only when read
+ */
+void FormBuilder::logRecord(uint8_t level, const char* format, int32_t arg0, int32_t arg1) {
+    LogRecord& rec = _log[_logHead];
+    rec.millis = millis();
+    rec.format = format;
+    rec.args[0] = arg0;
+    rec.args[1] = arg1;
+    rec.level = level;
+    _logHead = (_logHead + 1) % FORMBUILDER_LOG_SIZE;
+    if (_logCount < FORMBUILDER_LOG_SIZE) _logCount++;
+}
+
+/**
+ * Write the log ring buffer, oldest first
+ */
+size_t FormBuilder::printLog(Print& out) {
+    static const char levelNames[] = "-EWID";
+    uint16_t first = (_logHead + FORMBUILDER_LOG_SIZE - _logCount) % FORMBUILDER_LOG_SIZE;
+    size_t n = 0;
+    for (uint16_t i = 0; i < _logCount; i++) {
+        const LogRecord& rec = _log[(first + i) % FORMBUILDER_LOG_SIZE];
+        n += out.printf("[%10u] %c ", (unsigned)rec.millis, levelNames[rec.level]);
+        n += out.printf(rec.format, rec.args[0], rec.args[1]);
+        n += out.print('\n');
+    }
+    return n;
+}
+#endif
+
+/**
+ * Map an HTTP status code to its metrics slot
+ */
+uint8_t FormBuilder::statusIndex(uint16_t status) {
+    for (uint8_t i = 0; i < METRIC_STATUS_COUNT; i++) {
+        if (METRIC_STATUS_CODES[i] == status) return i;
+    }
+    return METRIC_STATUS_COUNT - 1;
+}
+
+/**
+ * Write one histogram in Prometheus text format (seconds)
+ */
+static size_t writeHistogram(Print& out, const char* name, const char* help, const FormHistogram& hist) {
+    size_t n = out.printf("# HELP %s %s\n# TYPE %s histogram\n", name, help, name);
+    uint32_t cumulative = 0;
+    for (int i = 0; i < FB_HIST_BUCKETS; i++) {
+        cumulative += hist.buckets[i];
+        uint32_t le = 2UL << i;
+        n += out.printf("%s_bucket{le=\"%u.%06u\"} %u\n", name,
+                        (unsigned)(le / 1000000), (unsigned)(le % 1000000), (unsigned)cumulative);
+    }
+    n += out.printf("%s_bucket{le=\"+Inf\"} %u\n", name, (unsigned)hist.count);
+    n += out.printf("%s_sum %u.%06u\n", name,
+                    (unsigned)(hist.sumMicros / 1000000), (unsigned)(hist.sumMicros % 1000000));
+    n += out.printf("%s_count %u\n", name, (unsigned)hist.count);
+    return n;
+}
+
+/**
+ * Write all metrics in Prometheus text exposition format
+ */
+size_t FormBuilder::writeMetrics(Print& out) {
+    size_t n = 0;
+
+    n += out.print("# HELP formbuilder_requests_total Requests handled, by route and status\n"
+                   "# TYPE formbuilder_requests_total counter\n");
+    for (int r = 0; r < FB_ROUTE_COUNT; r++) {
+        for (int c = 0; c < METRIC_STATUS_COUNT; c++) {
+            uint32_t count = _metrics.requests[r][c];
+            if (count == 0) continue;
+            if (METRIC_STATUS_CODES[c] == 0) {
+                n += out.printf("formbuilder_requests_total{route=\"%s\",code=\"other\"} %u\n",
+                                FB_ROUTE_NAMES[r], (unsigned)count);
+            } else {
+                n += out.printf("formbuilder_requests_total{route=\"%s\",code=\"%u\"} %u\n",
+                                FB_ROUTE_NAMES[r], METRIC_STATUS_CODES[c], (unsigned)count);
+            }
+        }
+    }
+
+    n += out.printf("# HELP formbuilder_received_bytes_total Request bytes read\n"
+                    "# TYPE formbuilder_received_bytes_total counter\n"
+                    "formbuilder_received_bytes_total %u\n", (unsigned)_metrics.bytesIn);
+    n += out.printf("# HELP formbuilder_sent_bytes_total Response bytes written\n"
+                    "# TYPE formbuilder_sent_bytes_total counter\n"
+                    "formbuilder_sent_bytes_total %u\n", (unsigned)_metrics.bytesOut);
+    n += out.printf("# HELP formbuilder_rejected_total Requests rejected for size or malformed input\n"
+                    "# TYPE formbuilder_rejected_total counter\n"
+                    "formbuilder_rejected_total %u\n", (unsigned)_metrics.rejected);
+    n += out.printf("# HELP formbuilder_rate_limited_total Login attempts refused during the back-off after a wrong password\n"
+                    "# TYPE formbuilder_rate_limited_total counter\n"
+                    "formbuilder_rate_limited_total %u\n", (unsigned)_metrics.rateLimited);
+
+    n += writeHistogram(out, "formbuilder_render_seconds", "Form render time", _metrics.render);
+    n += writeHistogram(out, "formbuilder_decode_seconds", "Submit decode time including callbacks", _metrics.decode);
+    n += writeHistogram(out, "formbuilder_handle_client_seconds", "Time each handleClient() call blocked loop()", _blockStats.calls);
+#ifdef FORMBUILDER_TLS
+    n += writeHistogram(out, "formbuilder_tls_handshake_seconds", "TLS handshake time", _latency.handshake);
+    n += out.printf("# HELP formbuilder_tls_resumed_total TLS handshakes that resumed a session\n"
+                    "# TYPE formbuilder_tls_resumed_total counter\n"
+                    "formbuilder_tls_resumed_total %u\n", (unsigned)_latency.resumed);
+#endif
+
+    // A dispatcher owns the connections: report its slots, counted when this request was routed
+    unsigned slotsInUse = _sharedAssets ? _slotsInUse : (_client ? 1u : 0u);
+    n += out.printf("# HELP formbuilder_connection_slots Connection slots\n"
+                    "# TYPE formbuilder_connection_slots gauge\n"
+                    "formbuilder_connection_slots %u\n"
+                    "# HELP formbuilder_connection_slots_in_use Connection slots holding a client\n"
+                    "# TYPE formbuilder_connection_slots_in_use gauge\n"
+                    "formbuilder_connection_slots_in_use %u\n", (unsigned)_slotCount, slotsInUse);
+
+    n += out.printf("# HELP formbuilder_heap_free_bytes Free heap\n"
+                    "# TYPE formbuilder_heap_free_bytes gauge\n"
+                    "formbuilder_heap_free_bytes %u\n"
+                    "# HELP formbuilder_heap_min_free_bytes Lowest free heap since boot\n"
+                    "# TYPE formbuilder_heap_min_free_bytes gauge\n"
+                    "formbuilder_heap_min_free_bytes %u\n"
+                    "# HELP formbuilder_heap_max_alloc_bytes Largest allocatable block\n"
+                    "# TYPE formbuilder_heap_max_alloc_bytes gauge\n"
+                    "formbuilder_heap_max_alloc_bytes %u\n",
+                    (unsigned)ESP.getFreeHeap(), (unsigned)ESP.getMinFreeHeap(),
+                    (unsigned)ESP.getMaxAllocHeap());
+    return n;
+}
+
+/**
+ * Add one duration to the histogram
+ */
+void FormHistogram::record(uint32_t us) {
+    int bucket = 0;
+    while (bucket < FB_HIST_BUCKETS - 1 && (us >> (bucket + 1)) != 0) bucket++;
+    buckets[bucket]++;
+    count++;
+    sumMicros += us;
+    if (us > maxMicros) maxMicros = us;
+}
+
+/**
+ * Estimate a percentile as the upper bound of the bucket that holds it
+ */
+uint32_t FormHistogram::percentile(uint8_t pct) const {
+    if (count == 0) return 0;
+    uint32_t target = ((uint64_t)count * pct + 99) / 100;
+    if (target == 0) target = 1;
+    uint32_t seen = 0;
+    for (int i = 0; i < FB_HIST_BUCKETS; i++) {
+        seen += buckets[i];
+        if (seen >= target) {
+            uint32_t upper = (2UL << i) - 1;
+            return upper < maxMicros ? upper : maxMicros;
+        }
+    }
+    return maxMicros;
+}
+
+/**
+ * Reset all counts
+ */
+void FormHistogram::clear() {
+    memset(this, 0, sizeof(*this));
+}
+
+/**
+ * Get handleClient() blocking-time statistics
+ */
+const FormBlockStats& FormBuilder::getBlockStats() const {
+    return _blockStats;
+}
+
+/**
+ * Clear handleClient() blocking-time statistics
+ */
+void FormBuilder::resetBlockStats() {
+    memset(&_blockStats, 0, sizeof(_blockStats));
+}
+
+/**
+ * Record the phase of the request currently being handled
+ */
+void FormBuilder::setPhase(FormPhase phase) {
+    unsigned long now = micros();
+    _phaseMicros[_phase] += now - _phaseStart;
+    _phaseStart = now;
+    _phase = phase;
+#ifdef FORMBUILDER_ALLOC_STATS
+    fbAllocPhase = phase;
+#endif
+}
+
+#ifdef FORMBUILDER_ALLOC_STATS
+/**
+ * Set the per-request allocation budget
+ */
+void FormBuilder::setAllocBudget(uint32_t maxAllocs, uint32_t maxPeakBytes) {
+    _allocBudgetCount = maxAllocs;
+    _allocBudgetBytes = maxPeakBytes;
+}
+
+/**
+ * Get allocation statistics for the most recent request
+ */
+const FormAllocStats& FormBuilder::getAllocStats() const {
+    return _allocStats;
+}
+
+/**
+ * Reset statistics and start attributing allocations to this instance
+ */
+void FormBuilder::beginAllocStats() {
+    memset(&_allocStats, 0, sizeof(_allocStats));
+    fbLiveBytes = 0;
+#if defined(ESP32)
+    fbAllocTask = xTaskGetCurrentTaskHandle();
+#endif
+    fbAllocTarget = &_allocStats;
+}
+
+/**
+ * Stop attributing allocations and check the request against the budget
+ */
+void FormBuilder::endAllocStats() {
+    fbAllocTarget = nullptr;
+
+    for (int i = 0; i < FB_PHASE_COUNT; i++) {
+        _allocStats.totalAllocs += _allocStats.allocCount[i];
+        if (_allocStats.peakBytes[i] > _allocStats.totalPeakBytes) {
+            _allocStats.totalPeakBytes = _allocStats.peakBytes[i];
+        }
+    }
+
+    _allocStats.budgetExceeded =
+        (_allocBudgetCount > 0 && _allocStats.totalAllocs > _allocBudgetCount) ||
+        (_allocBudgetBytes > 0 && _allocStats.totalPeakBytes > _allocBudgetBytes);
+
+    if (_allocStats.budgetExceeded) {
+        FB_LOGW("allocation budget exceeded: %u allocs, %u peak bytes",
+                _allocStats.totalAllocs, _allocStats.totalPeakBytes);
     }
 }
+#endif
 
 /**
  * Clean up and free resources when form functionality no longer needed
@@ -93,9 +1205,21 @@ void FormBuilder::cleanup() {
     
     // Clear callbacks
     _callback = nullptr;
+    _bitmaskCallback = nullptr;
     _formBuilderCallback = nullptr;
     _formCompleteCallback = nullptr;
+    for (int i = 0; i < _formCount; i++) {
+        _forms[i].title = String();
+    }
+    _formCount = 0;
+    _renderedForm = FORM_NONE;
     
+#ifdef FORMBUILDER_DEFLATE
+    free(_customCSSGzip);
+    _customCSSGzip = nullptr;
+    _customCSSGzipLength = 0;
+#endif
+
     // Clear all settings and strings
     clearSettings();
     _pageTitle = "";
@@ -108,6 +1232,12 @@ void FormBuilder::cleanup() {
     for (int i = 0; i < MAX_FORM_FIELDS; i++) {
         _fieldDefaults[i] = "";
     }
+    memset(_bitmaskFields, 0, sizeof(_bitmaskFields));
+    
+    for (int i = 0; i < MAX_FORM_RULES; i++) {
+        _rules[i].value = String();
+    }
+    _ruleCount = 0;
     
     // Force garbage collection of any String objects
     _settings.fieldPrompt = String();
@@ -129,29 +1259,63 @@ void FormBuilder::setTitle(String title) {
  */
 void FormBuilder::addCustomCSS(String css) {
     _customCSS = css;
+    _customCSSHash = fbHash(css.c_str(), css.length());
+    snprintf(_customCSSPath, sizeof(_customCSSPath), "/fb/c-%08x.css", (unsigned)_customCSSHash);
+
+#ifdef FORMBUILDER_DEFLATE
+    // Compress once, served to every client that accepts gzip
+    free(_customCSSGzip);
+    _customCSSGzipLength = 0;
+    _customCSSGzip = _deflate.compressCopy((const uint8_t*)css.c_str(), css.length(), _customCSSGzipLength);
+#endif
+}
+
+/**
+ * Link a stylesheet after the built-in and custom CSS
+ */
+void FormBuilder::setStylesheet(const char* href) {
+    _stylesheet = href;
+}
+
+/**
+ * Serve files from a filesystem under a URL prefix
+ */
+bool FormBuilder::serveStatic(const char* uri, fs::FS& fs, const char* path, const char* cacheControl) {
+    if (_mountCount >= MAX_STATIC_MOUNTS || !uri || uri[0] != '/') return false;
+    StaticMount& mount = _mounts[_mountCount++];
+    mount.uri = uri;
+    mount.fs = &fs;
+    mount.path = path;
+    mount.cacheControl = cacheControl;
+    return true;
 }
 
 /**
  * Add a subheading to organize form sections
  */
 void FormBuilder::addSubheading(String text) {
+    FB_PROFILE_BEGIN();
     renderSubheading(text);
+    FB_PROFILE_END(FB_FIELD_SUBHEADING);
 }
 
 /**
  * Add a text input field to the form
  */
 void FormBuilder::addText(String prompt, String defaultValue) {
+    FB_PROFILE_BEGIN();
     clearSettings();
     _settings.fieldPrompt = prompt;
     _settings.textDefault = defaultValue;
     renderTextInput();
+    FB_PROFILE_END(FB_FIELD_TEXT);
 }
 
 /**
  * Add a dropdown field with comma-separated options
  */
 void FormBuilder::addDropDown(String prompt, String options, int defaultIndex, bool returnText) {
+    FB_PROFILE_BEGIN();
     clearSettings();
     _settings.fieldPrompt = prompt;
     
@@ -179,12 +1343,14 @@ void FormBuilder::addDropDown(String prompt, String options, int defaultIndex, b
     _settings.returnPrompts = returnText;
     
     renderDropdown();
+    FB_PROFILE_END(FB_FIELD_DROPDOWN);
 }
 
 /**
  * Add a range dropdown (e.g., 0-23 for hours)
  */
 void FormBuilder::addDropDownRange(String prompt, int minVal, int maxVal, int defaultValue) {
+    FB_PROFILE_BEGIN();
     clearSettings();
     _settings.fieldPrompt = prompt;
     _settings.rangeMin = minVal;
@@ -198,12 +1364,14 @@ void FormBuilder::addDropDownRange(String prompt, int minVal, int maxVal, int de
     _settings.valid[1] = maxVal;
     
     renderDropdown();
+    FB_PROFILE_END(FB_FIELD_DROPDOWN_RANGE);
 }
 
 /**
  * Add a color picker field
  */
 void FormBuilder::addColorPicker(String prompt, int defaultColor) {
+    FB_PROFILE_BEGIN();
     clearSettings();
     _settings.fieldPrompt = prompt;
     _settings.colorDefault = defaultColor;
@@ -222,12 +1390,14 @@ void FormBuilder::addColorPicker(String prompt, int defaultColor) {
     _settings.isColorPicker = true;
     
     renderColorPicker();
+    FB_PROFILE_END(FB_FIELD_COLOR);
 }
 
 /**
  * Add a number input field with range validation
  */
 void FormBuilder::addNumber(String prompt, int minVal, int maxVal, int step, int defaultValue) {
+    FB_PROFILE_BEGIN();
     clearSettings();
     _settings.fieldPrompt = prompt;
     _settings.isNumberInput = true;
@@ -237,12 +1407,14 @@ void FormBuilder::addNumber(String prompt, int minVal, int maxVal, int step, int
     _settings.numberDefault = defaultValue;
     
     renderNumberInput();
+    FB_PROFILE_END(FB_FIELD_NUMBER);
 }
 
 /**
  * Add a range slider for numeric values
  */
 void FormBuilder::addRange(String prompt, int minVal, int maxVal, int step, int defaultValue) {
+    FB_PROFILE_BEGIN();
     clearSettings();
     _settings.fieldPrompt = prompt;
     _settings.isRangeSlider = true;
@@ -252,12 +1424,14 @@ void FormBuilder::addRange(String prompt, int minVal, int maxVal, int step, int
     _settings.rangeDefault = defaultValue;
     
     renderRangeSlider();
+    FB_PROFILE_END(FB_FIELD_RANGE);
 }
 
 /**
  * Add a time picker input
  */
 void FormBuilder::addTime(String prompt, int defaultTime, bool includeSeconds) {
+    FB_PROFILE_BEGIN();
     clearSettings();
     _settings.fieldPrompt = prompt;
     _settings.isTimeInput = true;
@@ -278,36 +1452,42 @@ void FormBuilder::addTime(String prompt, int defaultTime, bool includeSeconds) {
     _settings.timeIncludeSeconds = includeSeconds;
     
     renderTimeInput();
+    FB_PROFILE_END(FB_FIELD_TIME);
 }
 
 /**
  * Add a password input field
  */
 void FormBuilder::addPassword(String prompt, String defaultValue) {
+    FB_PROFILE_BEGIN();
     clearSettings();
     _settings.fieldPrompt = prompt;
     _settings.textDefault = defaultValue;
     _settings.isPasswordInput = true;
     
     renderPasswordInput();
+    FB_PROFILE_END(FB_FIELD_PASSWORD);
 }
 
 /**
  * Add a checkbox input
  */
 void FormBuilder::addCheckbox(String prompt, bool defaultChecked) {
+    FB_PROFILE_BEGIN();
     clearSettings();
     _settings.fieldPrompt = prompt;
     _settings.isCheckbox = true;
     _settings.checkboxDefault = defaultChecked;
     
     renderCheckbox();
+    FB_PROFILE_END(FB_FIELD_CHECKBOX);
 }
 
 /**
  * Add a radio button group with comma-separated options
  */
 void FormBuilder::addRadio(String prompt, String options, int defaultIndex, bool returnText) {
+    FB_PROFILE_BEGIN();
     clearSettings();
     _settings.fieldPrompt = prompt;
     
@@ -335,15 +1515,73 @@ void FormBuilder::addRadio(String prompt, String options, int defaultIndex, bool
     _settings.returnPrompts = returnText;
     
     renderRadio();
+    FB_PROFILE_END(FB_FIELD_RADIO);
+}
+
+/**
+ * Add a grid of checkboxes submitted as one integer
+ */
+void FormBuilder::addBitmask(String prompt, String labels, uint32_t defaultMask) {
+    FB_PROFILE_BEGIN();
+    clearSettings();
+    _settings.fieldPrompt = prompt;
+
+    // Parse comma-separated labels, one per bit
+    int labelCount = 0;
+    int lastComma = -1;
+    int nextComma = 0;
+
+    while (nextComma != -1 && labelCount < MAX_FIELD_OPTIONS && labelCount < 32) {
+        nextComma = labels.indexOf(',', lastComma + 1);
+        String label;
+        if (nextComma == -1) {
+            label = labels.substring(lastComma + 1);
+        } else {
+            label = labels.substring(lastComma + 1, nextComma);
+        }
+        label.trim();
+        _settings.fieldOptions[labelCount] = label;
+        labelCount++;
+        lastComma = nextComma;
+    }
+
+    _settings.isBitmask = true;
+    _settings.bitmaskDefault = defaultMask;
+
+    renderBitmask();
+    FB_PROFILE_END(FB_FIELD_BITMASK);
+}
+
+/**
+ * Set the callback for addBitmask() fields
+ */
+void FormBuilder::setBitmaskCallback(FormBitmaskCallback callback) {
+    _bitmaskCallback = callback;
 }
 
 /**
  * Add a hidden form field (invisible, preserves field numbering)
  */
 void FormBuilder::addHidden(String defaultValue) {
+    FB_PROFILE_BEGIN();
     clearSettings();
     _settings.textDefault = defaultValue;
     renderHidden();
+    FB_PROFILE_END(FB_FIELD_HIDDEN);
+}
+
+/**
+ * Show a range of fields only while another field holds a given value
+ */
+bool FormBuilder::showFieldsWhen(int first, int last, int field, String value) {
+    if (_ruleCount >= MAX_FORM_RULES) return false;
+    if (first < 1 || last < first || last > MAX_FORM_FIELDS || field < 1 || field > MAX_FORM_FIELDS) return false;
+    VisibilityRule& rule = _rules[_ruleCount++];
+    rule.field = field;
+    rule.first = first;
+    rule.last = last;
+    rule.value = value;
+    return true;
 }
 
 /**
@@ -373,13 +1611,40 @@ void FormBuilder::clearSettings() {
     _settings.isCheckbox = false;
     _settings.checkboxDefault = false;
     _settings.isRadio = false;
+    _settings.isBitmask = false;
+    _settings.bitmaskDefault = 0;
 }
 
 /**
  * Render subheading to HTML form
  */
 void FormBuilder::renderSubheading(String text) {
-    _client.println("<h2 class=\"subheading\">" + text + "</h2>");
+    emit("<h2 class=\"subheading\">");
+    emit(text);
+    emit("</h2>\n");
+}
+
+/**
+ * Heading and label that open most fields
+ */
+void FormBuilder::emitFieldStart() {
+    if (_settings.heading != "") {
+        emit("<h2>");
+        emit(_settings.heading);
+        emit("</h2>\n");
+    }
+    emit("<div class=\"field-group\">\n"
+         "<label class=\"field-label\">");
+    emit(_settings.fieldPrompt);
+    emit("</label>\n");
+}
+
+/**
+ * Field id of the field being rendered, "x" and its tag
+ */
+void FormBuilder::emitFieldId() {
+    emit("x");
+    emitNumber(_fieldTag);
 }
 
 /**
@@ -390,7 +1655,6 @@ void FormBuilder::renderDropdown() {
     
     _fieldTag++;
     _numberFields++;
-    String fieldId = "x" + String(_fieldTag);
 
     // Store default value for change detection
     if (_settings.isRangeDropdown) {
@@ -403,18 +1667,19 @@ void FormBuilder::renderDropdown() {
         }
     }
 
-    if (_settings.heading != "") _client.println("<h2>" + _settings.heading + "</h2>");
-
-    // Create field group container
-    _client.println("<div class=\"field-group\">");
-    _client.println("<label class=\"field-label\">" + _settings.fieldPrompt + "</label>");
-    _client.println("<select id=\"" + fieldId + "\">");
+    emitFieldStart();
+    emit("<select id=\"");
+    emitFieldId();
+    emit("\">\n");
 
     if (_settings.isRangeDropdown) {
         // Generate range options
         for (int option = _settings.rangeMin; option <= _settings.rangeMax; option++) {
-            String sel = (option == _settings.rangeDefault) ? " selected" : "";
-            _client.println("<option value=\"" + String(option) + "\"" + sel + ">" + String(option) + "</option>");
+            emit("<option value=\"");
+            emitNumber(option);
+            emit(option == _settings.rangeDefault ? "\" selected>" : "\">");
+            emitNumber(option);
+            emit("</option>\n");
         }
     } else {
         // Use predefined options
@@ -423,15 +1688,17 @@ void FormBuilder::renderDropdown() {
             if (_settings.fieldOptions[option].length() == 0) continue;
             
             // Use actual text as value if returnPrompts is true, otherwise use index
-            String optVal = _settings.returnPrompts ? _settings.fieldOptions[option] : String(option);
-            String optText = _settings.fieldOptions[option];
-            String sel = (option == _settings.numDefault) ? " selected" : "";
-            _client.println("<option value=\"" + optVal + "\"" + sel + ">" + optText + "</option>");
+            emit("<option value=\"");
+            if (_settings.returnPrompts) emit(_settings.fieldOptions[option]);
+            else emitNumber(option);
+            emit(option == _settings.numDefault ? "\" selected>" : "\">");
+            emit(_settings.fieldOptions[option]);
+            emit("</option>\n");
         }
     }
 
-    _client.println("</select>");
-    _client.println("</div>");
+    emit("</select>\n"
+         "</div>\n");
 }
 
 /**
@@ -442,18 +1709,17 @@ void FormBuilder::renderTextInput() {
     
     _fieldTag++;
     _numberFields++;
-    String fieldId = "x" + String(_fieldTag);
 
     // Store default value for change detection
     _fieldDefaults[_numberFields - 1] = _settings.textDefault;
 
-    if (_settings.heading != "") _client.println("<h2>" + _settings.heading + "</h2>");
-
-    // Create field group container
-    _client.println("<div class=\"field-group\">");
-    _client.println("<label class=\"field-label\">" + _settings.fieldPrompt + "</label>");
-    _client.println("<input type='text' id='" + fieldId + "' value='" + _settings.textDefault + "'>");
-    _client.println("</div>");
+    emitFieldStart();
+    emit("<input type='text' id='");
+    emitFieldId();
+    emit("' value='");
+    emit(_settings.textDefault);
+    emit("'>\n"
+         "</div>\n");
 }
 
 /**
@@ -464,18 +1730,17 @@ void FormBuilder::renderColorPicker() {
     
     _fieldTag++;
     _numberFields++;
-    String fieldId = "x" + String(_fieldTag);
 
     // Store default value for change detection (as integer string)
     _fieldDefaults[_numberFields - 1] = String(_settings.colorDefault);
 
-    if (_settings.heading != "") _client.println("<h2>" + _settings.heading + "</h2>");
-
-    // Create field group container
-    _client.println("<div class=\"field-group\">");
-    _client.println("<label class=\"field-label\">" + _settings.fieldPrompt + "</label>");
-    _client.println("<input type='color' id='" + fieldId + "' value='" + _settings.textDefault + "'>");
-    _client.println("</div>");
+    emitFieldStart();
+    emit("<input type='color' id='");
+    emitFieldId();
+    emit("' value='");
+    emit(_settings.textDefault);
+    emit("'>\n"
+         "</div>\n");
 }
 
 /**
@@ -486,20 +1751,23 @@ void FormBuilder::renderNumberInput() {
     
     _fieldTag++;
     _numberFields++;
-    String fieldId = "x" + String(_fieldTag);
 
     // Store default value for change detection
     _fieldDefaults[_numberFields - 1] = String(_settings.numberDefault);
 
-    if (_settings.heading != "") _client.println("<h2>" + _settings.heading + "</h2>");
-
-    // Create field group container
-    _client.println("<div class=\"field-group\">");
-    _client.println("<label class=\"field-label\">" + _settings.fieldPrompt + "</label>");
-    _client.println("<input type='number' id='" + fieldId + "' min='" + String(_settings.numberMin) + 
-                    "' max='" + String(_settings.numberMax) + "' step='" + String(_settings.numberStep) + 
-                    "' value='" + String(_settings.numberDefault) + "'>");
-    _client.println("</div>");
+    emitFieldStart();
+    emit("<input type='number' id='");
+    emitFieldId();
+    emit("' min='");
+    emitNumber(_settings.numberMin);
+    emit("' max='");
+    emitNumber(_settings.numberMax);
+    emit("' step='");
+    emitNumber(_settings.numberStep);
+    emit("' value='");
+    emitNumber(_settings.numberDefault);
+    emit("'>\n"
+         "</div>\n");
 }
 
 /**
@@ -510,24 +1778,32 @@ void FormBuilder::renderRangeSlider() {
     
     _fieldTag++;
     _numberFields++;
-    String fieldId = "x" + String(_fieldTag);
 
     // Store default value for change detection
     _fieldDefaults[_numberFields - 1] = String(_settings.rangeDefault);
 
-    if (_settings.heading != "") _client.println("<h2>" + _settings.heading + "</h2>");
-
-    // Create field group container
-    _client.println("<div class=\"field-group\">");
-    _client.println("<label class=\"field-label\">" + _settings.fieldPrompt + "</label>");
-    _client.println("<div class=\"range-container\">");
-    _client.println("<input type='range' id='" + fieldId + "' min='" + String(_settings.rangeMin) + 
-                    "' max='" + String(_settings.rangeMax) + "' step='" + String(_settings.rangeStep) + 
-                    "' value='" + String(_settings.rangeDefault) + "' oninput='updateRangeValue(\"" + 
-                    fieldId + "\", this.value)'>");
-    _client.println("<span class=\"range-value\" id='" + fieldId + "_value'>" + String(_settings.rangeDefault) + "</span>");
-    _client.println("</div>");
-    _client.println("</div>");
+    emitFieldStart();
+    emit("<div class=\"range-container\">\n"
+         "<input type='range' id='");
+    emitFieldId();
+    emit("' min='");
+    emitNumber(_settings.rangeMin);
+    emit("' max='");
+    emitNumber(_settings.rangeMax);
+    emit("' step='");
+    emitNumber(_settings.rangeStep);
+    emit("' value='");
+    emitNumber(_settings.rangeDefault);
+    emit("' oninput='updateRangeValue(\"");
+    emitFieldId();
+    emit("\", this.value)'>\n"
+         "<span class=\"range-value\" id='");
+    emitFieldId();
+    emit("_value'>");
+    emitNumber(_settings.rangeDefault);
+    emit("</span>\n"
+         "</div>\n"
+         "</div>\n");
 }
 
 /**
@@ -538,7 +1814,6 @@ void FormBuilder::renderTimeInput() {
     
     _fieldTag++;
     _numberFields++;
-    String fieldId = "x" + String(_fieldTag);
 
     // Store default value for change detection (as integer for callback comparison)
     int hours = _settings.textDefault.substring(0, 2).toInt();
@@ -546,14 +1821,13 @@ void FormBuilder::renderTimeInput() {
     int timeInt = hours * 100 + minutes;
     _fieldDefaults[_numberFields - 1] = String(timeInt);
 
-    if (_settings.heading != "") _client.println("<h2>" + _settings.heading + "</h2>");
-
-    // Create field group container
-    _client.println("<div class=\"field-group\">");
-    _client.println("<label class=\"field-label\">" + _settings.fieldPrompt + "</label>");
-    String stepAttr = _settings.timeIncludeSeconds ? " step='1'" : "";
-    _client.println("<input type='time' id='" + fieldId + "' value='" + _settings.textDefault + "'" + stepAttr + ">");
-    _client.println("</div>");
+    emitFieldStart();
+    emit("<input type='time' id='");
+    emitFieldId();
+    emit("' value='");
+    emit(_settings.textDefault);
+    emit(_settings.timeIncludeSeconds ? "' step='1'>\n" : "'>\n");
+    emit("</div>\n");
 }
 
 /**
@@ -564,24 +1838,25 @@ void FormBuilder::renderPasswordInput() {
     
     _fieldTag++;
     _numberFields++;
-    String fieldId = "x" + String(_fieldTag);
 
     // Store default value for change detection
     _fieldDefaults[_numberFields - 1] = _settings.textDefault;
 
-    if (_settings.heading != "") _client.println("<h2>" + _settings.heading + "</h2>");
-
-    // Create field group container
-    _client.println("<div class=\"field-group\">");
-    _client.println("<label class=\"field-label\">" + _settings.fieldPrompt + "</label>");
-    _client.println("<div class=\"password-container\">");
-    _client.println("<input type='password' id='" + fieldId + "' value='" + _settings.textDefault + "'>");
-    _client.println("<label class=\"show-password-label\">");
-    _client.println("<input type='checkbox' onclick='togglePassword(\"" + fieldId + "\")'>");
-    _client.println("<span>Show</span>");
-    _client.println("</label>");
-    _client.println("</div>");
-    _client.println("</div>");
+    emitFieldStart();
+    emit("<div class=\"password-container\">\n"
+         "<input type='password' id='");
+    emitFieldId();
+    emit("' value='");
+    emit(_settings.textDefault);
+    emit("'>\n"
+         "<label class=\"show-password-label\">\n"
+         "<input type='checkbox' onclick='togglePassword(\"");
+    emitFieldId();
+    emit("\")'>\n"
+         "<span>Show</span>\n"
+         "</label>\n"
+         "</div>\n"
+         "</div>\n");
 }
 
 /**
@@ -592,21 +1867,27 @@ void FormBuilder::renderCheckbox() {
     
     _fieldTag++;
     _numberFields++;
-    String fieldId = "x" + String(_fieldTag);
 
     // Store default value for change detection
     _fieldDefaults[_numberFields - 1] = _settings.checkboxDefault ? "true" : "false";
 
-    if (_settings.heading != "") _client.println("<h2>" + _settings.heading + "</h2>");
+    if (_settings.heading != "") {
+        emit("<h2>");
+        emit(_settings.heading);
+        emit("</h2>\n");
+    }
 
-    // Create field group container
-    _client.println("<div class=\"field-group checkbox-group\">");
-    String checked = _settings.checkboxDefault ? " checked" : "";
-    _client.println("<label class=\"checkbox-label\">");
-    _client.println("<input type='checkbox' id='" + fieldId + "' value='true'" + checked + ">");
-    _client.println("<span class=\"checkbox-text\">" + _settings.fieldPrompt + "</span>");
-    _client.println("</label>");
-    _client.println("</div>");
+    // The prompt follows the box, so no field label
+    emit("<div class=\"field-group checkbox-group\">\n"
+         "<label class=\"checkbox-label\">\n"
+         "<input type='checkbox' id='");
+    emitFieldId();
+    emit(_settings.checkboxDefault ? "' value='true' checked>\n" : "' value='true'>\n");
+    emit("<span class=\"checkbox-text\">");
+    emit(_settings.fieldPrompt);
+    emit("</span>\n"
+         "</label>\n"
+         "</div>\n");
 }
 
 /**
@@ -617,8 +1898,6 @@ void FormBuilder::renderRadio() {
     
     _fieldTag++;
     _numberFields++;
-    String fieldId = "x" + String(_fieldTag);
-    String groupName = "group_" + fieldId;
 
     // Store default value for change detection
     if (_settings.numDefault < MAX_FIELD_OPTIONS && _settings.fieldOptions[_settings.numDefault] != "") {
@@ -626,11 +1905,7 @@ void FormBuilder::renderRadio() {
             _settings.fieldOptions[_settings.numDefault] : String(_settings.numDefault);
     }
 
-    if (_settings.heading != "") _client.println("<h2>" + _settings.heading + "</h2>");
-
-    // Create field group container
-    _client.println("<div class=\"field-group\">");
-    _client.println("<label class=\"field-label\">" + _settings.fieldPrompt + "</label>");
+    emitFieldStart();
     
     // Generate radio buttons for each option
     for (int option = 0; option < MAX_FIELD_OPTIONS; option++) {
@@ -638,21 +1913,56 @@ void FormBuilder::renderRadio() {
         if (_settings.fieldOptions[option].length() == 0) continue;
         
         // Use actual text as value if returnPrompts is true, otherwise use index
-        String optVal = _settings.returnPrompts ? _settings.fieldOptions[option] : String(option);
-        String optText = _settings.fieldOptions[option];
-        String checked = (option == _settings.numDefault) ? " checked" : "";
-        String radioId = fieldId + "_" + String(option);
-        
-        _client.println("<div class=\"radio-group\">");
-        _client.println("<label class=\"radio-label\">");
-        _client.println("<input type='radio' id='" + radioId + "' name='" + groupName + 
-                        "' value='" + optVal + "'" + checked + ">");
-        _client.println("<span class=\"radio-text\">" + optText + "</span>");
-        _client.println("</label>");
-        _client.println("</div>");
+        emit("<div class=\"radio-group\">\n"
+             "<label class=\"radio-label\">\n"
+             "<input type='radio' id='");
+        emitFieldId();
+        emit("_");
+        emitNumber(option);
+        emit("' name='group_");
+        emitFieldId();
+        emit("' value='");
+        if (_settings.returnPrompts) emit(_settings.fieldOptions[option]);
+        else emitNumber(option);
+        emit(option == _settings.numDefault ? "' checked>\n" : "'>\n");
+        emit("<span class=\"radio-text\">");
+        emit(_settings.fieldOptions[option]);
+        emit("</span>\n"
+             "</label>\n"
+             "</div>\n");
     }
     
-    _client.println("</div>");
+    emit("</div>\n");
+}
+
+/**
+ * Render a bitmask field: one grid, one checkbox per label, valued by bit
+ */
+void FormBuilder::renderBitmask() {
+    if (_settings.fieldPrompt == "") return;
+
+    _fieldTag++;
+    _numberFields++;
+
+    // Store default value for change detection
+    _fieldDefaults[_numberFields - 1] = String(_settings.bitmaskDefault);
+    _bitmaskFields[(_numberFields - 1) / 32] |= 1UL << ((_numberFields - 1) % 32);
+
+    // The script reads the grid as the sum of its checked bits
+    emitFieldStart();
+    emit("<div class=\"bitmask-grid\" id=\"");
+    emitFieldId();
+    emit("\">\n");
+    for (int bit = 0; bit < MAX_FIELD_OPTIONS && bit < 32; bit++) {
+        if (_settings.fieldOptions[bit] == "") break;
+        emit("<label class=\"checkbox-label\"><input type='checkbox' value='");
+        emitNumber(bit);
+        emit((_settings.bitmaskDefault >> bit) & 1 ? "' checked>" : "'>");
+        emit(_settings.fieldOptions[bit]);
+        emit("</label>\n");
+    }
+    emit("</div>\n"
+         "</div>\n");
 }
 
 /**
@@ -661,302 +1971,425 @@ void FormBuilder::renderRadio() {
 void FormBuilder::renderHidden() {
     _fieldTag++;
     _numberFields++;
-    String fieldId = "x" + String(_fieldTag);
 
     _fieldDefaults[_numberFields - 1] = _settings.textDefault;
 
-    _client.println("<input type='hidden' id='" + fieldId + "' value='" + _settings.textDefault + "'>");
+    emit("<input type='hidden' id='");
+    emitFieldId();
+    emit("' value='");
+    emit(_settings.textDefault);
+    emit("'>\n");
 }
 
 /**
  * Start HTML form output
  */
 void FormBuilder::htmlStart() {
-    // Reset form generation state for fresh form
+    resetFormState();
+#ifdef FORMBUILDER_FIELD_PROFILE
+    _fieldCostCount = 0;
+#endif
+    
+    // The page goes out in gathered writes from here to htmlEnd()
+    _gathering = true;
+
+#ifdef FORMBUILDER_DEFLATE
+    // Headers go out as-is; everything after them through the deflater
+    if (_compress && (_headers.acceptEncodings & FB_ENCODING_GZIP) && !_silent && !_sizing) {
+        emit(FB_HTML_HEADERS_GZIP);
+        flushFragments();
+        _gathering = false;
+        _deflate.begin(*_io);
+        _deflating = true;
+    } else if (_bodyLength > 0) {
+#else
+    if (_bodyLength > 0) {
+#endif
+        emit(FB_HTML_HEADERS_LENGTH);
+        emitNumber(_bodyLength);
+        emit(_keepAlive ? "\r\n\r\n" : "\r\nConnection: close\r\n\r\n");
+    } else if (!_sizing) {
+        emit(FB_HTML_HEADERS);
+    }
+    if (_flushPoints & FB_FLUSH_HEADERS) flushFragments();
+    emit(FB_PAGE_HEAD);
+    emitStylesheets();
+
+    const String& title = _activeForm->title.length() > 0 ? _activeForm->title : _pageTitle;
+    emit("<title>");
+    emit(title);
+    emit("</title>\n"
+         "</head>\n");
+    if (_flushPoints & FB_FLUSH_HEAD) flushFragments();
+
+    emit("<body>\n"
+         "<div id=\"container\">\n"
+         "<h1 id=\"header\">");
+    emit(title);
+    emit("</h1>\n"
+         "<div id=\"inputs\">\n");
+}
+
+/**
+ * Built-in, custom and linked stylesheets for the document head
+ */
+void FormBuilder::emitStylesheets() {
+    // Dispatched builders link the shared stylesheet; standalone ones inline it
+    if (_sharedAssets) {
+        emit("<link rel=\"stylesheet\" href=\"" FB_ASSET_CSS_PATH "\">\n");
+    } else {
+        emit("<style>\n");
+        emit(FB_STYLE);
+        emit("</style>\n");
+    }
+
+    // Custom CSS is its own content-hashed stylesheet, cached for good
+    if (_customCSS.length() > 0) {
+        emit("<link rel=\"stylesheet\" href=\"");
+        emit(_customCSSPath);
+        emit("\">\n");
+    }
+    if (_stylesheet) {
+        emit("<link rel=\"stylesheet\" href=\"");
+        emit(_stylesheet);
+        emit("\">\n");
+    }
+}
+
+/**
+ * End HTML form output with JavaScript
+ */
+void FormBuilder::htmlEnd() {
+    emit(FB_PAGE_BUTTON);
+    emit("<script>\n"
+         "var fbFirst = ");
+    emitNumber(START_FIELD_TAG + 1);
+    emit(", fbLast = ");
+    emitNumber(_fieldTag);
+    emit(", fbAction = '");
+    emit(_activeForm->path);
+    if (_activeForm->path[0] == '\0' || _activeForm->path[strlen(_activeForm->path) - 1] != '/') emit("/");
+    emit("ajax_inputs', fbRules = [");
+    for (uint8_t r = 0; r < _ruleCount; r++) {
+        const VisibilityRule& rule = _rules[r];
+        String value = rule.value;
+        value.replace("\\", "\\\\");
+        value.replace("'", "\\'");
+        emit(r > 0 ? ",[" : "[");
+        emitNumber(START_FIELD_TAG + rule.field);
+        emit(",'");
+        emit(value);
+        emit("',");
+        emitNumber(START_FIELD_TAG + rule.first);
+        emit(",");
+        emitNumber(START_FIELD_TAG + rule.last);
+        emit("]");
+    }
+    emit("];\n");
+    if (_sharedAssets) {
+        emit("</script>\n"
+             "<script src=\"" FB_ASSET_JS_PATH "\"></script>\n");
+    } else {
+        emit(FB_SCRIPT);
+        emit("</script>\n");
+    }
+    emit(FB_PAGE_END);
+#ifdef FORMBUILDER_DEFLATE
+    if (_deflating) {
+        _deflating = false;
+        _bytesOut += _deflate.end();
+    }
+#endif
+    flushFragments();
+    _gathering = false;
+}
+
+/**
+ * Write constant text to the client, counting response bytes
+ * The text must outlive the page: it is queued by reference.
+ */
+void FormBuilder::emit(const char* text) {
+    if (_silent) return;
+    size_t length = strlen(text);
+    _markupBytes += length;
+    if (_sizing) return;
+#ifdef FORMBUILDER_DEFLATE
+    if (_deflating) {
+        _deflate.write((const uint8_t*)text, length);
+        return;
+    }
+#endif
+    if (_gathering) {
+        // Constants are queued where they are; very short ones cost less to copy
+        if (length <= sizeof(Fragment)) queueCopy(text, length);
+        else queueFragment(text, length);
+        return;
+    }
+    noteFirstByte();
+    _bytesOut += _io->write(text, length);
+}
+
+/**
+ * Write a dynamic value: queued as a copy, since it may not outlive the call
+ */
+void FormBuilder::emit(const String& text) {
+    emitCopy(text.c_str(), text.length());
+}
+
+void FormBuilder::emitNumber(long value) {
+    char digits[12];
+    int length = snprintf(digits, sizeof(digits), "%ld", value);
+    emitCopy(digits, length);
+}
+
+void FormBuilder::emitCopy(const char* data, size_t length) {
+    if (_silent) return;
+    _markupBytes += length;
+    if (_sizing) return;
+#ifdef FORMBUILDER_DEFLATE
+    if (_deflating) {
+        _deflate.write((const uint8_t*)data, length);
+        return;
+    }
+#endif
+    if (_gathering) {
+        queueCopy(data, length);
+        return;
+    }
+    noteFirstByte();
+    _bytesOut += _io->write(data, length);
+}
+
+/**
+ * Queue a fragment that stays valid until the page is finished
+ */
+void FormBuilder::queueFragment(const char* data, size_t length) {
+    if (length == 0) return;
+    if (_fragmentCount == FORMBUILDER_IOV_COUNT) flushFragments();
+    _fragments[_fragmentCount++] = { data, length };
+}
+
+/**
+ * Queue a copy of short-lived text, joining it to the previous copy when
+ * the two are adjacent in the arena. Text larger than the arena is
+ * written straight away, after what is already queued.
+ */
+void FormBuilder::queueCopy(const char* data, size_t length) {
+    if (length == 0) return;
+    if (_fragmentCount == FORMBUILDER_IOV_COUNT || _arenaUsed + length > sizeof(_arena)) {
+        flushFragments();
+    }
+    if (length > sizeof(_arena)) {
+        noteFirstByte();
+        _bytesOut += _io->write(data, length);
+        return;
+    }
+
+    char* copy = _arena + _arenaUsed;
+    memcpy(copy, data, length);
+    _arenaUsed += length;
+    if (_fragmentCount > 0) {
+        Fragment& last = _fragments[_fragmentCount - 1];
+        if (last.data + last.length == copy) {
+            last.length += length;
+            return;
+        }
+    }
+    _fragments[_fragmentCount++] = { copy, length };
+}
+
+/**
+ * Write the queued fragments
+ * Host builds hand them to writev() on the client socket in one call.
+ * lwIP copies everything it sends anyway, so on ESP32 (and for clients
+ * without a socket) they are gathered into FORMBUILDER_TX_BATCH writes.
+ */
+void FormBuilder::flushFragments() {
+    if (_fragmentCount == 0) return;
+    noteFirstByte();
+
+#if !defined(ESP32)
+    int fd = _io == &_client ? _client.fd() : -1;    // never around TLS
+    if (fd >= 0) {
+        struct iovec iov[FORMBUILDER_IOV_COUNT];
+        for (uint8_t i = 0; i < _fragmentCount; i++) {
+            iov[i].iov_base = (void*)_fragments[i].data;
+            iov[i].iov_len = _fragments[i].length;
+        }
+        int first = 0;
+        unsigned long lastProgress = millis();
+        while (first < _fragmentCount) {
+            ssize_t n = writev(fd, iov + first, _fragmentCount - first);
+            if (n < 0) {
+                if ((errno != EINTR && errno != EAGAIN) || millis() - lastProgress > FORMBUILDER_READ_TIMEOUT) break;
+                yield();
+                continue;
+            }
+            lastProgress = millis();
+            _bytesOut += n;
+
+            // Skip what was written; a partial write resumes mid-fragment
+            while (first < _fragmentCount && (size_t)n >= iov[first].iov_len) {
+                n -= iov[first].iov_len;
+                first++;
+            }
+            if (first < _fragmentCount) {
+                iov[first].iov_base = (char*)iov[first].iov_base + n;
+                iov[first].iov_len -= n;
+            }
+        }
+        _fragmentCount = 0;
+        _arenaUsed = 0;
+        return;
+    }
+#endif
+
+    uint8_t batch[FORMBUILDER_TX_BATCH];
+    size_t fill = 0;
+    for (uint8_t i = 0; i < _fragmentCount; i++) {
+        const Fragment& fragment = _fragments[i];
+        if (fill > 0 && fill + fragment.length > sizeof(batch)) {
+            _bytesOut += _io->write(batch, fill);
+            fill = 0;
+        }
+        if (fragment.length >= sizeof(batch)) {
+            _bytesOut += _io->write((const uint8_t*)fragment.data, fragment.length);
+            continue;
+        }
+        memcpy(batch + fill, fragment.data, fragment.length);
+        fill += fragment.length;
+    }
+    if (fill > 0) _bytesOut += _io->write(batch, fill);
+    _fragmentCount = 0;
+    _arenaUsed = 0;
+}
+
+/**
+ * Record time to first byte when the response starts
+ */
+void FormBuilder::noteFirstByte() {
+    if (_firstByteSent) return;
+    _firstByteSent = true;
+    FB_TRACE_INSTANT(FB_TRACE_FIRST_BYTE_OUT);
+    _latency.firstByte.record(micros() - _acceptMicros);
+}
+
+/**
+ * Reset field numbering and stored defaults before a form is built
+ */
+void FormBuilder::resetFormState() {
     _fieldTag = START_FIELD_TAG;
     _numberFields = 0;
+    _ruleCount = 0;
     
     // Clear default values for new form
     for (int i = 0; i < MAX_FORM_FIELDS; i++) {
         _fieldDefaults[i] = "";
     }
-    
-    _client.println("HTTP/1.1 200 OK");
-    _client.println("Content-type:text/html");
-    _client.println("Connection: close");
-    _client.println();
-    _client.println("<!DOCTYPE html>");
-    _client.println("<html lang=\"en\">");
-    _client.println("<head>");
-    _client.println("<meta charset=\"UTF-8\">");
-    _client.println("<meta name=\"viewport\" content=\"width=device-width, initial-scale=1.0\">");
-    
-    // Enhanced CSS with modern styling
-    _client.println("<style>");
-    _client.println(":root {");
-    _client.println("  --primary-color: #2563eb;");
-    _client.println("  --primary-hover: #1d4ed8;");
-    _client.println("  --success-color: #059669;");
-    _client.println("  --background: #f8fafc;");
-    _client.println("  --card-bg: #ffffff;");
-    _client.println("  --text-primary: #1e293b;");
-    _client.println("  --text-secondary: #475569;");
-    _client.println("  --border: #e2e8f0;");
-    _client.println("  --border-focus: #3b82f6;");
-    _client.println("  --shadow: 0 4px 6px -1px rgba(0, 0, 0, 0.1);");
-    _client.println("  --shadow-lg: 0 10px 15px -3px rgba(0, 0, 0, 0.1);");
-    _client.println("}");
-    
-    _client.println("* { box-sizing: border-box; }");
-    
-    _client.println("body {");
-    _client.println("  font-family: -apple-system, BlinkMacSystemFont, 'Segoe UI', Roboto, sans-serif;");
-    _client.println("  background: linear-gradient(135deg, var(--background) 0%, #e2e8f0 100%);");
-    _client.println("  margin: 0; padding: 20px; color: var(--text-primary); line-height: 1.6;");
-    _client.println("}");
-    
-    _client.println("#container {");
-    _client.println("  max-width: 800px; margin: 0 auto; background: var(--card-bg);");
-    _client.println("  border-radius: 16px; box-shadow: var(--shadow-lg); overflow: hidden;");
-    _client.println("}");
-    
-    _client.println("#header {");
-    _client.println("  background: linear-gradient(135deg, var(--primary-color) 0%, var(--primary-hover) 100%);");
-    _client.println("  color: white; text-align: center; font-size: 1.7rem;");
-    _client.println("  font-weight: 700; margin: 0; letter-spacing: -0.5px;");
-    _client.println("  border-radius: 16px 16px 0 0; padding: 15px; display: flex; align-items: center; justify-content: center;");
-    _client.println("}");
-    
-    _client.println("#inputs { padding: 20px 40px; margin-top: 0; }");
-    
-    _client.println(".subheading {");
-    _client.println("  font-size: 1.5rem; font-weight: 600; color: var(--text-primary);");
-    _client.println("  margin: 15px 0 20px 0; padding-bottom: 10px;");
-    _client.println("  border-bottom: 2px solid var(--border);");
-    _client.println("}");
-    _client.println(".subheading:first-child { margin-top: 0; }");
-    
-    _client.println(".field-group { margin-bottom: 24px; overflow: hidden; }");
-    
-    _client.println(".field-label {");
-    _client.println("  display: block; font-size: 1.1rem; font-weight: 500;");
-    _client.println("  color: var(--text-primary); margin-bottom: 8px;");
-    _client.println("}");
-    
-    _client.println("input[type=\"text\"], input[type=\"password\"], input[type=\"number\"], input[type=\"time\"], select {");
-    _client.println("  width: 100%; height: 48px; padding: 12px; font-size: 1.1rem;");
-    _client.println("  border: 2px solid var(--border); border-radius: 8px;");
-    _client.println("  background: var(--card-bg); transition: all 0.2s ease; outline: none;");
-    _client.println("}");
-    
-    _client.println("input[type=\"text\"]:focus, input[type=\"password\"]:focus, input[type=\"number\"]:focus, input[type=\"time\"]:focus, select:focus {");
-    _client.println("  border-color: var(--border-focus);");
-    _client.println("  box-shadow: 0 0 0 3px rgba(59, 130, 246, 0.1);");
-    _client.println("}");
-    
-    // Password container styling
-    _client.println(".password-container {");
-    _client.println("  display: flex; align-items: center; gap: 12px;");
-    _client.println("}");
-    
-    _client.println(".password-container input[type=\"password\"], .password-container input[type=\"text\"] {");
-    _client.println("  flex: 1;");
-    _client.println("}");
-    
-    _client.println(".show-password-label {");
-    _client.println("  display: flex; align-items: center; cursor: pointer; font-size: 0.9rem;");
-    _client.println("  color: var(--text-secondary); white-space: nowrap; margin: 0;");
-    _client.println("}");
-    
-    _client.println(".show-password-label input[type=\"checkbox\"] {");
-    _client.println("  width: 16px; height: 16px; margin-right: 6px;");
-    _client.println("}");
-    
-    _client.println("input[type=\"color\"] {");
-    _client.println("  width: 100%; height: 40px; padding: 2px;");
-    _client.println("  border: 2px solid var(--border); border-radius: 8px;");
-    _client.println("  cursor: pointer; transition: all 0.2s ease;");
-    _client.println("  appearance: none; -webkit-appearance: none;");
-    _client.println("}");
-    _client.println("input[type=\"color\"]::-webkit-color-swatch-wrapper { padding: 0; }");
-    _client.println("input[type=\"color\"]::-webkit-color-swatch { border: none; border-radius: 6px; }");
-    
-    _client.println("input[type=\"color\"]:hover {");
-    _client.println("  border-color: var(--border-focus);");
-    _client.println("}");
-    
-    // Range slider styling
-    _client.println(".range-container {");
-    _client.println("  display: flex; align-items: center; gap: 15px;");
-    _client.println("}");
-    
-    _client.println("input[type=\"range\"] {");
-    _client.println("  flex: 1; height: 6px; appearance: none; background: var(--border);");
-    _client.println("  border-radius: 3px; outline: none;");
-    _client.println("}");
-    
-    _client.println("input[type=\"range\"]::-webkit-slider-thumb {");
-    _client.println("  appearance: none; width: 20px; height: 20px; background: var(--primary-color);");
-    _client.println("  border-radius: 50%; cursor: pointer;");
-    _client.println("}");
-    
-    _client.println(".range-value {");
-    _client.println("  background: var(--primary-color); color: white; padding: 4px 12px;");
-    _client.println("  border-radius: 12px; font-weight: 600; min-width: 40px; text-align: center;");
-    _client.println("}");
-    
-    // Time input styling - constrain width for iOS Safari
-    _client.println("input[type=\"time\"] {");
-    _client.println("  width: 100%; max-width: 100%; box-sizing: border-box;");
-    _client.println("  height: 48px; padding: 12px; font-size: 1.1rem;");
-    _client.println("  border: 2px solid var(--border); border-radius: 8px;");
-    _client.println("  background: var(--card-bg); outline: none;");
-    _client.println("}");
-    
-    // Checkbox and radio styling
-    _client.println(".checkbox-group, .radio-group {");
-    _client.println("  margin-bottom: 4px;");
-    _client.println("}");
-    
-    _client.println(".checkbox-label, .radio-label {");
-    _client.println("  display: flex; align-items: center; cursor: pointer; font-size: 1.1rem;");
-    _client.println("  font-weight: 500; color: var(--text-primary); padding: 2px 0;");
-    _client.println("}");
-    
-    _client.println("input[type=\"checkbox\"], input[type=\"radio\"] {");
-    _client.println("  width: 18px; height: 18px; margin-right: 12px; cursor: pointer;");
-    _client.println("}");
-    
-    // Add the separator line above save button
-    _client.println(".button-separator {");
-    _client.println("  width: 100%; height: 1px;");
-    _client.println("  background: var(--border);");
-    _client.println("  margin: 30px 0 20px 0;");
-    _client.println("}");
-    
-    _client.println(".save-button {");
-    _client.println("  width: 100%; padding: 20px; font-size: 1.2rem; font-weight: 600;");
-    _client.println("  color: white; background: linear-gradient(135deg, var(--success-color) 0%, #047857 100%);");
-    _client.println("  border: none; border-radius: 12px; cursor: pointer;");
-    _client.println("  transition: all 0.2s ease; margin-top: 20px; box-shadow: var(--shadow);");
-    _client.println("}");
-    
-    _client.println(".save-button:hover {");
-    _client.println("  transform: translateY(-2px); box-shadow: var(--shadow-lg);");
-    _client.println("}");
-    
-    _client.println(".save-button:active { transform: translateY(0); }");
-    
-    _client.println(".success-message {");
-    _client.println("  position: fixed; top: 50%; left: 50%; transform: translate(-50%, -50%);");
-    _client.println("  background: rgba(5,150,105,0.95); color: white; padding: 30px 50px;");
-    _client.println("  border-radius: 16px; font-size: 1.6rem; font-weight: 700;");
-    _client.println("  box-shadow: 0 20px 40px rgba(0,0,0,0.3); z-index: 1000;");
-    _client.println("  transition: opacity 0.6s ease; pointer-events: none; white-space: nowrap;");
-    _client.println("}");
-    
-    _client.println("@media (max-width: 600px) {");
-    _client.println("  body { padding: 10px; }");
-    _client.println("  #header { padding: 15px; }");
-    _client.println("  #inputs { padding: 20px; }");
-    _client.println("}");
-    
-    // Inject custom CSS if provided
-    if (_customCSS.length() > 0) {
-        _client.println(_customCSS);
-    }
-    
-    _client.println("</style>");
-
-    _client.println("<title>" + _pageTitle + "</title>");
-    _client.println("</head>");
-
-    _client.println("<body>");
-    _client.println("<div id=\"container\">");
-    _client.println("<h1 id=\"header\">" + _pageTitle + "</h1>");
-    _client.println("<div id=\"inputs\">");
+    memset(_bitmaskFields, 0, sizeof(_bitmaskFields));
 }
 
 /**
- * End HTML form output with JavaScript
+ * Run the active form's builder without output, to recover its field count
+ * and defaults when the last page served was a different form (or none,
+ * e.g. after a reboot with the page still open in the browser)
  */
-void FormBuilder::htmlEnd() {
-    // Add the separator line before the save button
-    _client.println("<div class=\"button-separator\"></div>");
-    _client.println("<button type=\"button\" class=\"save-button\" onclick=\"SendText()\">Save Configuration</button>");
-    _client.println("</div></div>");
+void FormBuilder::rebuildDefaults() {
+    _silent = true;
+    resetFormState();
+    if (_activeForm->builder) _activeForm->builder();
+    _silent = false;
+}
 
-    _client.println("<script>");
+/**
+ * Run the active form's builder once without output to count the page
+ * body, so the page can be sent with a Content-Length. Gzipped pages and
+ * builds with enableContentLength() off are left unmeasured.
+ */
+void FormBuilder::measurePage() {
+    _bodyLength = 0;
+    if (!_measure) return;
+#ifdef FORMBUILDER_DEFLATE
+    if (_compress && (_headers.acceptEncodings & FB_ENCODING_GZIP)) return;
+#endif
+    _sizing = true;
+    htmlStart();
+    if (_activeForm->builder) _activeForm->builder();
+    htmlEnd();
+    _sizing = false;
+    _bodyLength = _markupBytes;
+    _markupBytes = 0;
+}
 
-    // Range slider update function
-    _client.println("function updateRangeValue(fieldId, value) {");
-    _client.println("  document.getElementById(fieldId + '_value').textContent = value;");
-    _client.println("}");
+/**
+ * Find the form whose path is the longest prefix of the request path
+ * @param requestLine HTTP request line
+ * @param rest Receives the offset of the request path after the matched prefix
+ * @return Route index, FORM_DEFAULT for the setFormBuilder() form, or FORM_NONE
+ */
+int FormBuilder::matchForm(const String& requestLine, int& rest) const {
+    const char* path = requestLine.c_str() + 4;    // after "GET "
+    int best = FORM_NONE;
+    size_t bestLen = 0;
+
+    for (int i = 0; i < _formCount; i++) {
+        size_t len = strlen(_forms[i].path);
+        if (len < bestLen || strncmp(path, _forms[i].path, len) != 0) continue;
+        // Match whole path segments only: /net must not match /network
+        char next = path[len];
+        if (_forms[i].path[len - 1] != '/' && next != '\0' && next != ' ' && next != '?' && next != '/') continue;
+        best = i;
+        bestLen = len;
+    }
 
-    // Password visibility toggle function
-    _client.println("function togglePassword(fieldId) {");
-    _client.println("  var field = document.getElementById(fieldId);");
-    _client.println("  field.type = field.type === 'password' ? 'text' : 'password';");
-    _client.println("}");
-
-    // JavaScript SendText() function - compact generic loop
-    _client.println("function SendText() {");
-    _client.println("  var request = new XMLHttpRequest();");
-    _client.println("  var sep = '__SEP__';");
-    _client.println("  var netText = '?';");
-    _client.println("  var first = true;");
-    _client.println("  for (var i = " + String(START_FIELD_TAG + 1) + "; i <= " + String(_fieldTag) + "; i++) {");
-    _client.println("    if (!first) netText += sep;");
-    _client.println("    first = false;");
-    _client.println("    var fieldId = 'x' + i;");
-    _client.println("    var value = '';");
-    _client.println("    var fieldFound = false;");
-    _client.println("    var field = document.getElementById(fieldId);");
-    _client.println("    if (field) {");
-    _client.println("      fieldFound = true;");
-    _client.println("      if (field.type === 'checkbox') {");
-    _client.println("        value = field.checked ? 'true' : 'false';");
-    _client.println("      } else {");
-    _client.println("        value = field.value || '';");
-    _client.println("      }");
-    _client.println("    } else {");
-    _client.println("      var rc = document.querySelector('input[name=\"group_' + fieldId + '\"]:checked');");
-    _client.println("      if (rc) { value = rc.value; fieldFound = true; }");
-    _client.println("    }");
-    _client.println("    if (fieldFound) {");
-    _client.println("      netText += fieldId + '=' + encodeURIComponent(value);");
-    _client.println("    }");
-    _client.println("  }");
+    if (best == FORM_NONE && _formBuilderCallback && path[0] == '/') {
+        best = FORM_DEFAULT;
+        bestLen = 1;
+    }
+    rest = 4 + bestLen;
+    return best;
+}
 
-    // Clear form and show success overlay (style matches LiveFormBuilder)
-    _client.println("  document.body.innerHTML = '';");
-    _client.println("  var o = document.createElement('div');");
-    _client.println("  o.className = 'success-message';");
-    _client.println("  o.textContent = '\\u2713 Settings Saved';");
-    _client.println("  document.body.appendChild(o);");
+/**
+ * Add a form served at its own path
+ */
+bool FormBuilder::addForm(const char* path, String title, FormBuilderCallback builder,
+                          FormDataCallback callback, FormCompleteCallback complete) {
+    if (_formCount >= MAX_FORM_ROUTES || !path || path[0] != '/') return false;
+    FormDefinition& form = _forms[_formCount++];
+    form.path = path;
+    form.title = title;
+    form.builder = builder;
+    form.callback = callback;
+    form.complete = complete;
+    return true;
+}
 
-    // Send the AJAX request with collected data
-    _client.println("  if (!netText.endsWith('?') && !netText.endsWith('&')) {");
-    _client.println("    netText += '&';");
-    _client.println("  }");
-    _client.println("  var nocache = 'nocache=' + Math.random() * 1000000;");
-    _client.println("  request.open('GET', '/ajax_inputs' + netText + nocache, true);");
-    _client.println("  request.send(null);");
-    _client.println("}");
-    _client.println("</script>");
+/**
+ * Get the size of the most recent response
+ */
+size_t FormBuilder::getLastResponseBytes() const {
+    return _bytesOut;
+}
 
-    _client.println("</body>");
-    _client.println("</html>");
-    _client.println();
+/**
+ * Convert one hex digit to its value, or -1 if it is not a hex digit
+ */
+static int hexDigit(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
 }
 
 /**
  * URL Decode function
+ * Malformed escapes (bad hex digits, truncated at the end) are kept literally
  */
-String FormBuilder::urlDecode(String input) {
-    String decoded = "";
-    char temp[] = "0x00";
+String FormBuilder::urlDecode(const String& input) {
+    String decoded;
     unsigned int len = input.length();
+    decoded.reserve(len);
     unsigned int i = 0;
 
     while (i < len) {
@@ -964,10 +2397,14 @@ String FormBuilder::urlDecode(String input) {
         if (c == '+') {
             decoded += ' ';
         } else if (c == '%' && i + 2 < len) {
-            temp[2] = input.charAt(i + 1);
-            temp[3] = input.charAt(i + 2);
-            decoded += (char) strtol(temp, NULL, 16);
-            i += 2;
+            int hi = hexDigit(input.charAt(i + 1));
+            int lo = hexDigit(input.charAt(i + 2));
+            if (hi < 0 || lo < 0) {
+                decoded += c;
+            } else {
+                decoded += (char)((hi << 4) | lo);
+                i += 2;
+            }
         } else {
             decoded += c;
         }
@@ -977,140 +2414,1001 @@ String FormBuilder::urlDecode(String input) {
 }
 
 /**
- * Process parameters from HTTP request
+ * Read one request line, without its line ending
+ * @return false if the line exceeds FORMBUILDER_MAX_LINE or the client
+ *         stops sending before the line is complete
  */
-void FormBuilder::getParameters() {
-    if (!_client) return;
+bool FormBuilder::readLine(String& line) {
+    line = "";
+    unsigned long lastData = millis();
+
+    while (_io->connected() || _io->available()) {
+        int c = _io->read();
+        if (c < 0) {
+            if (millis() - lastData > FORMBUILDER_READ_TIMEOUT) {
+                FB_LOGW("read timeout after %u bytes of line", line.length());
+                return false;
+            }
+            yield();
+            continue;
+        }
+        lastData = millis();
+        _metrics.bytesIn++;
+        if (c == '\n') {
+            line.trim();
+            return true;
+        }
+        if (line.length() >= FORMBUILDER_MAX_LINE) {
+            FB_LOGW("line longer than %d bytes", FORMBUILDER_MAX_LINE);
+            return false;
+        }
+        line += (char)c;
+    }
+    return false;
+}
 
-    String requestLine = "";
-    String firstLine = "";
-    bool headersDone = false;
-    bool handledRequest = false;
+/**
+ * Close the connection once the response has left the device
+ * The write side is shut down first so the peer sees FIN right after the
+ * last byte; the linger then ends as soon as the peer closes its side.
+ */
+void FormBuilder::lingerClose() {
+    setPhase(FB_PHASE_CLOSE);
+    _io->flush();
+#ifdef FORMBUILDER_TLS
+    if (_io == _tls) _tls->closeNotify();
+#endif
+    if (_client.fd() >= 0) shutdown(_client.fd(), SHUT_WR);
+    unsigned long start = millis();
+    while (_io->connected() && millis() - start < _closeLingerMs) {
+        while (_io->available()) _io->read();
+        delay(1);
+    }
+    _io->stop();
+}
 
-    while (_client.connected() && _client.available()) {
-        requestLine = _client.readStringUntil('\n');
-        requestLine.trim();
+/**
+ * Set the maximum time to wait for the peer to close after the page
+ */
+void FormBuilder::setCloseLinger(uint16_t ms) {
+    _closeLingerMs = ms;
+}
 
-        if (requestLine.length() == 0) {
-            headersDone = true;
-            break;
+#ifdef FORMBUILDER_TLS
+/**
+ * Serve connections accepted by handleClient() over TLS
+ */
+void FormBuilder::enableTLS(FormTLS& tls) {
+    _tls = &tls;
+}
+#endif
+
+/**
+ * Disable Nagle's algorithm on client connections
+ */
+void FormBuilder::setNoDelay(bool enable) {
+    _noDelay = enable;
+}
+
+/**
+ * Choose where a page is written out before the end of the response
+ */
+void FormBuilder::setFlushPoints(uint8_t points) {
+    _flushPoints = points;
+}
+
+/**
+ * Send form pages with an exact Content-Length
+ */
+void FormBuilder::enableContentLength(bool enable) {
+    _measure = enable;
+}
+
+/**
+ * Reject a malformed or oversized request and close the connection
+ */
+void FormBuilder::rejectRequest() {
+    _metrics.rejected++;
+    emit("HTTP/1.1 400 Bad Request\r\n"
+         "Connection: close\r\n"
+         "\r\n");
+    endRequest(FB_ROUTE_OTHER, 400);
+    _io->stop();
+}
+
+/**
+ * Redirect an OS captive-portal probe to the form
+ * @return false if the request is not a known probe
+ */
+bool FormBuilder::serveProbe(const String& requestLine) {
+    if (!requestLine.startsWith("GET /")) return false;
+    const char* path = requestLine.c_str() + 4;    // after "GET "
+
+    for (const char* probe : FB_PROBE_PATHS) {
+        size_t len = strlen(probe);
+        if (strncmp(path, probe, len) != 0) continue;
+        char next = path[len];
+        if (next != ' ' && next != '?' && next != '\0') continue;
+
+        emit("HTTP/1.1 302 Found\r\n"
+             "Location: http://" + _client.localIP().toString() + "/\r\n"
+             "Content-Length: 0\r\n"
+             "Connection: close\r\n"
+             "\r\n");
+        endRequest(FB_ROUTE_PROBE, 302);
+        _io->stop();
+        return true;
+    }
+    return false;
+}
+
+// Largest login form body accepted
+static const size_t FB_LOGIN_BODY_MAX = 256;
+
+/**
+ * Raw value of a field in an application/x-www-form-urlencoded string
+ */
+static String formField(const String& data, const char* name) {
+    int nameLength = strlen(name);
+    int pos = 0;
+    while (pos < (int)data.length()) {
+        int end = data.indexOf('&', pos);
+        if (end == -1) end = data.length();
+        if (end - pos > nameLength && data.charAt(pos + nameLength) == '=' &&
+            strncmp(data.c_str() + pos, name, nameLength) == 0) {
+            return data.substring(pos + nameLength + 1, end);
         }
+        pos = end + 1;
+    }
+    return "";
+}
 
-        if (firstLine == "") firstLine = requestLine;
+/**
+ * Whether a path is safe to redirect to after login: on this device, and
+ * plain enough to echo into a header and the page unescaped
+ */
+static bool isLocalPath(const String& path) {
+    if (path.length() == 0 || path.length() > 64 || path.charAt(0) != '/') return false;
+    if (path.charAt(1) == '/') return false;
+    for (unsigned int i = 0; i < path.length(); i++) {
+        char c = path.charAt(i);
+        if (!isalnum((unsigned char)c) && !strchr("/-_.~", c)) return false;
+    }
+    return true;
+}
 
-        if (requestLine.startsWith("GET /ajax_inputs")) {
-            handledRequest = true;
+/**
+ * Check the login cookie of the current request
+ * Decodes nothing from the request but the cookie; the MAC is compared in
+ * constant time and the token must be younger than FORMBUILDER_LOGIN_LIFETIME.
+ */
+bool FormBuilder::hasValidToken() const {
+    const char* token = _headers.token;
+    if (strlen(token) != FB_TOKEN_LENGTH) return false;
+
+    uint32_t issued = 0;
+    for (int i = 0; i < 8; i++) {
+        int digit = hexDigit(token[i]);
+        if (digit < 0) return false;
+        issued = (issued << 4) | digit;
+    }
+
+    char expected[FB_TOKEN_LENGTH + 1];
+    fbMakeToken(issued, expected);
+    uint8_t diff = 0;
+    for (int i = 0; i < FB_TOKEN_LENGTH; i++) diff |= token[i] ^ expected[i];
+    uint32_t age = (uint32_t)(millis() / 1000) - issued;
+    return diff == 0 && age < FORMBUILDER_LOGIN_LIFETIME;
+}
+
+/**
+ * Send a browser without a valid token to the login page, remembering
+ * where it was going
+ */
+void FormBuilder::redirectToLogin(const String& requestLine) {
+    int start = requestLine.indexOf(' ') + 1;
+    int end = start;
+    while (end < (int)requestLine.length() && requestLine.charAt(end) != ' ' && requestLine.charAt(end) != '?') end++;
+    String next = requestLine.substring(start, end);
+    String location = isLocalPath(next) ? "/fb/login?next=" + next : String("/fb/login");
+
+    emit("HTTP/1.1 303 See Other\r\n"
+         "Location: " + location + "\r\n"
+         "Content-Length: 0\r\n"
+         "Connection: close\r\n"
+         "\r\n");
+    endRequest(FB_ROUTE_LOGIN, 303);
+    _io->stop();
+}
 
-            int queryStart = requestLine.indexOf('?');
-            int queryEnd = requestLine.indexOf(' ', queryStart);
-            if (queryStart == -1 || queryEnd == -1) {
-                break;
+/**
+ * GET /fb/login shows the password form; POST checks the password and
+ * sets the token cookie. After a wrong password every attempt is refused
+ * for FORMBUILDER_LOGIN_BACKOFF ms.
+ */
+void FormBuilder::serveLogin(const String& requestLine) {
+    String next;
+    bool refused = false;
+
+    if (requestLine.startsWith("POST ")) {
+        size_t length = _headers.contentLength;
+        char body[FB_LOGIN_BODY_MAX + 1];
+        size_t received = 0;
+        unsigned long lastData = millis();
+        if (length > FB_LOGIN_BODY_MAX) {
+            rejectRequest();
+            return;
+        }
+        while (received < length) {
+            int c = _io->read();
+            if (c < 0) {
+                if (!_io->connected() || millis() - lastData > FORMBUILDER_READ_TIMEOUT) {
+                    rejectRequest();
+                    return;
+                }
+                yield();
+                continue;
             }
+            lastData = millis();
+            _metrics.bytesIn++;
+            body[received++] = (char)c;
+        }
+        body[received] = '\0';
+        String data(body);
+        next = urlDecode(formField(data, "next"));
+        if (!isLocalPath(next)) next = "/";
+
+        refused = _loginBackoff && millis() - _loginFailedAt < FORMBUILDER_LOGIN_BACKOFF;
+        if (refused) {
+            _metrics.rateLimited++;
+        } else {
+            String password = urlDecode(formField(data, "p"));
+            uint8_t digest[32];
+            uint8_t diff = 0;
+            fbHmac((const uint8_t*)password.c_str(), password.length(), digest);
+            for (int i = 0; i < 32; i++) diff |= digest[i] ^ _loginDigest[i];
+            refused = diff != 0;
+            _loginBackoff = refused;
+            if (refused) _loginFailedAt = millis();
+        }
 
-            String queryString = requestLine.substring(queryStart + 1, queryEnd);
-            const String sep = "__SEP__";
-            const int sepLen = sep.length();
+        if (!refused) {
+            char token[FB_TOKEN_LENGTH + 1];
+            fbMakeToken((uint32_t)(millis() / 1000), token);
+            String cookie = FB_LOGIN_COOKIE "=" + String(token) +
+                            "; Path=/; Max-Age=" + String(FORMBUILDER_LOGIN_LIFETIME) +
+                            "; HttpOnly; SameSite=Strict";
+            if (_io != &_client) cookie += "; Secure";
+            emit("HTTP/1.1 303 See Other\r\n"
+                 "Location: " + next + "\r\n"
+                 "Set-Cookie: " + cookie + "\r\n"
+                 "Content-Length: 0\r\n"
+                 "Connection: close\r\n"
+                 "\r\n");
+            endRequest(FB_ROUTE_LOGIN, 303);
+            FB_LOGI("login accepted");
+            _io->stop();
+            return;
+        }
+        FB_LOGW("login refused");
+    } else {
+        int queryStart = requestLine.indexOf('?');
+        int queryEnd = requestLine.indexOf(' ', queryStart);
+        if (queryStart != -1 && queryEnd != -1) {
+            next = urlDecode(formField(requestLine.substring(queryStart + 1, queryEnd), "next"));
+        }
+        if (!isLocalPath(next)) next = "/";
+    }
 
-            int pos = 0;
-            int nextSep;
-            int fieldIndex = 1;
+    emit(refused ? "HTTP/1.1 401 Unauthorized\r\n" : "HTTP/1.1 200 OK\r\n");
+    emit("Content-type:text/html\r\n"
+         "Cache-Control: no-store\r\n"
+         "Connection: close\r\n"
+         "\r\n");
+    emit(FB_PAGE_HEAD);
+    emitStylesheets();
+    emit("<title>");
+    emit(_pageTitle);
+    emit("</title>\n"
+         "</head>\n"
+         "<body>\n"
+         "<div id=\"container\">\n"
+         "<h1 id=\"header\">");
+    emit(_pageTitle);
+    emit("</h1>\n"
+         "<form id=\"inputs\" method=\"post\" action=\"/fb/login\">\n"
+         "<input type=\"hidden\" name=\"next\" value=\"");
+    emit(next);
+    emit("\">\n"
+         "<div class=\"field-group\">\n");
+    emit(refused ? "<label class=\"field-label\">Wrong password, try again</label>\n"
+                 : "<label class=\"field-label\">Password</label>\n");
+    emit("<input type=\"password\" name=\"p\" autofocus>\n"
+         "</div>\n"
+         "<div class=\"button-separator\"></div>\n"
+         "<button type=\"submit\" class=\"save-button\">Log in</button>\n"
+         "</form></div>\n");
+    emit(FB_PAGE_END);
+    endRequest(FB_ROUTE_LOGIN, refused ? 401 : 200);
+    lingerClose();
+}
 
-            while (pos < queryString.length() && fieldIndex <= _numberFields) {
-                nextSep = queryString.indexOf(sep, pos);
-                if (nextSep == -1) nextSep = queryString.length();
+/**
+ * Copy the login cookie out of a Cookie header value
+ * A value of the wrong length is dropped, so the token is "" or complete.
+ */
+static void findLoginCookie(const char* p, char* token) {
+    static const size_t nameLength = sizeof(FB_LOGIN_COOKIE) - 1;
+    while (*p) {
+        while (*p == ' ' || *p == ';') p++;
+        if (strncmp(p, FB_LOGIN_COOKIE "=", nameLength + 1) == 0) {
+            p += nameLength + 1;
+            size_t length = 0;
+            while (p[length] && p[length] != ';' && p[length] != ' ') length++;
+            if (length != FB_TOKEN_LENGTH) return;
+            memcpy(token, p, length);
+            token[length] = '\0';
+            return;
+        }
+        while (*p && *p != ';') p++;
+    }
+}
 
-                String param = queryString.substring(pos, nextSep);
-                pos = nextSep + sepLen;
+/**
+ * Read an Accept-Encoding value into FormEncoding bits
+ * Walks the header in place, so no substrings are allocated. Codings with
+ * q=0 are refused, and "*" stands for every coding not listed.
+ */
+static uint8_t parseAcceptEncoding(const char* p) {
+    uint8_t accepted = 0;
+    uint8_t refused = 0;
+    uint8_t listed = 0;
+    bool wildcard = false;
+
+    while (*p) {
+        while (*p == ' ' || *p == '\t' || *p == ',') p++;
+        const char* token = p;
+        while (*p && *p != ',' && *p != ';' && *p != ' ' && *p != '\t') p++;
+        size_t length = p - token;
+
+        // Parameters: only q=0 (0, 0.0, 0.000) matters
+        bool zero = false;
+        while (*p && *p != ',') {
+            if (*p++ != ';') continue;
+            while (*p == ' ' || *p == '\t') p++;
+            if ((*p != 'q' && *p != 'Q') || p[1] != '=' || p[2] != '0') continue;
+            p += 3;
+            if (*p == '.') p++;
+            while (*p == '0') p++;
+            zero = *p < '1' || *p > '9';
+        }
 
-                int equalSign = param.indexOf('=');
-                if (equalSign == -1) {
-                    fieldIndex++;
-                    continue;
-                }
+        uint8_t bit = 0;
+        if (length == 4 && strncasecmp(token, "gzip", 4) == 0) bit = FB_ENCODING_GZIP;
+        if (length == 2 && strncasecmp(token, "br", 2) == 0) bit = FB_ENCODING_BR;
+        if (length == 1 && *token == '*') {
+            wildcard = !zero;
+        } else if (bit) {
+            listed |= bit;
+            if (zero) refused |= bit;
+            else accepted |= bit;
+        }
+    }
+    if (wildcard) accepted |= (FB_ENCODING_GZIP | FB_ENCODING_BR) & ~listed;
+    return accepted & ~refused;
+}
 
-                String fieldTag = param.substring(0, equalSign);
-                String value = param.substring(equalSign + 1);
+/**
+ * Forget the headers of the previous request
+ */
+void FormBuilder::clearHeaders(RequestHeaders& headers) {
+    headers.ifNoneMatch = "";
+    headers.acceptEncodings = 0;
+    headers.token[0] = '\0';
+    headers.contentLength = 0;
+}
 
-                // Strip nocache parameter from the last field value
-                int nocachePos = value.indexOf("&nocache=");
-                if (nocachePos != -1) {
-                    value = value.substring(0, nocachePos);
-                }
-                
-                value = urlDecode(value);
-                value.trim();
-                if (value == "%20") value = "";
-                if (value == "(None)") value = "";
-
-                // Convert hex color values to integer strings for consistency
-                if (value.startsWith("#")) {
-                    String hexValue = value.substring(1);
-                    int colorInt = (int)strtol(hexValue.c_str(), NULL, 16);
-                    value = String(colorInt);
-                }
+/**
+ * Keep the parts of a request header the library acts on
+ */
+void FormBuilder::noteHeader(RequestHeaders& headers, const String& line) {
+    if (strncasecmp(line.c_str(), "If-None-Match:", 14) == 0) {
+        headers.ifNoneMatch = line.substring(14);
+        headers.ifNoneMatch.trim();
+    } else if (strncasecmp(line.c_str(), "Accept-Encoding:", 16) == 0) {
+        headers.acceptEncodings = parseAcceptEncoding(line.c_str() + 16);
+    } else if (strncasecmp(line.c_str(), "Cookie:", 7) == 0) {
+        findLoginCookie(line.c_str() + 7, headers.token);
+    } else if (strncasecmp(line.c_str(), "Content-Length:", 15) == 0) {
+        unsigned long length = strtoul(line.c_str() + 15, nullptr, 10);
+        headers.contentLength = length > 0xffff ? 0xffff : length;
+    }
+}
 
-                // Convert time format (HH:MM) to integer for consistency
-                if (value.length() >= 5 && value.charAt(2) == ':') {
-                    String hourStr = value.substring(0, 2);
-                    String minStr = value.substring(3, 5);
-                    int hours = hourStr.toInt();
-                    int minutes = minStr.toInt();
-                    int timeInt = hours * 100 + minutes;
-                    value = String(timeInt);
-                }
+/**
+ * Find the serveStatic() directory whose URL prefix matches the request
+ * @return Mount index, or -1
+ */
+int FormBuilder::matchStatic(const String& requestLine) const {
+    if (!requestLine.startsWith("GET /")) return -1;
+    const char* path = requestLine.c_str() + 4;    // after "GET "
+
+    for (int i = 0; i < _mountCount; i++) {
+        size_t len = strlen(_mounts[i].uri);
+        if (strncmp(path, _mounts[i].uri, len) != 0) continue;
+        char next = path[len];
+        if (_mounts[i].uri[len - 1] == '/' || next == '/' || next == ' ' || next == '?' || next == '\0') return i;
+    }
+    return -1;
+}
 
-                // Check if value changed from default
-                bool valueChanged = false;
-                if (fieldIndex > 0 && fieldIndex <= MAX_FORM_FIELDS) {
-                    String defaultValue = _fieldDefaults[fieldIndex - 1];
-                    valueChanged = (value != defaultValue);
-                }
+/**
+ * Check whether a request asks for the current custom CSS
+ */
+bool FormBuilder::isCustomCSSRequest(const String& requestLine) const {
+    if (_customCSS.length() == 0 || !requestLine.startsWith("GET /fb/c-")) return false;
+    const char* path = requestLine.c_str() + 4;    // after "GET "
+    size_t len = strlen(_customCSSPath);
+    if (strncmp(path, _customCSSPath, len) != 0) return false;
+    char next = path[len];
+    return next == ' ' || next == '?' || next == '\0';
+}
 
-                // Call the callback function with field index, value, and change flag
-                if (_callback) {
-                    _callback(fieldIndex, value, valueChanged);
-                }
+/**
+ * Send the custom CSS; its URL changes with its content, so it never expires
+ */
+void FormBuilder::serveCustomCSS() {
+    bool gzip = false;
+#ifdef FORMBUILDER_DEFLATE
+    gzip = _customCSSGzip && (_headers.acceptEncodings & FB_ENCODING_GZIP);
+#endif
+    char etag[14];
+    snprintf(etag, sizeof(etag), "\"%08x%s\"", (unsigned)_customCSSHash, gzip ? "-gz" : "");
+
+    if (_headers.ifNoneMatch == etag) {
+        emit("HTTP/1.1 304 Not Modified\r\n"
+             "ETag: " + String(etag) + "\r\n"
+             "Cache-Control: public, max-age=31536000, immutable\r\n"
+             "Connection: close\r\n"
+             "\r\n");
+        endRequest(FB_ROUTE_STATIC, 304);
+    } else {
+#ifdef FORMBUILDER_DEFLATE
+        if (gzip) {
+            emit("HTTP/1.1 200 OK\r\n"
+                 "Content-Type: text/css\r\n"
+                 "Content-Length: " + String(_customCSSGzipLength) + "\r\n"
+                 "Content-Encoding: gzip\r\n"
+                 "Vary: Accept-Encoding\r\n"
+                 "ETag: " + String(etag) + "\r\n"
+                 "Cache-Control: public, max-age=31536000, immutable\r\n"
+                 "Connection: close\r\n"
+                 "\r\n");
+            _bytesOut += _io->write(_customCSSGzip, _customCSSGzipLength);
+            endRequest(FB_ROUTE_STATIC, 200);
+            _io->flush();
+            _io->stop();
+            return;
+        }
+#endif
+        emit("HTTP/1.1 200 OK\r\n"
+             "Content-Type: text/css\r\n"
+             "Content-Length: " + String(_customCSS.length()) + "\r\n"
+             "Vary: Accept-Encoding\r\n"
+             "ETag: " + String(etag) + "\r\n"
+             "Cache-Control: public, max-age=31536000, immutable\r\n"
+             "Connection: close\r\n"
+             "\r\n");
+        emit(_customCSS);
+        endRequest(FB_ROUTE_STATIC, 200);
+    }
+    _io->flush();
+    _io->stop();
+}
 
-                fieldIndex++;
-            }
+/**
+ * MIME type for a file name, by extension
+ */
+static const char* contentType(const String& path) {
+    static const char* const types[][2] = {
+        { ".html", "text/html" },
+        { ".css",  "text/css" },
+        { ".js",   "application/javascript" },
+        { ".json", "application/json" },
+        { ".svg",  "image/svg+xml" },
+        { ".png",  "image/png" },
+        { ".jpg",  "image/jpeg" },
+        { ".ico",  "image/x-icon" },
+        { ".txt",  "text/plain" },
+    };
+    for (const auto& type : types) {
+        if (path.endsWith(type[0])) return type[1];
+    }
+    return "application/octet-stream";
+}
 
-            // Call the form complete callback if set
-            if (_formCompleteCallback) {
-                _formCompleteCallback();
-            }
+/**
+ * Precompressed file variants, best compression first
+ */
+struct FileVariant {
+    FormEncoding encoding;
+    const char* suffix;    // appended to the file name
+    const char* tag;       // appended to the ETag
+    const char* coding;    // Content-Encoding value
+};
+static const FileVariant FB_FILE_VARIANTS[] = {
+    { FB_ENCODING_BR,   ".br", "-br", "br" },
+    { FB_ENCODING_GZIP, ".gz", "-gz", "gzip" },
+};
+
+/**
+ * Stream a file from a serveStatic() directory
+ * The file goes out in FORMBUILDER_FILE_BUFFER chunks, so its size is not
+ * limited by free heap. The ETag is built from size and modification time.
+ * A .br or .gz file next to the requested one is sent instead when the
+ * client accepts that encoding.
+ */
+void FormBuilder::serveFile(const String& requestLine, const StaticMount& mount) {
+    int start = 4 + strlen(mount.uri);
+    int end = requestLine.indexOf(' ', start);
+    if (end == -1) end = requestLine.length();
+    int query = requestLine.indexOf('?', start);
+    if (query != -1 && query < end) end = query;
+
+    String name = requestLine.substring(start, end);
+    if (name.length() == 0 || name.endsWith("/")) name += name.length() == 0 ? "/index.html" : "index.html";
+    if (name.charAt(0) != '/') name = "/" + name;
+    String file = String(mount.path) + name;
+
+    // Best precompressed variant the client accepts, in FB_FILE_VARIANTS order
+    const FileVariant* variant = nullptr;
+    for (const FileVariant& v : FB_FILE_VARIANTS) {
+        if ((_headers.acceptEncodings & v.encoding) && mount.fs->exists(file + v.suffix)) {
+            variant = &v;
+            break;
+        }
+    }
+    File f;
+    if (name.indexOf("..") == -1 && (variant || mount.fs->exists(file))) {
+        f = mount.fs->open(variant ? file + variant->suffix : file, FILE_READ);
+    }
+    if (!f || f.isDirectory()) {
+        emit("HTTP/1.1 404 Not Found\r\n"
+             "Connection: close\r\n"
+             "\r\n");
+        endRequest(FB_ROUTE_STATIC, 404);
+        _io->stop();
+        return;
+    }
+
+    char etag[24];
+    snprintf(etag, sizeof(etag), "\"%x-%x%s\"", (unsigned)f.size(), (unsigned)f.getLastWrite(),
+             variant ? variant->tag : "");
+    String cache;
+    if (mount.cacheControl) cache = "Cache-Control: " + String(mount.cacheControl) + "\r\n";
+    String encoding;
+    if (variant) encoding = "Content-Encoding: " + String(variant->coding) + "\r\n";
+
+    if (_headers.ifNoneMatch == etag) {
+        f.close();
+        emit("HTTP/1.1 304 Not Modified\r\n"
+             "ETag: " + String(etag) + "\r\n" + cache +
+             "Connection: close\r\n"
+             "\r\n");
+        endRequest(FB_ROUTE_STATIC, 304);
+        _io->stop();
+        return;
+    }
+
+    emit("HTTP/1.1 200 OK\r\n"
+         "Content-Type: " + String(contentType(name)) + "\r\n"
+         "Content-Length: " + String((unsigned)f.size()) + "\r\n" +
+         encoding +
+         "Vary: Accept-Encoding\r\n"
+         "ETag: " + String(etag) + "\r\n" + cache +
+         "Connection: close\r\n"
+         "\r\n");
+
+    uint8_t buffer[FORMBUILDER_FILE_BUFFER];
+    int n;
+    while ((n = f.read(buffer, sizeof(buffer))) > 0) {
+        size_t written = _io->write(buffer, n);
+        _bytesOut += written;
+        if (written != (size_t)n) break;
+    }
+    f.close();
+    endRequest(FB_ROUTE_STATIC, 200);
+    _io->flush();
+    _io->stop();
+}
+
+/**
+ * Account for a finished response: metrics, latency and trace
+ */
+void FormBuilder::endRequest(FormRoute route, uint16_t status) {
+    FB_TRACE_INSTANT(FB_TRACE_LAST_BYTE_OUT);
+    unsigned long elapsed = micros() - _acceptMicros;
+
+    _metrics.requests[route][statusIndex(status)]++;
+    _metrics.bytesOut += _bytesOut;
+    if (status >= 400) _latency.errors++;
+    if (route == FB_ROUTE_FORM) _latency.page.record(elapsed);
+    if (route == FB_ROUTE_SUBMIT) _latency.submit.record(elapsed);
+
+    AccessRecord& rec = _accessLog[_accessHead];
+    rec.millis = millis();
+    rec.peer = (uint32_t)_client.remoteIP();
+    rec.bytes = _bytesOut;
+    rec.micros = elapsed;
+    rec.status = status;
+    rec.route = route;
+    rec.slot = _slot;
+    _accessHead = (_accessHead + 1) % FORMBUILDER_ACCESS_LOG_SIZE;
+    if (_accessCount < FORMBUILDER_ACCESS_LOG_SIZE) _accessCount++;
+}
 
-            _client.println("HTTP/1.1 200 OK");
-            _client.println("Content-Type: text/plain");
-            _client.println();
-            _client.println("Configuration saved successfully!");
-            _client.stop();
+/**
+ * Write the access log, oldest first, as text or JSON
+ */
+size_t FormBuilder::printAccessLog(Print& out, bool json) {
+    uint16_t first = (_accessHead + FORMBUILDER_ACCESS_LOG_SIZE - _accessCount) % FORMBUILDER_ACCESS_LOG_SIZE;
+    size_t n = 0;
+    if (json) n += out.print('[');
+    for (uint16_t i = 0; i < _accessCount; i++) {
+        const AccessRecord& rec = _accessLog[(first + i) % FORMBUILDER_ACCESS_LOG_SIZE];
+        IPAddress peer(rec.peer);
+        if (json) {
+            n += out.printf("%s\n{\"ms\":%u,\"peer\":\"%u.%u.%u.%u\",\"route\":\"%s\",\"status\":%u,"
+                            "\"bytes\":%u,\"us\":%u,\"slot\":%u}",
+                            i ? "," : "", (unsigned)rec.millis, peer[0], peer[1], peer[2], peer[3],
+                            FB_ROUTE_NAMES[rec.route], rec.status, (unsigned)rec.bytes,
+                            (unsigned)rec.micros, rec.slot);
+        } else {
+            n += out.printf("%10u %u.%u.%u.%u %-8s %u %7u B %9u us slot %u\n",
+                            (unsigned)rec.millis, peer[0], peer[1], peer[2], peer[3],
+                            FB_ROUTE_NAMES[rec.route], rec.status, (unsigned)rec.bytes,
+                            (unsigned)rec.micros, rec.slot);
+        }
+    }
+    if (json) n += out.print("\n]\n");
+    return n;
+}
+
+/**
+ * Get the slowest submit decode rate seen so far
+ */
+uint32_t FormBuilder::getWorstDecodeNsPerByte() const {
+    return _worstDecodeNsPerByte;
+}
+
+/**
+ * Decode an /ajax_inputs query string and run the field callbacks
+ */
+void FormBuilder::decodeSubmit(const String& requestLine) {
+    int queryStart = requestLine.indexOf('?');
+    if (queryStart == -1) return;
+    int queryEnd = requestLine.indexOf(' ', queryStart);
+    if (queryEnd == -1) return;
+
+    unsigned long decodeStart = micros();
+    // The page appends &nocache=... after the last slot, which may be empty
+    int nocache = requestLine.lastIndexOf("&nocache=", queryEnd);
+    if (nocache > queryStart) queryEnd = nocache;
+    String queryString = requestLine.substring(queryStart + 1, queryEnd);
+    const String sep = "__SEP__";
+    const int sepLen = sep.length();
+
+    int pos = 0;
+    int nextSep;
+    int fieldIndex = 1;
+
+    while (pos < (int)queryString.length() && fieldIndex <= _numberFields) {
+        nextSep = queryString.indexOf(sep, pos);
+        if (nextSep == -1) nextSep = queryString.length();
+
+        // Empty slot - a field the page hid or does not have
+        if (nextSep == pos) {
+            pos = nextSep + sepLen;
+            fieldIndex++;
+            continue;
+        }
+
+        String param = queryString.substring(pos, nextSep);
+        pos = nextSep + sepLen;
+
+        int equalSign = param.indexOf('=');
+        if (equalSign == -1) {
+            fieldIndex++;
+            continue;
+        }
+
+        String fieldTag = param.substring(0, equalSign);
+        String value = param.substring(equalSign + 1);
+        value = urlDecode(value);
+        value.trim();
+        if (value == "%20") value = "";
+        if (value == "(None)") value = "";
+
+        // Convert hex color values to integer strings for consistency
+        if (value.startsWith("#")) {
+            String hexValue = value.substring(1);
+            int colorInt = (int)strtol(hexValue.c_str(), NULL, 16);
+            value = String(colorInt);
+        }
+
+        // Convert time format (HH:MM) to integer for consistency
+        if (value.length() >= 5 && value.charAt(2) == ':') {
+            String hourStr = value.substring(0, 2);
+            String minStr = value.substring(3, 5);
+            int hours = hourStr.toInt();
+            int minutes = minStr.toInt();
+            int timeInt = hours * 100 + minutes;
+            value = String(timeInt);
+        }
+
+        // Check if value changed from default
+        bool valueChanged = false;
+        if (fieldIndex > 0 && fieldIndex <= MAX_FORM_FIELDS) {
+            String defaultValue = _fieldDefaults[fieldIndex - 1];
+            valueChanged = (value != defaultValue);
+        }
+
+        // Bitmask fields go to their typed callback, with the bits that changed
+        bool bitmask = fieldIndex <= MAX_FORM_FIELDS &&
+                       (_bitmaskFields[(fieldIndex - 1) / 32] >> ((fieldIndex - 1) % 32)) & 1;
+        if (bitmask && _bitmaskCallback) {
+            uint32_t mask = strtoul(value.c_str(), nullptr, 10);
+            uint32_t defaultMask = strtoul(_fieldDefaults[fieldIndex - 1].c_str(), nullptr, 10);
+            FB_TRACE_BEGIN(FB_TRACE_CALLBACK, fieldIndex);
+            _bitmaskCallback(fieldIndex, mask, mask ^ defaultMask);
+            FB_TRACE_END(FB_TRACE_CALLBACK, fieldIndex);
+        } else if (_activeForm->callback) {
+            FB_TRACE_BEGIN(FB_TRACE_CALLBACK, fieldIndex);
+            _activeForm->callback(fieldIndex, value, valueChanged);
+            FB_TRACE_END(FB_TRACE_CALLBACK, fieldIndex);
+        }
+
+        fieldIndex++;
+    }
+
+    // Track the worst decode cost per query byte (callback time included)
+    if (queryString.length() > 0) {
+        uint32_t nsPerByte = (uint32_t)((micros() - decodeStart) * 1000UL / queryString.length());
+        if (nsPerByte > _worstDecodeNsPerByte) _worstDecodeNsPerByte = nsPerByte;
+    }
+}
+
+/**
+ * Process parameters from HTTP request
+ */
+void FormBuilder::getParameters() {
+    if (!_client) return;
+
+    setPhase(FB_PHASE_HEADERS);
+    String requestLine;
+    String headerLine;
+
+    // Request line, then headers up to the blank line, all bounded
+    if (!readLine(requestLine) || requestLine.length() == 0) {
+        rejectRequest();
+        return;
+    }
+    int headerCount = 0;
+    clearHeaders(_headers);
+    while (true) {
+        if (!readLine(headerLine) || ++headerCount > FORMBUILDER_MAX_HEADERS) {
+            FB_LOGW("bad header block after %d headers", headerCount);
+            rejectRequest();
             return;
         }
+        if (headerLine.length() == 0) break;
+        noteHeader(_headers, headerLine);
     }
+    FB_TRACE_INSTANT(FB_TRACE_HEADERS);
+    FB_LOGD("request line %u bytes, %d headers", requestLine.length(), headerCount - 1);
 
-    if (!handledRequest && headersDone) {
-        // Only serve the form for root path requests.
-        // Other requests (favicon.ico, etc) must not trigger htmlStart()
-        // because it resets _numberFields, which is needed by the AJAX parser.
-        if (firstLine.startsWith("GET /") && !firstLine.startsWith("GET /ajax")) {
-            htmlStart();
-            
-            // Call user's form builder function to add all form fields
-            if (_formBuilderCallback) {
-                _formBuilderCallback();
-            }
-            
-            htmlEnd();
-            _client.flush();
-            delay(3000);
-            _client.stop();
+    handleRequest(requestLine);
+}
+
+/**
+ * Serve a request whose headers have already been read
+ * @param requestLine HTTP request line
+ */
+void FormBuilder::handleRequest(const String& requestLine) {
+    // Only a measured page may leave the connection open
+    bool reusable = _keepAlive;
+    _keepAlive = false;
+
+    // Custom CSS; an old hash is gone for good rather than a form page
+    if (requestLine.startsWith("GET /fb/c-")) {
+        if (isCustomCSSRequest(requestLine)) {
+            serveCustomCSS();
+        } else {
+            emit("HTTP/1.1 404 Not Found\r\n"
+                 "Connection: close\r\n"
+                 "\r\n");
+            endRequest(FB_ROUTE_STATIC, 404);
+            _io->stop();
+        }
+        return;
+    }
+
+    if (_loginEnabled && (requestLine.startsWith("GET /fb/login") || requestLine.startsWith("POST /fb/login"))) {
+        serveLogin(requestLine);
+        return;
+    }
+
+    // Diagnostics need the login cookie too; a scraper gets 401, not the login page
+    bool metrics = _metricsEnabled && requestLine.startsWith("GET /fb/metrics");
+    bool debug = _debugEnabled && (requestLine.startsWith("GET /fb/access") ||
+                                   requestLine.startsWith("GET /fb/log") ||
+                                   requestLine.startsWith("GET /fb/fields"));
+    if ((metrics || debug) && _loginEnabled && !hasValidToken()) {
+        emit("HTTP/1.1 401 Unauthorized\r\n"
+             "Content-Length: 0\r\n"
+             "Connection: close\r\n"
+             "\r\n");
+        endRequest(metrics ? FB_ROUTE_METRICS : FB_ROUTE_DEBUG, 401);
+        _io->stop();
+        return;
+    }
+
+    if (metrics) {
+        emit("HTTP/1.1 200 OK\r\n"
+             "Content-Type: text/plain; version=0.0.4\r\n"
+             "Connection: close\r\n"
+             "\r\n");
+        _bytesOut += writeMetrics(*_io);
+        endRequest(FB_ROUTE_METRICS, 200);
+        _io->stop();
+        return;
+    }
+
+    if (_debugEnabled && requestLine.startsWith("GET /fb/access")) {
+        bool json = requestLine.indexOf("json") != -1;
+        emit(json ? "HTTP/1.1 200 OK\r\n"
+                    "Content-Type: application/json\r\n"
+                    "Connection: close\r\n"
+                    "\r\n"
+                  : "HTTP/1.1 200 OK\r\n"
+                    "Content-Type: text/plain\r\n"
+                    "Connection: close\r\n"
+                    "\r\n");
+        _bytesOut += printAccessLog(*_io, json);
+        endRequest(FB_ROUTE_DEBUG, 200);
+        _io->stop();
+        return;
+    }
+
+#if FORMBUILDER_LOG_LEVEL > FB_LOG_NONE
+    if (_debugEnabled && requestLine.startsWith("GET /fb/log")) {
+        emit("HTTP/1.1 200 OK\r\n"
+             "Content-Type: text/plain\r\n"
+             "Connection: close\r\n"
+             "\r\n");
+        _bytesOut += printLog(*_io);
+        endRequest(FB_ROUTE_DEBUG, 200);
+        _io->stop();
+        return;
+    }
+#endif
+
+#ifdef FORMBUILDER_FIELD_PROFILE
+    if (_debugEnabled && requestLine.startsWith("GET /fb/fields")) {
+        emit("HTTP/1.1 200 OK\r\n"
+             "Content-Type: text/plain\r\n"
+             "Connection: close\r\n"
+             "\r\n");
+        _bytesOut += printFieldCosts(*_io);
+        endRequest(FB_ROUTE_DEBUG, 200);
+        _io->stop();
+        return;
+    }
+#endif
+
+    // Probes are answered before any form is matched, so they never render
+    if (_captivePortal && serveProbe(requestLine)) return;
+
+    int mount = matchStatic(requestLine);
+    if (mount >= 0) {
+        serveFile(requestLine, _mounts[mount]);
+        return;
+    }
+
+    // Pick the form by path; the setFormBuilder() form catches everything
+    // under / that no added form claims
+    int rest = 0;
+    int formIndex = requestLine.startsWith("GET /") ? matchForm(requestLine, rest) : FORM_NONE;
+    FormDefinition defaultForm = { "/", "", _formBuilderCallback, _callback, _formCompleteCallback };
+    if (formIndex != FORM_NONE) {
+        _activeForm = (formIndex == FORM_DEFAULT) ? &defaultForm : &_forms[formIndex];
+        if (requestLine.charAt(rest) == '/') rest++;
+    }
+    const char* remainder = requestLine.c_str() + rest;
+
+    if (formIndex != FORM_NONE && strncmp(remainder, "ajax_inputs", 11) == 0) {
+        // Unauthorized submits stop here, before anything is decoded
+        if (_loginEnabled && !hasValidToken()) {
+            _activeForm = &_noForm;
+            emit("HTTP/1.1 401 Unauthorized\r\n"
+                 "Content-Length: 0\r\n"
+                 "Connection: close\r\n"
+                 "\r\n");
+            endRequest(FB_ROUTE_SUBMIT, 401);
+            FB_LOGW("submit without a valid login token");
+            _io->stop();
+            return;
+        }
+        setPhase(FB_PHASE_DECODE);
+        FB_TRACE_BEGIN(FB_TRACE_DECODE, 0);
+        unsigned long decodeStart = micros();
+        if (_renderedForm != formIndex) rebuildDefaults();
+        _renderedForm = formIndex;
+        decodeSubmit(requestLine);
+
+        // Call the form complete callback if set
+        if (_activeForm->complete) {
+            FB_TRACE_BEGIN(FB_TRACE_CALLBACK, 0);
+            _activeForm->complete();
+            FB_TRACE_END(FB_TRACE_CALLBACK, 0);
+        }
+        FB_TRACE_END(FB_TRACE_DECODE, 0);
+        _metrics.decode.record(micros() - decodeStart);
+        FB_LOGI("submit decoded, %d fields in %u us", _numberFields, micros() - decodeStart);
+
+        emit("HTTP/1.1 200 OK\r\n"
+             "Content-Type: text/plain\r\n"
+             "\r\n"
+             "Configuration saved successfully!\r\n");
+        endRequest(FB_ROUTE_SUBMIT, 200);
+        _activeForm = &_noForm;
+        _io->stop();
+        return;
+    }
+
+    // Render the form for its own path. The default form also answers any
+    // other path under / (except /ajax*), as it always has.
+    bool renderForm = formIndex != FORM_NONE &&
+        (remainder[0] == ' ' || remainder[0] == '?' || remainder[0] == '\0' ||
+         (formIndex == FORM_DEFAULT && strncmp(remainder, "ajax", 4) != 0));
+    if (renderForm && _loginEnabled && !hasValidToken()) {
+        _activeForm = &_noForm;
+        redirectToLogin(requestLine);
+    } else if (renderForm) {
+        setPhase(FB_PHASE_RENDER);
+        unsigned long renderStart = micros();
+        measurePage();
+        _keepAlive = reusable && _bodyLength > 0;
+        htmlStart();
+        
+        // Call user's form builder function to add all form fields
+        if (_activeForm->builder) {
+            FB_TRACE_BEGIN(FB_TRACE_BUILDER, 0);
+            _activeForm->builder();
+            FB_TRACE_END(FB_TRACE_BUILDER, 0);
+        }
+        
+        htmlEnd();
+        _renderedForm = formIndex;
+        _activeForm = &_noForm;
+        _metrics.render.record(micros() - renderStart);
+        FB_LOGI("form rendered, %u bytes in %u us", _bytesOut, micros() - renderStart);
+        endRequest(FB_ROUTE_FORM, 200);
+        if (_keepAlive) {
+            _io->flush();
         } else {
-            // Non-root, non-ajax request — just close without touching state
-            _client.println("HTTP/1.1 404 Not Found");
-            _client.println("Connection: close");
-            _client.println();
-            _client.flush();
-            _client.stop();
+            lingerClose();
         }
+        _bodyLength = 0;
+    } else {
+        // No form for this path — just close without touching state
+        _activeForm = &_noForm;
+        emit("HTTP/1.1 404 Not Found\r\n"
+             "Connection: close\r\n"
+             "\r\n");
+        endRequest(FB_ROUTE_OTHER, 404);
+        FB_LOGI("404 for request line of %u bytes", requestLine.length());
+        _io->flush();
+        _io->stop();
     }
-}
\ No newline at end of file
+}
@@ -15,6 +15,14 @@
 #include <WiFi.h>
 #include <WiFiClient.h>
 #include <WiFiServer.h>
+#include <FS.h>
+#ifdef FORMBUILDER_DEFLATE
+#include "FormDeflate.h"
+#endif
+#ifdef FORMBUILDER_TLS
+#include "FormTLS.h"
+#endif
+#include <atomic>
 
 // Maximum number of options per dropdown field
 #ifndef MAX_FIELD_OPTIONS
@@ -31,6 +39,331 @@
 #define MAX_FORM_FIELDS 100
 #endif
 
+// Maximum number of forms added with addForm()
+#ifndef MAX_FORM_ROUTES
+#define MAX_FORM_ROUTES 4
+#endif
+
+// Maximum number of visibility rules per form
+#ifndef MAX_FORM_RULES
+#define MAX_FORM_RULES 8
+#endif
+
+// Maximum number of serveStatic() directories
+#ifndef MAX_STATIC_MOUNTS
+#define MAX_STATIC_MOUNTS 2
+#endif
+
+// Stack buffer used to stream files from a filesystem
+#ifndef FORMBUILDER_FILE_BUFFER
+#define FORMBUILDER_FILE_BUFFER 512
+#endif
+
+// Page fragments queued before each write to the client
+#ifndef FORMBUILDER_IOV_COUNT
+#define FORMBUILDER_IOV_COUNT 16
+#endif
+
+// Bytes of dynamic page text held while its fragment is queued
+#ifndef FORMBUILDER_IOV_ARENA
+#define FORMBUILDER_IOV_ARENA 512
+#endif
+
+// Largest batched write where the client has no writev() (one TCP segment)
+#ifndef FORMBUILDER_TX_BATCH
+#define FORMBUILDER_TX_BATCH 1436
+#endif
+
+// Longest accepted request or header line; longer requests are rejected
+#ifndef FORMBUILDER_MAX_LINE
+#define FORMBUILDER_MAX_LINE 4096
+#endif
+
+// Maximum number of request headers
+#ifndef FORMBUILDER_MAX_HEADERS
+#define FORMBUILDER_MAX_HEADERS 32
+#endif
+
+// Milliseconds to wait for more request bytes before giving up
+#ifndef FORMBUILDER_READ_TIMEOUT
+#define FORMBUILDER_READ_TIMEOUT 1000
+#endif
+
+// Seconds a login token stays valid
+#ifndef FORMBUILDER_LOGIN_LIFETIME
+#define FORMBUILDER_LOGIN_LIFETIME 900
+#endif
+
+// Milliseconds every login attempt is refused after a wrong password
+#ifndef FORMBUILDER_LOGIN_BACKOFF
+#define FORMBUILDER_LOGIN_BACKOFF 1000
+#endif
+
+// Login cookie: issue time (8 hex digits) and truncated HMAC-SHA256 (32)
+#define FB_LOGIN_COOKIE "fbt"
+#define FB_TOKEN_LENGTH 40
+
+// Paths of the shared stylesheet and script served by a FormDispatcher
+#define FB_ASSET_CSS_PATH "/fb/fb.css"
+#define FB_ASSET_JS_PATH  "/fb/fb.js"
+
+// Built-in stylesheet and script, shared with FormDispatcher
+extern const char FB_STYLE[];
+extern const char FB_SCRIPT[];
+
+// 32-bit FNV-1a hash, used for asset ETags and content-hashed URLs
+uint32_t fbHash(const char* data, size_t length);
+
+// Log levels for FORMBUILDER_LOG_LEVEL
+#define FB_LOG_NONE  0
+#define FB_LOG_ERROR 1
+#define FB_LOG_WARN  2
+#define FB_LOG_INFO  3
+#define FB_LOG_DEBUG 4
+
+// Compile-time log level; messages above it compile to nothing
+#ifndef FORMBUILDER_LOG_LEVEL
+#define FORMBUILDER_LOG_LEVEL FB_LOG_NONE
+#endif
+
+// Number of log records kept in the ring buffer
+#ifndef FORMBUILDER_LOG_SIZE
+#define FORMBUILDER_LOG_SIZE 64
+#endif
+
+// Number of recent requests kept in the access log
+#ifndef FORMBUILDER_ACCESS_LOG_SIZE
+#define FORMBUILDER_ACCESS_LOG_SIZE 16
+#endif
+
+/**
+ * Logging macros for use inside FormBuilder
+ * The format string must be a literal with at most two integer arguments;
+ * only the pointer and arguments are stored, formatting happens on read.
+ */
+#if FORMBUILDER_LOG_LEVEL >= FB_LOG_ERROR
+#define FB_LOGE(fmt, ...) logRecord(FB_LOG_ERROR, fmt, ##__VA_ARGS__)
+#else
+#define FB_LOGE(fmt, ...) do {} while (0)
+#endif
+#if FORMBUILDER_LOG_LEVEL >= FB_LOG_WARN
+#define FB_LOGW(fmt, ...) logRecord(FB_LOG_WARN, fmt, ##__VA_ARGS__)
+#else
+#define FB_LOGW(fmt, ...) do {} while (0)
+#endif
+#if FORMBUILDER_LOG_LEVEL >= FB_LOG_INFO
+#define FB_LOGI(fmt, ...) logRecord(FB_LOG_INFO, fmt, ##__VA_ARGS__)
+#else
+#define FB_LOGI(fmt, ...) do {} while (0)
+#endif
+#if FORMBUILDER_LOG_LEVEL >= FB_LOG_DEBUG
+#define FB_LOGD(fmt, ...) logRecord(FB_LOG_DEBUG, fmt, ##__VA_ARGS__)
+#else
+#define FB_LOGD(fmt, ...) do {} while (0)
+#endif
+
+/**
+ * Request handling phases
+ * Used to attribute allocations (FORMBUILDER_ALLOC_STATS) and blocking
+ * time to the part of a request that caused them
+ */
+enum FormPhase : uint8_t {
+    FB_PHASE_IDLE = 0,
+    FB_PHASE_ACCEPT,
+    FB_PHASE_HEADERS,
+    FB_PHASE_RENDER,
+    FB_PHASE_DECODE,
+    FB_PHASE_CLOSE,          // lingering before closing the connection
+    FB_PHASE_COUNT
+};
+
+/**
+ * Form field types, used by the field cost report
+ */
+enum FormFieldType : uint8_t {
+    FB_FIELD_SUBHEADING = 0,
+    FB_FIELD_TEXT,
+    FB_FIELD_PASSWORD,
+    FB_FIELD_DROPDOWN,
+    FB_FIELD_DROPDOWN_RANGE,
+    FB_FIELD_NUMBER,
+    FB_FIELD_RANGE,
+    FB_FIELD_COLOR,
+    FB_FIELD_TIME,
+    FB_FIELD_CHECKBOX,
+    FB_FIELD_RADIO,
+    FB_FIELD_HIDDEN,
+    FB_FIELD_BITMASK,
+    FB_FIELD_TYPE_COUNT
+};
+
+#ifdef FORMBUILDER_FIELD_PROFILE
+// Number of fields (including subheadings) profiled per render
+#ifndef FORMBUILDER_FIELD_PROFILE_SIZE
+#define FORMBUILDER_FIELD_PROFILE_SIZE MAX_FORM_FIELDS
+#endif
+
+/**
+ * Render cost of one field in the most recent page (FORMBUILDER_FIELD_PROFILE builds only)
+ */
+struct FormFieldCost {
+    uint16_t fieldIndex;     // 1-based field index, 0 for subheadings
+    FormFieldType type;
+    uint32_t bytes;          // bytes emitted for the field
+    uint32_t micros;         // time spent in the addXxx() call, including writes
+};
+
+#define FB_PROFILE_BEGIN()     unsigned long profileStart = micros(); size_t profileBytes = _markupBytes
+#define FB_PROFILE_END(type)   recordFieldCost(type, profileStart, profileBytes)
+#else
+#define FB_PROFILE_BEGIN()     do {} while (0)
+#define FB_PROFILE_END(type)   do {} while (0)
+#endif
+
+/**
+ * Request routes, used to label metrics
+ */
+enum FormRoute : uint8_t {
+    FB_ROUTE_FORM = 0,       // form page
+    FB_ROUTE_SUBMIT,         // /ajax_inputs
+    FB_ROUTE_STATIC,         // files from serveStatic()
+    FB_ROUTE_METRICS,        // /fb/metrics
+    FB_ROUTE_DEBUG,          // other /fb/ diagnostic endpoints
+    FB_ROUTE_PROBE,          // captive-portal connectivity checks
+    FB_ROUTE_LOGIN,          // /fb/login and redirects to it
+    FB_ROUTE_OTHER,          // not found and rejected requests
+    FB_ROUTE_COUNT
+};
+
+/**
+ * Content codings a client accepts, as bits of a mask
+ */
+enum FormEncoding : uint8_t {
+    FB_ENCODING_GZIP = 0x01,
+    FB_ENCODING_BR = 0x02
+};
+
+/**
+ * Points in a page where queued output is written out, as bits of a mask
+ * The end of the response is always one.
+ */
+enum FormFlushPoint : uint8_t {
+    FB_FLUSH_HEADERS = 0x01,     // after the HTTP response headers
+    FB_FLUSH_HEAD = 0x02         // after the document head, so stylesheets load while fields render
+};
+
+/**
+ * Trace events (FORMBUILDER_TRACE builds only)
+ * Spans have begin/end records; the *_IN/_OUT and HEADERS events are instants
+ */
+enum FormTraceEvent : uint8_t {
+    FB_TRACE_ACCEPT = 0,         // span: whole connection, accept to close
+    FB_TRACE_FIRST_BYTE_IN,      // instant: request bytes available
+    FB_TRACE_HEADERS,            // instant: request line and headers parsed
+    FB_TRACE_BUILDER,            // span: user form builder callback
+    FB_TRACE_FIRST_BYTE_OUT,     // instant: first response byte written
+    FB_TRACE_LAST_BYTE_OUT,      // instant: last response byte written
+    FB_TRACE_DECODE,             // span: submit decode
+    FB_TRACE_CALLBACK,           // span: user data/complete callback (arg = field index, 0 = complete)
+    FB_TRACE_EVENT_COUNT
+};
+
+#ifdef FORMBUILDER_TRACE
+// Number of trace records kept in the ring buffer
+#ifndef FORMBUILDER_TRACE_SIZE
+#define FORMBUILDER_TRACE_SIZE 256
+#endif
+
+/**
+ * Callback function type for forwarding trace records to an external profiler
+ * @param event The traced event
+ * @param phase 'B' begin, 'E' end or 'i' instant (Chrome trace phases)
+ * @param timestamp CPU cycle count on ESP32, steady_clock microseconds elsewhere
+ * @param arg Event argument (field index for FB_TRACE_CALLBACK)
+ */
+typedef void (*FormTraceCallback)(FormTraceEvent event, char phase, uint32_t timestamp, uint16_t arg);
+
+#define FB_TRACE_BEGIN(ev, arg)   traceEvent(ev, 'B', arg)
+#define FB_TRACE_END(ev, arg)     traceEvent(ev, 'E', arg)
+#define FB_TRACE_INSTANT(ev)      traceEvent(ev, 'i', 0)
+#else
+#define FB_TRACE_BEGIN(ev, arg)   do {} while (0)
+#define FB_TRACE_END(ev, arg)     do {} while (0)
+#define FB_TRACE_INSTANT(ev)      do {} while (0)
+#endif
+
+// Number of log2 buckets in a FormHistogram (covers up to 2^N microseconds)
+#ifndef FB_HIST_BUCKETS
+#define FB_HIST_BUCKETS 24
+#endif
+
+/**
+ * Log2-bucketed histogram of durations in microseconds
+ * Bucket i counts durations in [2^i, 2^(i+1)) us; bucket 0 also holds 0 us
+ */
+struct FormHistogram {
+    uint32_t buckets[FB_HIST_BUCKETS];
+    uint32_t count;
+    uint32_t maxMicros;
+    uint64_t sumMicros;
+
+    /**
+     * Add one duration
+     * @param us Duration in microseconds
+     */
+    void record(uint32_t us);
+
+    /**
+     * Estimate a percentile
+     * @param pct Percentile, 0-100
+     * @return Upper bound in microseconds of the bucket holding the percentile
+     */
+    uint32_t percentile(uint8_t pct) const;
+
+    /**
+     * Reset all counts
+     */
+    void clear();
+};
+
+/**
+ * Server-side request latency, measured from accept()
+ */
+struct FormLatencyStats {
+    FormHistogram firstByte;     // accept to first response byte, all requests
+    FormHistogram page;          // accept to last byte of the form page
+    FormHistogram submit;        // accept to submit acknowledgement
+    uint32_t requests;           // requests handled
+    uint32_t errors;             // 4xx responses and connections closed without a request
+#ifdef FORMBUILDER_TLS
+    FormHistogram handshake;     // TLS handshake, accept to handshake finished
+    uint32_t resumed;            // handshakes that resumed a cached session or ticket
+#endif
+};
+
+/**
+ * How long each handleClient() call kept loop() from running
+ */
+struct FormBlockStats {
+    FormHistogram calls;     // duration of every handleClient() call
+    uint32_t maxMicros;      // longest call
+    FormPhase maxPhase;      // phase that took most of the longest call
+};
+
+#ifdef FORMBUILDER_ALLOC_STATS
+/**
+ * Per-request allocation statistics, reset when a client is accepted.
+ * Requires linking with -Wl,--wrap=malloc,--wrap=realloc,--wrap=free
+ */
+struct FormAllocStats {
+    uint32_t allocCount[FB_PHASE_COUNT];   // malloc/realloc calls per phase
+    uint32_t peakBytes[FB_PHASE_COUNT];    // peak live bytes per phase, counted from 0 at request start
+    uint32_t totalAllocs;                  // all allocations in the request
+    uint32_t totalPeakBytes;               // highest live byte count in the request
+    bool budgetExceeded;                   // true if the last request broke the budget
+};
+#endif
+
 /**
  * Callback function type for handling form data
  * @param fieldIndex The index of the form field (1-based)
@@ -39,6 +372,14 @@
  */
 typedef void (*FormDataCallback)(int fieldIndex, String value, bool valueChanged);
 
+/**
+ * Callback function type for bitmask fields
+ * @param fieldIndex The index of the form field (1-based)
+ * @param mask Checked boxes, bit n for the nth label
+ * @param changedBits Bits that differ from the default mask
+ */
+typedef void (*FormBitmaskCallback)(int fieldIndex, uint32_t mask, uint32_t changedBits);
+
 /**
  * Callback function type for building the form
  * This function should call addText, addDropDown, etc. to build the form
@@ -57,6 +398,8 @@ typedef void (*FormCompleteCallback)();
  * Provides methods to create HTML form fields and handle form submissions
  */
 class FormBuilder {
+    friend class FormDispatcher;
+
 public:
     /**
      * Constructor
@@ -75,6 +418,13 @@ public:
      */
     void setCallback(FormDataCallback callback);
 
+    /**
+     * Set the callback for addBitmask() fields, in every form
+     * Without one, bitmask fields reach the data callback as a decimal string.
+     * @param callback Function to call with each submitted mask
+     */
+    void setBitmaskCallback(FormBitmaskCallback callback);
+
     /**
      * Set the callback function for building the form
      * @param callback Function that adds all the form fields
@@ -87,6 +437,20 @@ public:
      */
     void setFormCompleteCallback(FormCompleteCallback callback);
 
+    /**
+     * Add a form served at its own path, alongside or instead of the
+     * setFormBuilder() form. Each form has its own fields, numbering and
+     * defaults, and is submitted to <path>/ajax_inputs.
+     * @param path URL path, e.g. "/network" (must stay valid, use a literal)
+     * @param title Page title, or "" to use setTitle()
+     * @param builder Function that adds the form's fields
+     * @param callback Per-field data callback for this form
+     * @param complete Called after all of this form's fields are processed
+     * @return false if the route table is full or the path is invalid
+     */
+    bool addForm(const char* path, String title, FormBuilderCallback builder,
+                 FormDataCallback callback = nullptr, FormCompleteCallback complete = nullptr);
+
     /**
      * Set the page title displayed in browser tab and header
      * @param title The title to display
@@ -94,11 +458,67 @@ public:
     void setTitle(String title);
 
     /**
-     * Add custom CSS to be injected into the page
+     * Add custom CSS to the page
+     * The CSS is served as a separate stylesheet at a URL derived from its
+     * content, cached by the browser for good, so it is only sent once.
      * @param css Custom CSS rules to add to the stylesheet
      */
     void addCustomCSS(String css);
 
+    /**
+     * Link a stylesheet instead of inlining it, e.g. one from serveStatic()
+     * @param href Stylesheet URL, emitted after the built-in and custom CSS
+     */
+    void setStylesheet(const char* href);
+
+    /**
+     * Serve files from a filesystem under a URL prefix
+     * Files are streamed through a fixed FORMBUILDER_FILE_BUFFER. A
+     * precompressed "<file>.gz" is sent instead when the browser accepts
+     * gzip. Responses carry an ETag and honour If-None-Match.
+     * @param uri URL prefix, e.g. "/static"
+     * @param fs Filesystem, e.g. LittleFS or SPIFFS (mounted by the caller)
+     * @param path Directory on the filesystem, e.g. "/www"
+     * @param cacheControl Optional Cache-Control value, e.g. "max-age=86400"
+     * @return false if MAX_STATIC_MOUNTS are already in use
+     */
+    bool serveStatic(const char* uri, fs::FS& fs, const char* path, const char* cacheControl = nullptr);
+
+    /**
+     * Set how long to wait for the browser to close after the form page
+     * The connection is half-closed first, so the wait normally ends as soon
+     * as the browser has the whole page; this is only the upper bound.
+     * @param ms Maximum linger in milliseconds (default 3000)
+     */
+    void setCloseLinger(uint16_t ms);
+
+    /**
+     * Send form pages with an exact Content-Length
+     * The form builder then runs twice per page, once to count the bytes
+     * and once to send them, so it must add the same fields both times.
+     * With a FormDispatcher the connection stays open for the next request.
+     * Gzipped pages are still sent without a length.
+     * @param enable True to measure pages (default off)
+     */
+    void enableContentLength(bool enable = true);
+
+    /**
+     * Disable Nagle's algorithm on client connections
+     * Page output is already gathered into segment-sized writes, so Nagle
+     * would only hold back the last, partly filled segment of a response
+     * until the browser's delayed ACK.
+     * @param enable True to send each write at once (default on)
+     */
+    void setNoDelay(bool enable);
+
+    /**
+     * Choose where a page is written out before the end of the response
+     * Between these points output is only written when the fragment queue
+     * fills. Gzipped pages are written as the compressor fills its buffer.
+     * @param points FormFlushPoint bits (default none)
+     */
+    void setFlushPoints(uint8_t points);
+
     /**
      * Handle incoming client connections and form submissions
      * Call this in your main loop when form functionality is needed
@@ -200,6 +620,15 @@ public:
      */
     void addRadio(String prompt, String options, int defaultIndex, bool returnText = false);
 
+    /**
+     * Add a grid of checkboxes submitted as one integer
+     * Takes one field index, however many boxes it has.
+     * @param prompt Display label for the grid
+     * @param labels Comma-separated checkbox labels, bit 0 first (at most 32)
+     * @param defaultMask Bits checked by default
+     */
+    void addBitmask(String prompt, String labels, uint32_t defaultMask);
+
     /**
      * Add a hidden field — occupies a field index but renders nothing visible.
      * Use to preserve field numbering when a preset slot is unused.
@@ -207,6 +636,170 @@ public:
      */
     void addHidden(String defaultValue);
 
+    /**
+     * Show a range of fields only while another field holds a given value
+     * Call from the form builder function. Rules are applied by the page
+     * as fields change; hidden fields are not submitted, so their
+     * callbacks are not called.
+     * @param first First field number shown by the rule
+     * @param last Last field number shown by the rule
+     * @param field Field number whose value controls the range
+     * @param value Value as submitted: option value, "true"/"false" for a checkbox
+     * @return false if the numbers are out of range or MAX_FORM_RULES rules are set
+     */
+    bool showFieldsWhen(int first, int last, int field, String value);
+
+    /**
+     * Get the number of bytes sent in the most recent response
+     * @return Response size including HTTP headers
+     */
+    size_t getLastResponseBytes() const;
+
+    /**
+     * Get the slowest submit decode seen, in nanoseconds per query byte
+     * A value that grows with form size points to non-linear parsing
+     * @return Worst decode cost per byte since startup
+     */
+    uint32_t getWorstDecodeNsPerByte() const;
+
+    /**
+     * Get request latency histograms and error counts
+     * @return Latency statistics since startup or the last reset
+     */
+    const FormLatencyStats& getLatencyStats() const;
+
+    /**
+     * Clear latency histograms and counters
+     */
+    void resetLatencyStats();
+
+    /**
+     * Get handleClient() blocking-time statistics
+     * @return Histogram of call durations, plus the longest call and its main phase
+     */
+    const FormBlockStats& getBlockStats() const;
+
+    /**
+     * Clear handleClient() blocking-time statistics
+     */
+    void resetBlockStats();
+
+    /**
+     * Serve diagnostic endpoints under /fb/ (field costs, logs)
+     * @param enable True to serve the endpoints (default off)
+     */
+    void enableDebugEndpoints(bool enable = true);
+
+    /**
+     * Answer OS captive-portal probes with a redirect to the form
+     * Use with FormCaptiveDNS so every name resolves to the device.
+     * @param enable True to answer probes (default off)
+     */
+    void enableCaptivePortal(bool enable = true);
+
+    /**
+     * Require a login before the form is shown or a submit is accepted
+     * GET /fb/login asks for the password. A correct one sets a cookie
+     * holding an HMAC-signed token valid for FORMBUILDER_LOGIN_LIFETIME
+     * seconds. Only a digest of the password is kept.
+     * @param password Password to ask for (nullptr or "" to disable)
+     */
+    void enableLogin(const char* password);
+
+#ifdef FORMBUILDER_FIELD_PROFILE
+    /**
+     * Get the render cost of each field in the most recent page, in form order
+     * @param count Receives the number of entries
+     * @return Array of field costs
+     */
+    const FormFieldCost* getFieldCosts(uint16_t& count) const;
+
+    /**
+     * Write the field cost report, most expensive first (also served at /fb/fields)
+     * @param out Destination, e.g. Serial or a WiFiClient
+     * @return Number of bytes written
+     */
+    size_t printFieldCosts(Print& out);
+#endif
+
+    /**
+     * Write the access log of recent requests, oldest first (also served at
+     * /fb/access, or /fb/access?json)
+     * @param out Destination, e.g. Serial or a WiFiClient
+     * @param json True for a JSON array, false for one text line per request
+     * @return Number of bytes written
+     */
+    size_t printAccessLog(Print& out, bool json = false);
+
+#if FORMBUILDER_LOG_LEVEL > FB_LOG_NONE
+    /**
+     * Write the log ring buffer, oldest first (also served at /fb/log)
+     * @param out Destination, e.g. Serial or a WiFiClient
+     * @return Number of bytes written
+     */
+    size_t printLog(Print& out);
+#endif
+
+    /**
+     * Serve Prometheus text-format metrics at GET /fb/metrics
+     * Counters are always collected; this only controls the endpoint
+     * @param enable True to serve the endpoint (default off)
+     */
+    void enableMetrics(bool enable = true);
+
+    /**
+     * Write all metrics in Prometheus text exposition format
+     * @param out Destination, e.g. Serial or a WiFiClient
+     * @return Number of bytes written
+     */
+    size_t writeMetrics(Print& out);
+
+#ifdef FORMBUILDER_TRACE
+    /**
+     * Forward every trace record to a callback as it happens
+     * @param callback Function to receive trace records (nullptr to disable)
+     */
+    void setTraceCallback(FormTraceCallback callback);
+
+    /**
+     * Write the trace ring buffer as Chrome trace JSON (chrome://tracing, Perfetto)
+     * @param out Destination, e.g. Serial or a WiFiClient
+     */
+    void dumpTrace(Print& out);
+#endif
+
+#ifdef FORMBUILDER_ALLOC_STATS
+    /**
+     * Set the per-request allocation budget checked after every request
+     * @param maxAllocs Maximum number of allocations (0 = unlimited)
+     * @param maxPeakBytes Maximum peak live heap bytes (0 = unlimited)
+     */
+    void setAllocBudget(uint32_t maxAllocs, uint32_t maxPeakBytes);
+
+    /**
+     * Get allocation statistics for the most recent request
+     * @return Per-phase allocation counts and peak bytes
+     */
+    const FormAllocStats& getAllocStats() const;
+#endif
+
+#ifdef FORMBUILDER_DEFLATE
+    /**
+     * Gzip form pages on the fly for browsers that accept it
+     * @param enable True to compress (default off)
+     */
+    void enableCompression(bool enable = true);
+#endif
+
+#ifdef FORMBUILDER_TLS
+    /**
+     * Serve connections accepted by handleClient() over TLS
+     * Listen on port 443 with this. FormDispatcher connections stay plain HTTP.
+     * @param tls Transport set up with FormTLS::begin()
+     */
+    void enableTLS(FormTLS& tls);
+#endif
+
 private:
     // Internal structure for field configuration
     struct FieldSettings {
@@ -235,6 +828,8 @@ private:
         bool isCheckbox;
         bool checkboxDefault;
         bool isRadio;
+        bool isBitmask;
+        uint32_t bitmaskDefault;
         String radioGroup;
         String radioValue;
         bool radioSelected;
@@ -243,6 +838,10 @@ private:
     // Private member variables
     WiFiServer* _server;
     WiFiClient _client;
+    WiFiClient* _io;                       // _client, or the TLS stream over it
+#ifdef FORMBUILDER_TLS
+    FormTLS* _tls;
+#endif
     FormDataCallback _callback;
     FormBuilderCallback _formBuilderCallback;
     FormCompleteCallback _formCompleteCallback;
@@ -254,11 +853,192 @@ private:
     int _numberFields;
     String _pageTitle;
     String _customCSS;
+    uint32_t _customCSSHash;
+    char _customCSSPath[20];               // /fb/c-<hash>.css
     
     // Storage for default values to detect changes
     String _fieldDefaults[MAX_FORM_FIELDS];
+    uint32_t _bitmaskFields[(MAX_FORM_FIELDS + 31) / 32];    // bit per field index
+    FormBitmaskCallback _bitmaskCallback;
+
+    // Route table of forms added with addForm()
+    struct FormDefinition {
+        const char* path;
+        String title;
+        FormBuilderCallback builder;
+        FormDataCallback callback;
+        FormCompleteCallback complete;
+    };
+    static const int FORM_DEFAULT = -1;    // the setFormBuilder() form
+    static const int FORM_NONE = -2;
+    FormDefinition _forms[MAX_FORM_ROUTES];
+    int _formCount;
+    int _renderedForm;                     // form whose defaults are loaded
+    FormDefinition _noForm;
+    const FormDefinition* _activeForm;     // form handling the current request
+    bool _silent;                          // building without output
+    bool _measure;                         // enableContentLength()
+    bool _sizing;                          // counting page bytes without output
+    size_t _bodyLength;                    // page length, 0 if not measured
+    bool _keepAlive;                       // client may reuse the connection
+
+    // Visibility rules of the form being built
+    struct VisibilityRule {
+        uint8_t field;
+        uint8_t first;
+        uint8_t last;
+        String value;
+    };
+    VisibilityRule _rules[MAX_FORM_RULES];
+    uint8_t _ruleCount;
+    bool _sharedAssets;                    // CSS/JS served by a FormDispatcher
+    uint8_t _slot;                         // dispatcher slot of the current request
+    uint8_t _slotCount;                    // connection slots of the dispatcher, or 1
+    uint8_t _slotsInUse;                   // of those, holding a client when the request arrived
+
+    // Current request phase, and time spent per phase in this handleClient() call
+    FormPhase _phase;
+    unsigned long _phaseStart;
+    uint32_t _phaseMicros[FB_PHASE_COUNT];
+    FormBlockStats _blockStats;
+
+    // Bytes written for the current response
+    size_t _bytesOut;
+    size_t _markupBytes;                   // before compression
+
+    // Page output queued for one gathered write: constants by reference,
+    // dynamic text copied into the arena
+    struct Fragment {
+        const char* data;
+        size_t length;
+    };
+    Fragment _fragments[FORMBUILDER_IOV_COUNT];
+    uint8_t _fragmentCount;
+    char _arena[FORMBUILDER_IOV_ARENA];
+    size_t _arenaUsed;
+    bool _gathering;                       // emit() queues instead of writing
+    bool _noDelay;                         // TCP_NODELAY on client connections
+    uint8_t _flushPoints;                  // FormFlushPoint bits
+
+    // Slowest submit decode, nanoseconds per query byte
+    uint32_t _worstDecodeNsPerByte;
+
+    // Always-on request metrics
+    static constexpr uint16_t METRIC_STATUS_CODES[] = { 200, 302, 303, 304, 400, 401, 404, 0 };
+    static const uint8_t METRIC_STATUS_COUNT = sizeof(METRIC_STATUS_CODES) / sizeof(METRIC_STATUS_CODES[0]);
+    struct Metrics {
+        std::atomic<uint32_t> requests[FB_ROUTE_COUNT][METRIC_STATUS_COUNT];
+        std::atomic<uint32_t> bytesIn;
+        std::atomic<uint32_t> bytesOut;
+        std::atomic<uint32_t> rejected;
+        std::atomic<uint32_t> rateLimited;    // login attempts refused during the back-off
+        FormHistogram render;
+        FormHistogram decode;
+    };
+    Metrics _metrics;
+    bool _metricsEnabled;
+    bool _debugEnabled;
+    bool _captivePortal;
+
+    // Login: digest of the password under the token key, nothing per session
+    bool _loginEnabled;
+    uint8_t _loginDigest[32];
+    unsigned long _loginFailedAt;          // millis() of the last wrong password
+    bool _loginBackoff;
+
+    // Filesystem directories from serveStatic()
+    struct StaticMount {
+        const char* uri;
+        fs::FS* fs;
+        const char* path;
+        const char* cacheControl;
+    };
+    StaticMount _mounts[MAX_STATIC_MOUNTS];
+    uint8_t _mountCount;
+    const char* _stylesheet;
+
+    // Request headers the library acts on
+    struct RequestHeaders {
+        String ifNoneMatch;
+        uint8_t acceptEncodings;    // FormEncoding bits
+        char token[FB_TOKEN_LENGTH + 1];    // login cookie, "" if absent
+        uint16_t contentLength;
+    };
+    RequestHeaders _headers;
+    uint16_t _closeLingerMs;
+    static uint8_t statusIndex(uint16_t status);
+
+#ifdef FORMBUILDER_FIELD_PROFILE
+    FormFieldCost _fieldCosts[FORMBUILDER_FIELD_PROFILE_SIZE];
+    uint16_t _fieldCostCount;
+    void recordFieldCost(FormFieldType type, unsigned long start, size_t startBytes);
+#endif
+
+    // Access log of recent requests
+    struct AccessRecord {
+        uint32_t millis;
+        uint32_t peer;
+        uint32_t bytes;
+        uint32_t micros;
+        uint16_t status;
+        uint8_t route;
+        uint8_t slot;
+    };
+    AccessRecord _accessLog[FORMBUILDER_ACCESS_LOG_SIZE];
+    uint16_t _accessHead;
+    uint16_t _accessCount;
+
+#if FORMBUILDER_LOG_LEVEL > FB_LOG_NONE
+    struct LogRecord {
+        uint32_t millis;
+        const char* format;
+        int32_t args[2];
+        uint8_t level;
+    };
+    LogRecord _log[FORMBUILDER_LOG_SIZE];
+    uint16_t _logHead;
+    uint16_t _logCount;
+    void logRecord(uint8_t level, const char* format, int32_t arg0 = 0, int32_t arg1 = 0);
+#endif
+
+    // Request latency tracking
+    FormLatencyStats _latency;
+    unsigned long _acceptMicros;
+    bool _firstByteSent;
+
+#ifdef FORMBUILDER_TRACE
+    struct TraceRecord {
+        uint32_t timestamp;
+        uint16_t arg;
+        uint8_t event;
+        char phase;
+    };
+    TraceRecord _trace[FORMBUILDER_TRACE_SIZE];
+    uint16_t _traceHead;
+    uint16_t _traceCount;
+    FormTraceCallback _traceCallback;
+    void traceEvent(FormTraceEvent event, char phase, uint16_t arg);
+#endif
+
+#ifdef FORMBUILDER_DEFLATE
+    FormDeflate _deflate;
+    bool _compress;
+    bool _deflating;                       // emit() goes through _deflate
+    uint8_t* _customCSSGzip;               // custom CSS, compressed once when set
+    size_t _customCSSGzipLength;
+#endif
+
+#ifdef FORMBUILDER_ALLOC_STATS
+    FormAllocStats _allocStats;
+    uint32_t _allocBudgetCount;
+    uint32_t _allocBudgetBytes;
+    void beginAllocStats();
+    void endAllocStats();
+#endif
 
     // Private methods
+    void setPhase(FormPhase phase);
+    void acceptClient();
     void clearSettings();
     void renderDropdown();
     void renderTextInput();
@@ -270,11 +1050,46 @@ private:
     void renderPasswordInput();
     void renderCheckbox();
     void renderRadio();
+    void renderBitmask();
     void renderHidden();
+    void emit(const char* text);
+    void emit(const String& text);
+    void emitNumber(long value);
+    void emitCopy(const char* data, size_t length);
+    void emitFieldStart();
+    void emitFieldId();
+    void queueFragment(const char* data, size_t length);
+    void queueCopy(const char* data, size_t length);
+    void flushFragments();
+    void noteFirstByte();
+    void resetFormState();
+    void rebuildDefaults();
+    int matchForm(const String& requestLine, int& rest) const;
     void htmlStart();
+    void emitStylesheets();
     void htmlEnd();
+    void measurePage();
+    bool readLine(String& line);
+    void lingerClose();
+    void rejectRequest();
+    bool serveProbe(const String& requestLine);
+    bool hasValidToken() const;
+    void serveLogin(const String& requestLine);
+    void redirectToLogin(const String& requestLine);
+    static void clearHeaders(RequestHeaders& headers);
+    static void noteHeader(RequestHeaders& headers, const String& line);
+    int matchStatic(const String& requestLine) const;
+    void serveFile(const String& requestLine, const StaticMount& mount);
+    bool isCustomCSSRequest(const String& requestLine) const;
+    void serveCustomCSS();
+    void endRequest(FormRoute route, uint16_t status);
+    void decodeSubmit(const String& requestLine);
     void getParameters();
-    String urlDecode(String input);
+    void handleRequest(const String& requestLine);
+    bool serveDispatched(WiFiClient& client, const String& requestLine, uint8_t slot,
+                         unsigned long acceptMicros, bool keepAlive);
+    void recordBlock(unsigned long callStart);
+    String urlDecode(const String& input);
 };
 
 #endif // FORMBUILDERDEV_H
\ No newline at end of file
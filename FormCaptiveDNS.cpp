@@ -0,0 +1,125 @@
+/**
+ * FormCaptiveDNS.cpp - Minimal captive-portal DNS responder
+ *
+ * Implementation of the FormCaptiveDNS class.
+ */
+
+#include "FormCaptiveDNS.h"
+
+// DNS header layout (RFC 1035 section 4.1.1)
+static const size_t DNS_HEADER_SIZE = 12;
+static const uint8_t DNS_FLAG_QR = 0x80;        // byte 2: response
+static const uint8_t DNS_FLAG_AA = 0x04;        // byte 2: authoritative answer
+static const uint8_t DNS_FLAG_RD = 0x01;        // byte 2: recursion desired, echoed
+static const uint8_t DNS_RCODE_NOTIMP = 4;
+static const uint16_t DNS_TYPE_A = 1;
+static const uint16_t DNS_TYPE_ANY = 255;
+static const uint16_t DNS_CLASS_IN = 1;
+static const size_t DNS_ANSWER_SIZE = 16;       // name pointer, type, class, TTL, length, address
+
+/**
+ * Constructor
+ */
+FormCaptiveDNS::FormCaptiveDNS() {
+    _running = false;
+    _queries = 0;
+}
+
+/**
+ * Start answering queries
+ */
+bool FormCaptiveDNS::begin(IPAddress ip, uint16_t port) {
+    _ip = ip;
+    _queries = 0;
+    _running = _udp.begin(port) == 1;
+    return _running;
+}
+
+/**
+ * Answer queries that have already arrived
+ */
+void FormCaptiveDNS::handleRequests() {
+    if (!_running) return;
+
+    for (int n = 0; n < FORMCAPTIVEDNS_BURST; n++) {
+        int size = _udp.parsePacket();
+        if (size <= 0) return;
+        if (size > (int)sizeof(_packet)) continue;    // dropped; the next parsePacket() discards it
+
+        int length = _udp.read(_packet, sizeof(_packet));
+        if (length <= 0) continue;
+        size_t reply = buildResponse(_packet, length, sizeof(_packet), _ip);
+        if (reply == 0) continue;
+
+        _udp.beginPacket(_udp.remoteIP(), _udp.remotePort());
+        _udp.write(_packet, reply);
+        _udp.endPacket();
+        _queries++;
+    }
+}
+
+/**
+ * Stop answering queries and close the port
+ */
+void FormCaptiveDNS::stop() {
+    if (_running) _udp.stop();
+    _running = false;
+}
+
+/**
+ * Number of queries answered since begin()
+ */
+uint32_t FormCaptiveDNS::getQueries() const {
+    return _queries;
+}
+
+/**
+ * Turn a query into its response in place
+ */
+size_t FormCaptiveDNS::buildResponse(uint8_t* packet, size_t length, size_t capacity, IPAddress ip) {
+    if (length < DNS_HEADER_SIZE || (packet[2] & DNS_FLAG_QR)) return 0;
+
+    uint8_t opcode = (packet[2] >> 3) & 0x0F;
+    uint16_t questions = (packet[4] << 8) | packet[5];
+
+    // Header-only reply for anything but a standard single-question query
+    packet[2] = DNS_FLAG_QR | DNS_FLAG_AA | (packet[2] & (0x78 | DNS_FLAG_RD));
+    memset(packet + 6, 0, DNS_HEADER_SIZE - 6);    // no answer, authority or additional records
+    if (opcode != 0 || questions != 1) {
+        packet[3] = DNS_RCODE_NOTIMP;
+        packet[4] = packet[5] = 0;
+        return DNS_HEADER_SIZE;
+    }
+    packet[3] = 0;
+
+    // Walk the question name; compression pointers are not valid here
+    size_t pos = DNS_HEADER_SIZE;
+    while (pos < length && packet[pos] != 0) {
+        if (packet[pos] & 0xC0) return 0;
+        pos += packet[pos] + 1;
+    }
+    if (pos + 5 > length) return 0;
+    uint16_t type = (packet[pos + 1] << 8) | packet[pos + 2];
+    uint16_t cls = (packet[pos + 3] << 8) | packet[pos + 4];
+    size_t end = pos + 5;    // any EDNS record after the question is dropped
+
+    if ((type != DNS_TYPE_A && type != DNS_TYPE_ANY) || cls != DNS_CLASS_IN) return end;
+    if (end + DNS_ANSWER_SIZE > capacity) return end;
+
+    uint8_t* answer = packet + end;
+    answer[0] = 0xC0;                        // name: pointer to the question
+    answer[1] = DNS_HEADER_SIZE;
+    answer[2] = 0;
+    answer[3] = DNS_TYPE_A;
+    answer[4] = 0;
+    answer[5] = DNS_CLASS_IN;
+    answer[6] = (FORMCAPTIVEDNS_TTL >> 24) & 0xFF;
+    answer[7] = (FORMCAPTIVEDNS_TTL >> 16) & 0xFF;
+    answer[8] = (FORMCAPTIVEDNS_TTL >> 8) & 0xFF;
+    answer[9] = FORMCAPTIVEDNS_TTL & 0xFF;
+    answer[10] = 0;
+    answer[11] = 4;                          // IPv4 address length
+    for (int i = 0; i < 4; i++) answer[12 + i] = ip[i];
+    packet[7] = 1;                           // one answer
+    return end + DNS_ANSWER_SIZE;
+}
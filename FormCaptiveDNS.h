@@ -0,0 +1,87 @@
+/**
+ * FormCaptiveDNS.h - Minimal captive-portal DNS responder
+ *
+ * Answers every A query with the device address, so a phone or laptop
+ * that joins the device's access point is sent straight to the form.
+ * Non-blocking: handleRequests() only serves packets already received.
+ *
+ * Author: FormBuilder Library
+ * License: MIT
+ */
+
+#ifndef FORMCAPTIVEDNS_H
+#define FORMCAPTIVEDNS_H
+
+#include <Arduino.h>
+#include <WiFiUdp.h>
+
+// Largest query accepted; classic DNS over UDP is limited to 512 bytes
+#ifndef FORMCAPTIVEDNS_PACKET_SIZE
+#define FORMCAPTIVEDNS_PACKET_SIZE 512
+#endif
+
+// Most queries answered per handleRequests() call
+#ifndef FORMCAPTIVEDNS_BURST
+#define FORMCAPTIVEDNS_BURST 4
+#endif
+
+// Seconds clients may cache an answer
+#ifndef FORMCAPTIVEDNS_TTL
+#define FORMCAPTIVEDNS_TTL 60
+#endif
+
+/**
+ * FormCaptiveDNS Class
+ */
+class FormCaptiveDNS {
+public:
+    /**
+     * Constructor
+     */
+    FormCaptiveDNS();
+
+    /**
+     * Start answering queries
+     * @param ip Address returned for every name, usually WiFi.softAPIP()
+     * @param port UDP port to listen on (default 53)
+     * @return false if the port could not be opened
+     */
+    bool begin(IPAddress ip, uint16_t port = 53);
+
+    /**
+     * Answer queries that have already arrived
+     * Call this in your main loop().
+     */
+    void handleRequests();
+
+    /**
+     * Stop answering queries and close the port
+     */
+    void stop();
+
+    /**
+     * Number of queries answered since begin()
+     */
+    uint32_t getQueries() const;
+
+    /**
+     * Turn a query into its response in place
+     * A and ANY queries get one answer with ip; other types get an empty
+     * answer so clients fall back quickly. Unsupported queries get NOTIMP.
+     * @param packet Query on input, response on output
+     * @param length Query length
+     * @param capacity Size of the packet buffer
+     * @param ip Address to answer with
+     * @return Response length, or 0 if the packet should be dropped
+     */
+    static size_t buildResponse(uint8_t* packet, size_t length, size_t capacity, IPAddress ip);
+
+private:
+    WiFiUDP _udp;
+    IPAddress _ip;
+    bool _running;
+    uint32_t _queries;
+    uint8_t _packet[FORMCAPTIVEDNS_PACKET_SIZE];
+};
+
+#endif // FORMCAPTIVEDNS_H
@@ -0,0 +1,324 @@
+/**
+ * FormDeflate.cpp - Low-memory streaming gzip encoder
+ *
+ * Implementation of the FormDeflate class (RFC 1951 fixed-Huffman blocks
+ * in an RFC 1952 gzip wrapper).
+ */
+
+#include "FormDeflate.h"
+
+static_assert((FORMDEFLATE_WINDOW & (FORMDEFLATE_WINDOW - 1)) == 0 &&
+              FORMDEFLATE_WINDOW >= 512 && FORMDEFLATE_WINDOW <= 8192,
+              "FORMDEFLATE_WINDOW must be a power of two from 512 to 8192");
+
+/**
+ * Print into a fixed buffer, counting bytes that do not fit
+ * With no buffer it only counts, for sizing a second pass.
+ */
+class FormBufferPrint : public Print {
+public:
+    FormBufferPrint(uint8_t* buffer, size_t size) : _buffer(buffer), _size(size), _length(0) {}
+    size_t write(uint8_t b) override {
+        if (_buffer && _length < _size) _buffer[_length] = b;
+        _length++;
+        return 1;
+    }
+    size_t length() const { return _length; }
+
+private:
+    uint8_t* _buffer;
+    size_t _size;
+    size_t _length;
+};
+
+// Length symbols 257..285: base length and extra bits
+static const uint16_t LENGTH_BASE[29] PROGMEM = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static const uint8_t LENGTH_EXTRA[29] PROGMEM = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+
+// Distance codes 0..29: base distance and extra bits
+static const uint16_t DIST_BASE[30] PROGMEM = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+};
+static const uint8_t DIST_EXTRA[30] PROGMEM = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+
+// CRC-32 (IEEE) by nibble - 64 bytes of table instead of 1 KB
+static const uint32_t CRC_NIBBLE[16] PROGMEM = {
+    0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac, 0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
+    0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c, 0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c
+};
+
+/**
+ * Constructor
+ */
+FormDeflate::FormDeflate() {
+    _out = nullptr;
+    _fill = 0;
+    _pos = 0;
+    _bits = 0;
+    _bitCount = 0;
+    _outLength = 0;
+    _crc = 0;
+    _inputBytes = 0;
+    _outputBytes = 0;
+}
+
+/**
+ * Start a gzip stream
+ */
+void FormDeflate::begin(Print& out) {
+    _out = &out;
+    _fill = 0;
+    _pos = 0;
+    _bits = 0;
+    _bitCount = 0;
+    _outLength = 0;
+    _crc = 0xffffffff;
+    _inputBytes = 0;
+    _outputBytes = 0;
+    for (int i = 0; i < HASH_SIZE; i++) _head[i] = -1;
+
+    // gzip member header: deflate, no name, no mtime, unknown OS
+    static const uint8_t header[10] = { 0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 0xff };
+    for (uint8_t b : header) putByte(b);
+
+    // One fixed-Huffman block carries the whole stream
+    putBits(0, 1);    // BFINAL = 0
+    putBits(1, 2);    // BTYPE = 01
+}
+
+/**
+ * Compress more input
+ */
+void FormDeflate::write(const uint8_t* data, size_t length) {
+    _inputBytes += length;
+    for (size_t i = 0; i < length; i++) {
+        uint8_t b = data[i];
+        _crc = (_crc >> 4) ^ CRC_NIBBLE[(_crc ^ b) & 0x0f];
+        _crc = (_crc >> 4) ^ CRC_NIBBLE[(_crc ^ (b >> 4)) & 0x0f];
+    }
+
+    while (length > 0) {
+        int room = 2 * WINDOW - _fill;
+        int chunk = length < (size_t)room ? (int)length : room;
+        memcpy(_buffer + _fill, data, chunk);
+        _fill += chunk;
+        data += chunk;
+        length -= chunk;
+        if (_fill == 2 * WINDOW) {
+            compress(false);
+            slide();
+        }
+    }
+}
+
+/**
+ * Finish the stream: last block, CRC and length trailer
+ */
+size_t FormDeflate::end() {
+    compress(true);
+    putLiteral(256);    // end of the open block
+
+    // Empty final block, then pad to a byte boundary
+    putBits(1, 1);
+    putBits(1, 2);
+    putLiteral(256);
+    if (_bitCount > 0) putBits(0, 8 - _bitCount);
+
+    uint32_t crc = ~_crc;
+    for (int i = 0; i < 4; i++) putByte((crc >> (8 * i)) & 0xff);
+    for (int i = 0; i < 4; i++) putByte((_inputBytes >> (8 * i)) & 0xff);
+    flushOutput();
+    return _outputBytes;
+}
+
+/**
+ * Uncompressed bytes written since begin()
+ */
+uint32_t FormDeflate::getInputBytes() const {
+    return _inputBytes;
+}
+
+/**
+ * Compress a whole buffer into a new one of exactly the compressed size
+ */
+uint8_t* FormDeflate::compressCopy(const uint8_t* data, size_t size, size_t& length) {
+    length = 0;
+    FormBufferPrint counter(nullptr, 0);
+    begin(counter);
+    write(data, size);
+    end();
+    if (counter.length() >= size) return nullptr;
+
+    uint8_t* copy = (uint8_t*)malloc(counter.length());
+    if (!copy) return nullptr;
+    FormBufferPrint buffer(copy, counter.length());
+    begin(buffer);
+    write(data, size);
+    end();
+    length = buffer.length();
+    return copy;
+}
+
+/**
+ * Encode buffered input; without flush, keep MAX_MATCH bytes of lookahead
+ */
+void FormDeflate::compress(bool flush) {
+    int limit = flush ? _fill : _fill - MAX_MATCH;
+
+    while (_pos < limit) {
+        int available = _fill - _pos;
+        int distance = 0;
+        int length = available >= MIN_MATCH ? findMatch(_pos, available, distance) : 0;
+
+        if (length >= MIN_MATCH) {
+            putMatch(length, distance);
+            for (int i = 0; i < length; i++, _pos++) {
+                if (_fill - _pos >= MIN_MATCH) insert(_pos);
+            }
+        } else {
+            putLiteral(_buffer[_pos]);
+            if (available >= MIN_MATCH) insert(_pos);
+            _pos++;
+        }
+    }
+}
+
+/**
+ * Drop the oldest window of history to make room for more input
+ */
+void FormDeflate::slide() {
+    memmove(_buffer, _buffer + WINDOW, _fill - WINDOW);
+    _fill -= WINDOW;
+    _pos -= WINDOW;
+    for (int i = 0; i < HASH_SIZE; i++) {
+        _head[i] = _head[i] >= WINDOW ? _head[i] - WINDOW : -1;
+    }
+    for (int i = 0; i < WINDOW; i++) {
+        _prev[i] = _prev[i] >= WINDOW ? _prev[i] - WINDOW : -1;
+    }
+}
+
+/**
+ * Hash of the three bytes at pos
+ */
+int FormDeflate::hash(int pos) const {
+    return ((_buffer[pos] << 10) ^ (_buffer[pos + 1] << 5) ^ _buffer[pos + 2]) & (HASH_SIZE - 1);
+}
+
+/**
+ * Record pos as the most recent occurrence of its three bytes
+ */
+void FormDeflate::insert(int pos) {
+    int h = hash(pos);
+    _prev[pos & (WINDOW - 1)] = _head[h];
+    _head[h] = pos;
+}
+
+/**
+ * Longest earlier match for the bytes at pos, within the window
+ * @return Match length, or 0 if none reaches MIN_MATCH
+ */
+int FormDeflate::findMatch(int pos, int available, int& distance) const {
+    int maxLength = available < MAX_MATCH ? available : MAX_MATCH;
+    int best = 0;
+    int candidate = _head[hash(pos)];
+
+    for (int chain = 0; chain < FORMDEFLATE_CHAIN && candidate >= 0; chain++) {
+        if (pos - candidate >= WINDOW) break;
+        if (_buffer[candidate + best] == _buffer[pos + best]) {
+            int length = 0;
+            while (length < maxLength && _buffer[candidate + length] == _buffer[pos + length]) length++;
+            if (length > best) {
+                best = length;
+                distance = pos - candidate;
+                if (best == maxLength) break;
+            }
+        }
+        int next = _prev[candidate & (WINDOW - 1)];
+        if (next >= candidate) break;    // slot reused by a newer position
+        candidate = next;
+    }
+    return best >= MIN_MATCH ? best : 0;
+}
+
+/**
+ * Append bits, least significant first
+ */
+void FormDeflate::putBits(uint32_t value, uint8_t count) {
+    _bits |= value << _bitCount;
+    _bitCount += count;
+    while (_bitCount >= 8) {
+        putByte(_bits & 0xff);
+        _bits >>= 8;
+        _bitCount -= 8;
+    }
+}
+
+/**
+ * Append a Huffman code, which deflate stores most significant bit first
+ */
+void FormDeflate::putCode(uint16_t code, uint8_t length) {
+    uint16_t reversed = 0;
+    for (uint8_t i = 0; i < length; i++) {
+        reversed = (reversed << 1) | (code & 1);
+        code >>= 1;
+    }
+    putBits(reversed, length);
+}
+
+/**
+ * Append a literal/length symbol using the fixed code
+ */
+void FormDeflate::putLiteral(uint16_t symbol) {
+    if (symbol < 144) {
+        putCode(0x30 + symbol, 8);
+    } else if (symbol < 256) {
+        putCode(0x190 + symbol - 144, 9);
+    } else if (symbol < 280) {
+        putCode(symbol - 256, 7);
+    } else {
+        putCode(0xc0 + symbol - 280, 8);
+    }
+}
+
+/**
+ * Append a length/distance pair
+ */
+void FormDeflate::putMatch(int length, int distance) {
+    int code = 28;
+    while (LENGTH_BASE[code] > length) code--;
+    putLiteral(257 + code);
+    putBits(length - LENGTH_BASE[code], LENGTH_EXTRA[code]);
+
+    code = 29;
+    while (DIST_BASE[code] > distance) code--;
+    putCode(code, 5);
+    putBits(distance - DIST_BASE[code], DIST_EXTRA[code]);
+}
+
+/**
+ * Queue one compressed byte
+ */
+void FormDeflate::putByte(uint8_t value) {
+    _outBuffer[_outLength++] = value;
+    if (_outLength == sizeof(_outBuffer)) flushOutput();
+}
+
+/**
+ * Write queued bytes to the output
+ */
+void FormDeflate::flushOutput() {
+    if (_outLength == 0 || !_out) return;
+    _outputBytes += _out->write(_outBuffer, _outLength);
+    _outLength = 0;
+}
@@ -0,0 +1,113 @@
+/**
+ * FormDeflate.h - Low-memory streaming gzip encoder
+ *
+ * Compresses a byte stream into gzip format as it is written, for the
+ * dynamic form markup. Uses LZ77 over a small sliding window with short
+ * hash chains and the fixed Huffman code, so no code tables are built
+ * and memory use is fixed and small.
+ *
+ * Author: FormBuilder Library
+ * License: MIT
+ */
+
+#ifndef FORMDEFLATE_H
+#define FORMDEFLATE_H
+
+#include <Arduino.h>
+
+// Sliding window in bytes; a power of two from 512 to 8192.
+// RAM used is about 4 x window + 2 x hash size + output buffer.
+#ifndef FORMDEFLATE_WINDOW
+#define FORMDEFLATE_WINDOW 1024
+#endif
+
+// log2 of the number of hash heads
+#ifndef FORMDEFLATE_HASH_BITS
+#define FORMDEFLATE_HASH_BITS 9
+#endif
+
+// Match candidates tried per position; higher compresses better, slower
+#ifndef FORMDEFLATE_CHAIN
+#define FORMDEFLATE_CHAIN 8
+#endif
+
+// Compressed bytes collected before each write to the output
+#ifndef FORMDEFLATE_OUT_BUFFER
+#define FORMDEFLATE_OUT_BUFFER 256
+#endif
+
+/**
+ * FormDeflate Class
+ */
+class FormDeflate {
+public:
+    /**
+     * Constructor
+     */
+    FormDeflate();
+
+    /**
+     * Start a gzip stream
+     * @param out Destination for the compressed bytes
+     */
+    void begin(Print& out);
+
+    /**
+     * Compress more input
+     */
+    void write(const uint8_t* data, size_t length);
+
+    /**
+     * Finish the stream: last block, CRC and length trailer
+     * @return Compressed bytes written since begin()
+     */
+    size_t end();
+
+    /**
+     * Uncompressed bytes written since begin()
+     */
+    uint32_t getInputBytes() const;
+
+    /**
+     * Compress a whole buffer into a new one of exactly the compressed size
+     * Sizes the output with a counting pass, then fills it.
+     * @param length Receives the compressed length
+     * @return A malloc() buffer for the caller to free(), or nullptr if the
+     *         result would not be smaller or memory ran out
+     */
+    uint8_t* compressCopy(const uint8_t* data, size_t size, size_t& length);
+
+private:
+    static const int WINDOW = FORMDEFLATE_WINDOW;
+    static const int HASH_SIZE = 1 << FORMDEFLATE_HASH_BITS;
+    static const int MIN_MATCH = 3;
+    static const int MAX_MATCH = 258;
+
+    Print* _out;
+    uint8_t _buffer[2 * WINDOW];       // history and lookahead
+    int16_t _head[HASH_SIZE];          // most recent position per hash
+    int16_t _prev[WINDOW];             // previous position with the same hash
+    int _fill;                         // bytes in _buffer
+    int _pos;                          // next byte to encode
+    uint32_t _bits;
+    uint8_t _bitCount;
+    uint8_t _outBuffer[FORMDEFLATE_OUT_BUFFER];
+    uint16_t _outLength;
+    uint32_t _crc;
+    uint32_t _inputBytes;
+    size_t _outputBytes;
+
+    void compress(bool flush);
+    void slide();
+    int hash(int pos) const;
+    void insert(int pos);
+    int findMatch(int pos, int available, int& distance) const;
+    void putBits(uint32_t value, uint8_t count);
+    void putCode(uint16_t code, uint8_t length);
+    void putLiteral(uint16_t symbol);
+    void putMatch(int length, int distance);
+    void putByte(uint8_t value);
+    void flushOutput();
+};
+
+#endif // FORMDEFLATE_H
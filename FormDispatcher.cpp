@@ -0,0 +1,352 @@
+/**
+ * FormDispatcher.cpp - Shared server for several FormBuilder instances
+ *
+ * Implementation of the FormDispatcher class.
+ */
+
+#include "FormDispatcher.h"
+
+/**
+ * Constructor
+ */
+FormDispatcher::FormDispatcher() {
+    _server = nullptr;
+    _builderCount = 0;
+    _assetHits = 0;
+    for (uint8_t i = 0; i < FORMDISPATCHER_MAX_SLOTS; i++) {
+        _slots[i].busy = false;
+        _slots[i].kept = false;
+        resetRequest(_slots[i]);
+    }
+    _assets[0].path = FB_ASSET_CSS_PATH;
+    _assets[0].contentType = "text/css";
+    _assets[0].body = FB_STYLE;
+    _assets[1].path = FB_ASSET_JS_PATH;
+    _assets[1].contentType = "application/javascript";
+    _assets[1].body = FB_SCRIPT;
+    for (Asset& asset : _assets) {
+        asset.length = 0;
+        asset.etag[0] = '\0';
+#ifdef FORMBUILDER_DEFLATE
+        asset.gzip = nullptr;
+        asset.gzipLength = 0;
+#endif
+    }
+}
+
+/**
+ * Initialize the dispatcher with a WiFi server
+ */
+void FormDispatcher::begin(WiFiServer* server) {
+    _server = server;
+
+    // Lengths, validators and compressed copies never change, so work them out once
+#ifdef FORMBUILDER_DEFLATE
+    FormDeflate* deflate = new FormDeflate();
+#endif
+    for (Asset& asset : _assets) {
+        asset.length = strlen(asset.body);
+        snprintf(asset.etag, sizeof(asset.etag), "\"%08x\"", (unsigned)fbHash(asset.body, asset.length));
+#ifdef FORMBUILDER_DEFLATE
+        free(asset.gzip);
+        asset.gzip = deflate->compressCopy((const uint8_t*)asset.body, asset.length, asset.gzipLength);
+#endif
+    }
+#ifdef FORMBUILDER_DEFLATE
+    delete deflate;
+#endif
+}
+
+/**
+ * Register a builder to route requests to
+ */
+bool FormDispatcher::addBuilder(FormBuilder& builder) {
+    if (_builderCount >= FORMDISPATCHER_MAX_BUILDERS) return false;
+    builder._sharedAssets = true;
+    builder._slotCount = FORMDISPATCHER_MAX_SLOTS;
+    _builders[_builderCount++] = &builder;
+    return true;
+}
+
+/**
+ * Accept new connections and serve any slot whose request has arrived
+ */
+void FormDispatcher::handleClient() {
+    if (!_server || _builderCount == 0) return;
+
+    acceptSlots();
+
+    for (uint8_t i = 0; i < FORMDISPATCHER_MAX_SLOTS; i++) {
+        Slot& slot = _slots[i];
+        if (!slot.busy) continue;
+        bool started = slot.line.length() > 0 || slot.requestLine.length() > 0;
+        if (slot.client.available()) {
+            if (slot.kept) {
+                slot.kept = false;
+                slot.acceptMicros = micros();
+            }
+            readSlot(i);
+        } else if (!slot.client.connected()) {
+            releaseSlot(i);
+        } else if (started && millis() - slot.lastData > FORMBUILDER_READ_TIMEOUT) {
+            serveSlot(i, false);
+        } else if (!started && millis() - slot.acceptMillis > FORMDISPATCHER_IDLE_TIMEOUT) {
+            releaseSlot(i);
+        }
+    }
+}
+
+/**
+ * Number of connection slots currently in use
+ */
+uint8_t FormDispatcher::getActiveSlots() const {
+    uint8_t active = 0;
+    for (uint8_t i = 0; i < FORMDISPATCHER_MAX_SLOTS; i++) {
+        if (_slots[i].busy) active++;
+    }
+    return active;
+}
+
+/**
+ * Number of requests answered from the asset cache
+ */
+uint32_t FormDispatcher::getAssetHits() const {
+    return _assetHits;
+}
+
+/**
+ * Move pending connections into free slots
+ * Only when none is free does a kept-alive connection with nothing to
+ * read give up its slot to a new one; connections beyond that stay in
+ * the server's backlog.
+ */
+void FormDispatcher::acceptSlots() {
+    while (_server->hasClient()) {
+        int free = -1;
+        for (uint8_t i = 0; i < FORMDISPATCHER_MAX_SLOTS && free < 0; i++) {
+            if (!_slots[i].busy) free = i;
+        }
+        for (uint8_t i = 0; i < FORMDISPATCHER_MAX_SLOTS && free < 0; i++) {
+            if (_slots[i].kept && !_slots[i].client.available()) {
+                releaseSlot(i);
+                free = i;
+            }
+        }
+        if (free < 0) return;
+
+        Slot& slot = _slots[free];
+        slot.client = _server->accept();
+        if (!slot.client) return;
+        slot.acceptMillis = millis();
+        slot.acceptMicros = micros();
+        slot.busy = true;
+        slot.kept = false;
+        resetRequest(slot);
+    }
+}
+
+/**
+ * Take whatever request bytes have arrived in a slot, without waiting for
+ * more, and serve the request once its header block is complete. Bytes
+ * after the blank line (a body, the next request) stay unread.
+ */
+void FormDispatcher::readSlot(uint8_t index) {
+    Slot& slot = _slots[index];
+    slot.lastData = millis();
+
+    while (slot.client.available()) {
+        int c = slot.client.read();
+        if (c < 0) break;
+        if (c != '\n') {
+            if (slot.line.length() >= FORMBUILDER_MAX_LINE) {
+                serveSlot(index, false);
+                return;
+            }
+            slot.line += (char)c;
+            continue;
+        }
+
+        slot.line.trim();
+        if (slot.requestLine.length() > 0 && slot.line.length() == 0) {
+            serveSlot(index, true);
+            return;
+        }
+        if (!takeLine(slot)) {
+            serveSlot(index, false);
+            return;
+        }
+        slot.line = "";
+    }
+}
+
+/**
+ * Act on one complete line of a slot's request: the request line, which
+ * decides who gets the headers, or one of the headers after it
+ * @return false if the request is malformed or has too many headers
+ */
+bool FormDispatcher::takeLine(Slot& slot) {
+    if (slot.requestLine.length() == 0) {
+        if (slot.line.length() == 0) return false;
+        slot.requestLine = slot.line;
+        slot.keepAlive = slot.requestLine.endsWith(" HTTP/1.1");
+        slot.asset = findAsset(slot.requestLine);
+        slot.builder = slot.asset ? nullptr : route(slot.requestLine);
+        return true;
+    }
+
+    if (++slot.headerCount > FORMBUILDER_MAX_HEADERS) return false;
+    if (strncasecmp(slot.line.c_str(), "Connection:", 11) == 0) {
+        String value = slot.line.substring(11);
+        value.toLowerCase();
+        if (value.indexOf("close") != -1) slot.keepAlive = false;
+    }
+    FormBuilder::noteHeader(slot.headers, slot.line);
+    return true;
+}
+
+/**
+ * Answer the request read into a slot: hand it to an asset or a builder,
+ * or reject it with 400 when `ok` is false
+ */
+void FormDispatcher::serveSlot(uint8_t index, bool ok) {
+    Slot& slot = _slots[index];
+    bool keepAlive = ok && slot.keepAlive;
+
+    if (!ok) {
+        slot.client.print("HTTP/1.1 400 Bad Request\r\n"
+                          "Connection: close\r\n"
+                          "\r\n");
+    } else if (slot.asset) {
+        sendAsset(slot.client, *slot.asset, slot.headers, keepAlive);
+    } else {
+        FormBuilder* builder = slot.builder;
+        builder->_headers = slot.headers;
+        builder->_slotsInUse = getActiveSlots();
+        keepAlive = builder->serveDispatched(slot.client, slot.requestLine, index, slot.acceptMicros, keepAlive);
+    }
+    resetRequest(slot);
+
+    // Keep the connection for the next request; the idle timeout restarts
+    if (keepAlive && slot.client.connected()) {
+        slot.kept = true;
+        slot.acceptMillis = millis();
+    } else {
+        releaseSlot(index);
+    }
+}
+
+/**
+ * Close a slot's connection and free the slot
+ */
+void FormDispatcher::releaseSlot(uint8_t index) {
+    _slots[index].client.stop();
+    _slots[index].busy = false;
+    _slots[index].kept = false;
+    resetRequest(_slots[index]);
+}
+
+/**
+ * Forget the request read into a slot, ready for the next one
+ */
+void FormDispatcher::resetRequest(Slot& slot) {
+    slot.line = "";
+    slot.requestLine = "";
+    slot.asset = nullptr;
+    slot.builder = nullptr;
+    FormBuilder::clearHeaders(slot.headers);
+    slot.headerCount = 0;
+    slot.keepAlive = false;
+}
+
+/**
+ * Pick the builder that serves the request: the owner of a custom CSS URL
+ * or serveStatic() prefix first, then the longest form path match. /fb/ endpoints and paths no builder
+ * claims go to the first builder.
+ */
+FormBuilder* FormDispatcher::route(const String& requestLine) const {
+    FormBuilder* best = _builders[0];
+    for (uint8_t i = 0; i < _builderCount; i++) {
+        if (_builders[i]->isCustomCSSRequest(requestLine)) return _builders[i];
+    }
+    if (!requestLine.startsWith("GET /") || requestLine.startsWith("GET /fb/")) return best;
+
+    for (uint8_t i = 0; i < _builderCount; i++) {
+        if (_builders[i]->matchStatic(requestLine) >= 0) return _builders[i];
+    }
+
+    int bestRest = -1;
+    for (uint8_t i = 0; i < _builderCount; i++) {
+        int rest = 0;
+        if (_builders[i]->matchForm(requestLine, rest) == FormBuilder::FORM_NONE) continue;
+        if (rest > bestRest) {
+            best = _builders[i];
+            bestRest = rest;
+        }
+    }
+    return best;
+}
+
+/**
+ * Find the cached asset a request line asks for, if any
+ */
+const FormDispatcher::Asset* FormDispatcher::findAsset(const String& requestLine) const {
+    if (!requestLine.startsWith("GET /fb/")) return nullptr;
+    const char* path = requestLine.c_str() + 4;    // after "GET "
+
+    for (const Asset& asset : _assets) {
+        size_t len = strlen(asset.path);
+        if (strncmp(path, asset.path, len) != 0) continue;
+        char next = path[len];
+        if (next == ' ' || next == '?' || next == '\0') return &asset;
+    }
+    return nullptr;
+}
+
+/**
+ * Send an asset, or 304 Not Modified when the browser's copy is current
+ * Clients that accept gzip get the compressed copy, with its own ETag.
+ */
+void FormDispatcher::sendAsset(WiFiClient& client, const Asset& asset, const FormBuilder::RequestHeaders& headers,
+                               bool keepAlive) {
+    const char* connection = keepAlive ? "" : "Connection: close\r\n";
+    const uint8_t* body = (const uint8_t*)asset.body;
+    size_t length = asset.length;
+    const char* vary = "";
+    const char* encoding = "";
+    char etag[14];
+    strcpy(etag, asset.etag);
+#ifdef FORMBUILDER_DEFLATE
+    if (asset.gzip) {
+        vary = "Vary: Accept-Encoding\r\n";
+        if (headers.acceptEncodings & FB_ENCODING_GZIP) {
+            body = asset.gzip;
+            length = asset.gzipLength;
+            encoding = "Content-Encoding: gzip\r\n";
+            snprintf(etag, sizeof(etag), "%.9s-gz\"", asset.etag);
+        }
+    }
+#endif
+    _assetHits++;
+    if (headers.ifNoneMatch == etag) {
+        client.printf("HTTP/1.1 304 Not Modified\r\n"
+                      "ETag: %s\r\n"
+                      "Cache-Control: public, max-age=%u\r\n"
+                      "%s"
+                      "\r\n",
+                      etag, (unsigned)FORMDISPATCHER_ASSET_MAX_AGE, connection);
+    } else {
+        client.printf("HTTP/1.1 200 OK\r\n"
+                      "Content-Type: %s\r\n"
+                      "Content-Length: %u\r\n"
+                      "%s"
+                      "%s"
+                      "ETag: %s\r\n"
+                      "Cache-Control: public, max-age=%u\r\n"
+                      "%s"
+                      "\r\n",
+                      asset.contentType, (unsigned)length, encoding, vary, etag,
+                      (unsigned)FORMDISPATCHER_ASSET_MAX_AGE, connection);
+        client.write(body, length);
+    }
+    client.flush();
+}
@@ -0,0 +1,137 @@
+/**
+ * FormDispatcher.h - Shared server for several FormBuilder instances
+ *
+ * Owns the listening WiFiServer and a small set of connection slots,
+ * routes each request to the registered FormBuilder whose form path
+ * matches best, and serves one cached copy of the built-in CSS and JS,
+ * gzipped for clients that accept it when FORMBUILDER_DEFLATE is set.
+ * Responses with a known length keep the connection open for the next
+ * request when the client allows it.
+ *
+ * Author: FormBuilder Library
+ * License: MIT
+ */
+
+#ifndef FORMDISPATCHER_H
+#define FORMDISPATCHER_H
+
+#include "FormBuilder.h"
+
+// Maximum number of FormBuilder instances on one dispatcher
+#ifndef FORMDISPATCHER_MAX_BUILDERS
+#define FORMDISPATCHER_MAX_BUILDERS 4
+#endif
+
+// Connections held open while waiting for their request
+#ifndef FORMDISPATCHER_MAX_SLOTS
+#define FORMDISPATCHER_MAX_SLOTS 4
+#endif
+
+// Milliseconds a slot may wait for its first request byte, or between
+// requests on a kept-alive connection. Once a request has started, each
+// further byte must arrive within FORMBUILDER_READ_TIMEOUT.
+#ifndef FORMDISPATCHER_IDLE_TIMEOUT
+#define FORMDISPATCHER_IDLE_TIMEOUT 2000
+#endif
+
+// Seconds browsers may reuse the shared CSS/JS without revalidating
+#ifndef FORMDISPATCHER_ASSET_MAX_AGE
+#define FORMDISPATCHER_ASSET_MAX_AGE 86400
+#endif
+
+/**
+ * FormDispatcher Class
+ *
+ * Use instead of FormBuilder::begin() when more than one FormBuilder
+ * shares a server. Call handleClient() from loop(); the builders' own
+ * handleClient() is then not needed.
+ */
+class FormDispatcher {
+public:
+    /**
+     * Constructor
+     */
+    FormDispatcher();
+
+    /**
+     * Initialize the dispatcher with a WiFi server
+     * @param server Pointer to WiFiServer instance
+     */
+    void begin(WiFiServer* server);
+
+    /**
+     * Register a builder; its pages link the shared CSS/JS from then on
+     * The first builder also answers /fb/ endpoints and unmatched paths.
+     * @param builder FormBuilder to route requests to
+     * @return false if FORMDISPATCHER_MAX_BUILDERS are already registered
+     */
+    bool addBuilder(FormBuilder& builder);
+
+    /**
+     * Accept new connections and serve any slot whose request has arrived
+     * Call this in your main loop().
+     */
+    void handleClient();
+
+    /**
+     * Number of connection slots currently in use
+     */
+    uint8_t getActiveSlots() const;
+
+    /**
+     * Number of requests answered from the asset cache (200 or 304)
+     */
+    uint32_t getAssetHits() const;
+
+private:
+    // A cached static asset with its validator
+    struct Asset {
+        const char* path;
+        const char* contentType;
+        const char* body;
+        size_t length;
+        char etag[11];             // quoted 8-digit hex FNV-1a of the body
+#ifdef FORMBUILDER_DEFLATE
+        uint8_t* gzip;             // compressed once in begin(), nullptr if not smaller
+        size_t gzipLength;
+#endif
+    };
+
+    // A connection and the request read from it so far. Requests arrive
+    // a piece at a time across handleClient() calls, so a slow client
+    // never holds up the other slots.
+    struct Slot {
+        WiFiClient client;
+        unsigned long acceptMillis;
+        unsigned long acceptMicros;
+        unsigned long lastData;    // millis() of the last request byte
+        bool busy;
+        bool kept;                 // idle between kept-alive requests
+        String line;               // line being received
+        String requestLine;        // "" until the request line is complete
+        const Asset* asset;
+        FormBuilder* builder;
+        FormBuilder::RequestHeaders headers;
+        uint8_t headerCount;
+        bool keepAlive;
+    };
+
+    WiFiServer* _server;
+    FormBuilder* _builders[FORMDISPATCHER_MAX_BUILDERS];
+    uint8_t _builderCount;
+    Slot _slots[FORMDISPATCHER_MAX_SLOTS];
+    Asset _assets[2];
+    uint32_t _assetHits;
+
+    void acceptSlots();
+    void readSlot(uint8_t index);
+    bool takeLine(Slot& slot);
+    void serveSlot(uint8_t index, bool ok);
+    void releaseSlot(uint8_t index);
+    void resetRequest(Slot& slot);
+    FormBuilder* route(const String& requestLine) const;
+    const Asset* findAsset(const String& requestLine) const;
+    void sendAsset(WiFiClient& client, const Asset& asset, const FormBuilder::RequestHeaders& headers, bool keepAlive);
+};
+
+#endif // FORMDISPATCHER_H
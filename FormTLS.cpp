@@ -0,0 +1,295 @@
+/**
+ * FormTLS.cpp - HTTPS transport for FormBuilder
+ *
+ * Implementation of the FormTLS class.
+ */
+
+#include "FormTLS.h"
+#include <mbedtls/net_sockets.h>
+
+/**
+ * Constructor
+ */
+FormTLS::FormTLS() {
+    mbedtls_entropy_init(&_entropy);
+    mbedtls_ctr_drbg_init(&_drbg);
+    mbedtls_x509_crt_init(&_cert);
+    mbedtls_pk_init(&_key);
+    mbedtls_ssl_config_init(&_conf);
+    mbedtls_ssl_init(&_ssl);
+#if defined(MBEDTLS_SSL_CACHE_C)
+    mbedtls_ssl_cache_init(&_cache);
+#endif
+#if defined(MBEDTLS_SSL_TICKET_C)
+    mbedtls_ssl_ticket_init(&_ticket);
+#endif
+    _ready = false;
+    _active = false;
+    _peerClosed = false;
+    _closeSent = false;
+    _resumed = false;
+    _peekByte = -1;
+}
+
+/**
+ * Destructor
+ */
+FormTLS::~FormTLS() {
+    mbedtls_ssl_free(&_ssl);
+    mbedtls_ssl_config_free(&_conf);
+#if defined(MBEDTLS_SSL_CACHE_C)
+    mbedtls_ssl_cache_free(&_cache);
+#endif
+#if defined(MBEDTLS_SSL_TICKET_C)
+    mbedtls_ssl_ticket_free(&_ticket);
+#endif
+    mbedtls_pk_free(&_key);
+    mbedtls_x509_crt_free(&_cert);
+    mbedtls_ctr_drbg_free(&_drbg);
+    mbedtls_entropy_free(&_entropy);
+}
+
+/**
+ * Load the server certificate and key and set up the TLS context
+ */
+bool FormTLS::begin(const char* certPem, const char* keyPem) {
+    static const char personalization[] = "FormTLS";
+    if (mbedtls_ctr_drbg_seed(&_drbg, mbedtls_entropy_func, &_entropy,
+                              (const unsigned char*)personalization, sizeof(personalization) - 1) != 0) {
+        return false;
+    }
+
+    // PEM lengths include the terminating NUL
+    if (mbedtls_x509_crt_parse(&_cert, (const unsigned char*)certPem, strlen(certPem) + 1) != 0) return false;
+#if MBEDTLS_VERSION_MAJOR >= 3
+    if (mbedtls_pk_parse_key(&_key, (const unsigned char*)keyPem, strlen(keyPem) + 1, nullptr, 0,
+                             mbedtls_ctr_drbg_random, &_drbg) != 0) {
+        return false;
+    }
+#else
+    if (mbedtls_pk_parse_key(&_key, (const unsigned char*)keyPem, strlen(keyPem) + 1, nullptr, 0) != 0) return false;
+#endif
+
+    if (mbedtls_ssl_config_defaults(&_conf, MBEDTLS_SSL_IS_SERVER, MBEDTLS_SSL_TRANSPORT_STREAM,
+                                    MBEDTLS_SSL_PRESET_DEFAULT) != 0) {
+        return false;
+    }
+    mbedtls_ssl_conf_rng(&_conf, mbedtls_ctr_drbg_random, &_drbg);
+    if (mbedtls_ssl_conf_own_cert(&_conf, &_cert, &_key) != 0) return false;
+
+    // Resumption skips the certificate and key exchange: session IDs are
+    // looked up in the cache, tickets carry the session encrypted to us
+#if defined(MBEDTLS_SSL_CACHE_C)
+    mbedtls_ssl_cache_set_max_entries(&_cache, FORMTLS_CACHE_SIZE);
+#if defined(MBEDTLS_HAVE_TIME)
+    mbedtls_ssl_cache_set_timeout(&_cache, FORMTLS_SESSION_LIFETIME);
+#endif
+    mbedtls_ssl_conf_session_cache(&_conf, this, cacheGet, cacheSet);
+#endif
+#if defined(MBEDTLS_SSL_TICKET_C)
+    if (mbedtls_ssl_ticket_setup(&_ticket, mbedtls_ctr_drbg_random, &_drbg,
+                                 MBEDTLS_CIPHER_AES_256_GCM, FORMTLS_SESSION_LIFETIME) == 0) {
+        mbedtls_ssl_conf_session_tickets_cb(&_conf, ticketWrite, ticketParse, this);
+    }
+#endif
+
+    if (mbedtls_ssl_setup(&_ssl, &_conf) != 0) return false;
+    mbedtls_ssl_set_bio(&_ssl, this, bioSend, bioRecv, nullptr);
+    _ready = true;
+    return true;
+}
+
+/**
+ * Run the server handshake on an accepted connection
+ */
+bool FormTLS::accept(WiFiClient& client) {
+    if (!_ready) return false;
+    WiFiClient::operator=(client);
+    mbedtls_ssl_session_reset(&_ssl);
+    _peerClosed = false;
+    _closeSent = false;
+    _resumed = false;
+    _peekByte = -1;
+
+    unsigned long start = millis();
+    int ret;
+    while ((ret = mbedtls_ssl_handshake(&_ssl)) != 0) {
+        if ((ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE) ||
+            millis() - start > FORMTLS_HANDSHAKE_TIMEOUT) {
+            WiFiClient::stop();
+            return false;
+        }
+        yield();
+    }
+    _active = true;
+    return true;
+}
+
+/**
+ * Whether the last handshake resumed an earlier session
+ */
+bool FormTLS::wasResumed() const {
+    return _resumed;
+}
+
+/**
+ * Tell the browser the response is complete (TLS close_notify)
+ */
+void FormTLS::closeNotify() {
+    if (!_active || _closeSent) return;
+    mbedtls_ssl_close_notify(&_ssl);
+    _closeSent = true;
+}
+
+size_t FormTLS::write(uint8_t b) {
+    return write(&b, 1);
+}
+
+/**
+ * Encrypt and send; each call becomes one or more TLS records
+ */
+size_t FormTLS::write(const uint8_t* buf, size_t size) {
+    if (!_active) return 0;
+    size_t sent = 0;
+    while (sent < size) {
+        int ret = mbedtls_ssl_write(&_ssl, buf + sent, size - sent);
+        if (ret > 0) {
+            sent += ret;
+        } else if (ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE) {
+            yield();
+        } else {
+            break;
+        }
+    }
+    return sent;
+}
+
+/**
+ * Decrypted bytes ready to read
+ * Processes a pending record, if one has arrived, without consuming it.
+ */
+int FormTLS::available() {
+    if (!_active) return 0;
+    int ready = _peekByte >= 0 ? 1 : 0;
+    if (mbedtls_ssl_get_bytes_avail(&_ssl) == 0 && WiFiClient::available() > 0) {
+        int ret = mbedtls_ssl_read(&_ssl, nullptr, 0);
+        if (ret == MBEDTLS_ERR_SSL_PEER_CLOSE_NOTIFY) _peerClosed = true;
+    }
+    return ready + (int)mbedtls_ssl_get_bytes_avail(&_ssl);
+}
+
+int FormTLS::read() {
+    uint8_t b;
+    return read(&b, 1) == 1 ? b : -1;
+}
+
+/**
+ * Read decrypted bytes
+ * @return Bytes read, or -1 if none are available yet
+ */
+int FormTLS::read(uint8_t* buf, size_t size) {
+    if (!_active || size == 0) return -1;
+    size_t n = 0;
+    if (_peekByte >= 0) {
+        buf[n++] = (uint8_t)_peekByte;
+        _peekByte = -1;
+        if (available() <= 0) return n;
+    }
+    int ret = mbedtls_ssl_read(&_ssl, buf + n, size - n);
+    if (ret > 0) return n + ret;
+    if (ret == 0 || ret == MBEDTLS_ERR_SSL_PEER_CLOSE_NOTIFY) _peerClosed = true;
+    return n > 0 ? (int)n : -1;
+}
+
+int FormTLS::peek() {
+    if (_peekByte < 0) {
+        uint8_t b;
+        if (read(&b, 1) == 1) _peekByte = b;
+    }
+    return _peekByte;
+}
+
+/**
+ * Records are sent as they are written, so there is nothing to flush
+ */
+void FormTLS::flush() {
+}
+
+/**
+ * Send close_notify and close the connection
+ * The TLS context is kept for the next connection.
+ */
+void FormTLS::stop() {
+    closeNotify();
+    _active = false;
+    WiFiClient::stop();
+}
+
+uint8_t FormTLS::connected() {
+    if (!_active || _peerClosed) return 0;
+    return WiFiClient::connected() || mbedtls_ssl_get_bytes_avail(&_ssl) > 0 || _peekByte >= 0;
+}
+
+/**
+ * mbedTLS send callback: write ciphertext to the socket
+ */
+int FormTLS::bioSend(void* ctx, const unsigned char* buf, size_t len) {
+    FormTLS* tls = static_cast<FormTLS*>(ctx);
+    size_t n = tls->WiFiClient::write(buf, len);
+    return n > 0 ? (int)n : MBEDTLS_ERR_NET_SEND_FAILED;
+}
+
+/**
+ * mbedTLS receive callback: read ciphertext without blocking
+ */
+int FormTLS::bioRecv(void* ctx, unsigned char* buf, size_t len) {
+    FormTLS* tls = static_cast<FormTLS*>(ctx);
+    int ready = tls->WiFiClient::available();
+    if (ready <= 0) {
+        return tls->WiFiClient::connected() ? MBEDTLS_ERR_SSL_WANT_READ : MBEDTLS_ERR_NET_CONN_RESET;
+    }
+    int n = tls->WiFiClient::read(buf, len < (size_t)ready ? len : (size_t)ready);
+    return n > 0 ? n : MBEDTLS_ERR_SSL_WANT_READ;
+}
+
+#if defined(MBEDTLS_SSL_CACHE_C)
+// Cache lookups that succeed are resumed handshakes
+#if MBEDTLS_VERSION_MAJOR >= 3
+int FormTLS::cacheGet(void* ctx, unsigned char const* id, size_t idLength, mbedtls_ssl_session* session) {
+    FormTLS* tls = static_cast<FormTLS*>(ctx);
+    int ret = mbedtls_ssl_cache_get(&tls->_cache, id, idLength, session);
+    if (ret == 0) tls->_resumed = true;
+    return ret;
+}
+
+int FormTLS::cacheSet(void* ctx, unsigned char const* id, size_t idLength, const mbedtls_ssl_session* session) {
+    return mbedtls_ssl_cache_set(&static_cast<FormTLS*>(ctx)->_cache, id, idLength, session);
+}
+#else
+int FormTLS::cacheGet(void* ctx, mbedtls_ssl_session* session) {
+    FormTLS* tls = static_cast<FormTLS*>(ctx);
+    int ret = mbedtls_ssl_cache_get(&tls->_cache, session);
+    if (ret == 0) tls->_resumed = true;
+    return ret;
+}
+
+int FormTLS::cacheSet(void* ctx, const mbedtls_ssl_session* session) {
+    return mbedtls_ssl_cache_set(&static_cast<FormTLS*>(ctx)->_cache, session);
+}
+#endif
+#endif
+
+#if defined(MBEDTLS_SSL_TICKET_C)
+// Tickets that decrypt and validate are resumed handshakes
+int FormTLS::ticketWrite(void* ctx, const mbedtls_ssl_session* session, unsigned char* start,
+                         const unsigned char* end, size_t* length, uint32_t* lifetime) {
+    return mbedtls_ssl_ticket_write(&static_cast<FormTLS*>(ctx)->_ticket, session, start, end, length, lifetime);
+}
+
+int FormTLS::ticketParse(void* ctx, mbedtls_ssl_session* session, unsigned char* buf, size_t length) {
+    FormTLS* tls = static_cast<FormTLS*>(ctx);
+    int ret = mbedtls_ssl_ticket_parse(&tls->_ticket, session, buf, length);
+    if (ret == 0) tls->_resumed = true;
+    return ret;
+}
+#endif
@@ -0,0 +1,137 @@
+/**
+ * FormTLS.h - HTTPS transport for FormBuilder
+ *
+ * Server-side TLS on an accepted WiFiClient using mbedTLS. Sessions are
+ * kept in a small cache and handed out as session tickets, so a browser
+ * that comes back resumes without repeating the public-key operations.
+ * One connection at a time: the TLS context and its record buffers are
+ * allocated once in begin() and reset between connections.
+ *
+ * Author: FormBuilder Library
+ * License: MIT
+ */
+
+#ifndef FORMTLS_H
+#define FORMTLS_H
+
+#include <Arduino.h>
+#include <WiFiClient.h>
+#include <mbedtls/version.h>
+#include <mbedtls/ssl.h>
+#include <mbedtls/ssl_cache.h>
+#include <mbedtls/ssl_ticket.h>
+#include <mbedtls/entropy.h>
+#include <mbedtls/ctr_drbg.h>
+#include <mbedtls/x509_crt.h>
+#include <mbedtls/pk.h>
+
+// Sessions kept for resumption by session ID
+#ifndef FORMTLS_CACHE_SIZE
+#define FORMTLS_CACHE_SIZE 4
+#endif
+
+// Seconds a cached session or ticket can be resumed
+#ifndef FORMTLS_SESSION_LIFETIME
+#define FORMTLS_SESSION_LIFETIME 86400
+#endif
+
+// Milliseconds allowed for a handshake
+#ifndef FORMTLS_HANDSHAKE_TIMEOUT
+#define FORMTLS_HANDSHAKE_TIMEOUT 5000
+#endif
+
+/**
+ * FormTLS Class
+ *
+ * A WiFiClient whose reads and writes go through TLS. Pass it to
+ * FormBuilder::enableTLS(); the builder then runs the handshake on each
+ * connection it accepts and talks to the browser through this object.
+ */
+class FormTLS : public WiFiClient {
+public:
+    /**
+     * Constructor
+     */
+    FormTLS();
+
+    /**
+     * Destructor
+     */
+    ~FormTLS();
+
+    /**
+     * Load the server certificate and key and set up the TLS context
+     * @param certPem Certificate chain, PEM, NUL-terminated
+     * @param keyPem Private key, PEM, NUL-terminated
+     * @return false if the certificate or key could not be used
+     */
+    bool begin(const char* certPem, const char* keyPem);
+
+    /**
+     * Run the server handshake on an accepted connection
+     * @param client Connection from WiFiServer::accept()
+     * @return false if the handshake failed or timed out
+     */
+    bool accept(WiFiClient& client);
+
+    /**
+     * Whether the last handshake resumed an earlier session
+     */
+    bool wasResumed() const;
+
+    /**
+     * Tell the browser the response is complete (TLS close_notify)
+     * The connection stays open so the browser's own close can be awaited.
+     */
+    void closeNotify();
+
+    // Stream over the TLS connection
+    size_t write(uint8_t b) override;
+    size_t write(const uint8_t* buf, size_t size) override;
+    int available() override;
+    int read() override;
+    int read(uint8_t* buf, size_t size) override;
+    int peek() override;
+    void flush() override;
+    void stop() override;
+    uint8_t connected() override;
+
+private:
+    mbedtls_entropy_context _entropy;
+    mbedtls_ctr_drbg_context _drbg;
+    mbedtls_x509_crt _cert;
+    mbedtls_pk_context _key;
+    mbedtls_ssl_config _conf;
+    mbedtls_ssl_context _ssl;
+#if defined(MBEDTLS_SSL_CACHE_C)
+    mbedtls_ssl_cache_context _cache;
+#endif
+#if defined(MBEDTLS_SSL_TICKET_C)
+    mbedtls_ssl_ticket_context _ticket;
+#endif
+    bool _ready;                 // begin() succeeded
+    bool _active;                // handshake done, connection open
+    bool _peerClosed;            // close_notify or EOF from the browser
+    bool _closeSent;             // our close_notify is out
+    bool _resumed;
+    int _peekByte;               // byte read ahead by peek(), or -1
+
+    static int bioSend(void* ctx, const unsigned char* buf, size_t len);
+    static int bioRecv(void* ctx, unsigned char* buf, size_t len);
+#if defined(MBEDTLS_SSL_CACHE_C)
+#if MBEDTLS_VERSION_MAJOR >= 3
+    static int cacheGet(void* ctx, unsigned char const* id, size_t idLength, mbedtls_ssl_session* session);
+    static int cacheSet(void* ctx, unsigned char const* id, size_t idLength, const mbedtls_ssl_session* session);
+#else
+    static int cacheGet(void* ctx, mbedtls_ssl_session* session);
+    static int cacheSet(void* ctx, const mbedtls_ssl_session* session);
+#endif
+#endif
+#if defined(MBEDTLS_SSL_TICKET_C)
+    static int ticketWrite(void* ctx, const mbedtls_ssl_session* session, unsigned char* start,
+                           const unsigned char* end, size_t* length, uint32_t* lifetime);
+    static int ticketParse(void* ctx, mbedtls_ssl_session* session, unsigned char* buf, size_t length);
+#endif
+};
+
+#endif // FORMTLS_H
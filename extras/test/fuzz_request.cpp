@@ -0,0 +1,183 @@
+/**
+ * fuzz_request.cpp - Fuzz target for request parsing and percent-decoding
+ *
+ * Each input is sent twice: as raw request bytes to a form without login
+ * and to one with login enabled, and as the query of an /ajax_inputs
+ * submit so the bytes reach decodeSubmit() and urlDecode().
+ *
+ * Built by the Makefile with a plain main(): it runs every file in the
+ * corpus directories given on the command line, then seeded mutations of
+ * them, then a scaling check that fails if decoding cost grows faster
+ * than linearly with the input. Build with clang -fsanitize=fuzzer and
+ * -DFB_LIBFUZZER to drive LLVMFuzzerTestOneInput() from libFuzzer instead.
+ */
+
+#include "FormBuilder.h"
+#include <algorithm>
+#include <chrono>
+#include <dirent.h>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <vector>
+
+// Runs per mutated seed, and the largest growth of decode time allowed
+// when the input grows by SCALE_FACTOR (linear is SCALE_FACTOR, quadratic its square)
+#define MUTATIONS_PER_SEED 2000
+#define SCALE_FACTOR       8
+#define SCALE_MAX_GROWTH   24
+
+static WiFiServer openServer(80), lockedServer(81);
+static FormBuilder openForm, lockedForm;
+
+static void buildForm(FormBuilder& form) {
+  form.addDropDown("Mode", "Station,AP", 0, true);
+  form.addText("SSID", "home");
+  form.addPassword("Password", "secret");
+  form.addColorPicker("Color", 0x2563EB);
+  form.addTime("Off", 2300, true);
+  form.addBitmask("Days", "Mon,Tue,Wed,Thu,Fri,Sat,Sun", 0x1f);
+  form.addCheckbox("Sleep", true);
+  form.addHidden("7");
+  form.showFieldsWhen(2, 3, 1, "Station");
+}
+
+static void ignoreField(int fieldIndex, String value, bool changed) {}
+static void ignoreMask(int fieldIndex, uint32_t mask, uint32_t changedBits) {}
+
+static void setup() {
+  openForm.begin(&openServer);
+  openForm.setFormBuilder([] { buildForm(openForm); });
+  openForm.setCallback(ignoreField);
+  openForm.setBitmaskCallback(ignoreMask);
+  openForm.enableCaptivePortal();
+  openForm.enableMetrics();
+  openForm.enableDebugEndpoints();
+
+  lockedForm.begin(&lockedServer);
+  lockedForm.setFormBuilder([] { buildForm(lockedForm); });
+  lockedForm.setCallback(ignoreField);
+  lockedForm.enableLogin("fuzz");
+}
+
+static void send(WiFiServer& server, FormBuilder& form, const std::string& request) {
+  server.push(request);
+  form.handleClient();
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+  static bool ready = false;
+  if (!ready) { setup(); ready = true; }
+  std::string input((const char*)data, size);
+  send(openServer, openForm, input);
+  send(lockedServer, lockedForm, input);
+  send(openServer, openForm, "GET /ajax_inputs?" + input + " HTTP/1.1\r\n\r\n");
+  return 0;
+}
+
+#ifndef FB_LIBFUZZER
+
+static std::vector<std::string> seeds;
+
+static void loadCorpus(const std::string& path) {
+  if (DIR* dir = opendir(path.c_str())) {
+    std::vector<std::string> names;
+    while (dirent* entry = readdir(dir)) {
+      if (entry->d_name[0] != '.') names.push_back(entry->d_name);
+    }
+    closedir(dir);
+    std::sort(names.begin(), names.end());
+    for (const std::string& name : names) loadCorpus(path + "/" + name);
+    return;
+  }
+  std::ifstream in(path, std::ios::binary);
+  std::stringstream data;
+  data << in.rdbuf();
+  seeds.push_back(data.str());
+}
+
+static void run(const std::string& input) {
+  LLVMFuzzerTestOneInput((const uint8_t*)input.data(), input.size());
+}
+
+/** Byte flips, inserts, deletes and splices of the seeds, with a fixed seed */
+static void mutate() {
+  static const char interesting[] = "%%0gz+=&?_SEP__\r\n /:;,#";
+  std::mt19937 rng(1);
+  for (const std::string& seed : seeds) {
+    for (int n = 0; n < MUTATIONS_PER_SEED; n++) {
+      std::string s = seed;
+      int edits = 1 + rng() % 8;
+      for (int e = 0; e < edits; e++) {
+        size_t at = s.empty() ? 0 : rng() % s.size();
+        switch (rng() % 5) {
+          case 0: if (!s.empty()) s[at] = rng(); break;
+          case 1: s.insert(at, 1, interesting[rng() % (sizeof(interesting) - 1)]); break;
+          case 2: if (!s.empty()) s.erase(at, 1 + rng() % 16); break;
+          case 3: { const std::string& other = seeds[rng() % seeds.size()];
+                    size_t from = other.empty() ? 0 : rng() % other.size();
+                    s.insert(std::min(at, s.size()), other, from, 1 + rng() % 64); break; }
+          default: s.insert(at, std::string(1 + rng() % 64, interesting[rng() % (sizeof(interesting) - 1)]));
+        }
+      }
+      run(s);
+    }
+  }
+}
+
+/** Median time of one submit whose query is `query`, in nanoseconds */
+static double submitNanos(const std::string& query) {
+  std::string request = "GET /ajax_inputs?" + query + " HTTP/1.1\r\n\r\n";
+  std::vector<double> samples;
+  for (int i = 0; i < 9; i++) {
+    auto start = std::chrono::steady_clock::now();
+    for (int r = 0; r < 4; r++) send(openServer, openForm, request);
+    samples.push_back(std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count());
+  }
+  std::sort(samples.begin(), samples.end());
+  return samples[samples.size() / 2];
+}
+
+/**
+ * Worst-case shapes for the decoder at two sizes. A parser that rescans
+ * its input per separator or per escape grows with the square of the size.
+ */
+static int checkScaling() {
+  struct Shape { const char* name; std::string (*make)(size_t); };
+  static const Shape shapes[] = {
+    {"escapes", [](size_t n) { std::string s = "x11="; while (s.size() < n) s += "%41"; return s; }},
+    {"bad escapes", [](size_t n) { std::string s = "x11="; while (s.size() < n) s += "%%g"; return s; }},
+    {"partial separators", [](size_t n) { std::string s = "x11="; while (s.size() < n) s += "__SEP_"; return s; }},
+    {"nocache", [](size_t n) { std::string s = "x11="; while (s.size() < n) s += "&nocache"; return s; }},
+    {"plain", [](size_t n) { return "x11=" + std::string(n, 'a'); }},
+  };
+  const size_t small = FORMBUILDER_MAX_LINE / (SCALE_FACTOR * 2);
+  const size_t large = small * SCALE_FACTOR;
+  int failures = 0;
+  for (const Shape& shape : shapes) {
+    double t1 = submitNanos(shape.make(small));
+    double t8 = submitNanos(shape.make(large));
+    double growth = t8 / t1;
+    printf("%-20s %6zu bytes %8.0f ns, %6zu bytes %9.0f ns, growth %.1f\n",
+           shape.name, small, t1 / 4, large, t8 / 4, growth);
+    if (growth > SCALE_MAX_GROWTH) {
+      printf("FAIL %s: decode time grew %.1fx for %dx input\n", shape.name, growth, SCALE_FACTOR);
+      failures++;
+    }
+  }
+  printf("worst decode: %u ns/byte\n", (unsigned)openForm.getWorstDecodeNsPerByte());
+  return failures;
+}
+
+int main(int argc, char** argv) {
+  for (int i = 1; i < argc; i++) loadCorpus(argv[i]);
+  if (seeds.empty()) seeds.push_back("GET / HTTP/1.1\r\n\r\n");
+  for (const std::string& seed : seeds) run(seed);
+  mutate();
+  printf("%zu seeds, %zu inputs run\n", seeds.size(), seeds.size() * (MUTATIONS_PER_SEED + 1));
+  if (checkScaling()) return 1;
+  printf("all checks passed\n");
+  return 0;
+}
+
+#endif
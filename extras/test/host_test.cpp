@@ -0,0 +1,810 @@
+/**
+ * host_test.cpp - FormBuilder checks that run on a desktop host
+ *
+ * Builds the library against the mock Arduino core in mock/ and drives
+ * it with in-memory connections, or a socketpair() where the socket
+ * itself matters. Run with --update to rewrite the golden
+ * files after an intended change to the page markup.
+ */
+
+#include "FormBuilder.h"
+#include "FormCaptiveDNS.h"
+#include "FormDispatcher.h"
+#include "reference_form.h"
+#include <zlib.h>
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <utime.h>
+#include <poll.h>
+#include <thread>
+
+// Size budgets for the reference forms; raise them deliberately, with the README table
+#define REFERENCE_PAGE_BUDGET      11776   // full response, headers included
+#define REFERENCE_PAGE_GZIP_BUDGET 4864    // same response through FormDeflate
+#define LARGE_FORM_BUDGET          27648   // 100-field form, uncompressed
+#define LARGE_FORM_GZIP_BUDGET     6656    // 100-field form through FormDeflate
+
+#ifdef FORMBUILDER_ALLOC_STATS
+// Heap budgets per request, with every String allocation counted
+#define REFERENCE_PAGE_ALLOCS      16
+#define REFERENCE_PAGE_PEAK_BYTES  1024
+#define SUBMIT_ALLOCS              32
+#define SUBMIT_PEAK_BYTES          2048
+#endif
+
+static WiFiServer server(80);
+static FormBuilder form;
+static bool updateGolden = false;
+static int failures = 0;
+
+#define CHECK(cond, ...) do { if (!(cond)) { \
+    printf("FAIL %s:%d: ", __FILE__, __LINE__); printf(__VA_ARGS__); printf("\n"); failures++; } } while (0)
+
+/** One field of each type, as described under Page Size in the README */
+static void referenceForm() {
+  addReferenceFields(form);
+}
+
+/** Text, number, checkbox, dropdown and range fields in turn, as in the Compression table */
+static void largeForm() {
+  for (int i = 0; i < 100; i++) {
+    switch (i % 5) {
+      case 0: form.addText("Name " + String(i), "value"); break;
+      case 1: form.addNumber("Count " + String(i), 0, 100, 1, i); break;
+      case 2: form.addCheckbox("Enable " + String(i), i & 1); break;
+      case 3: form.addDropDown("Mode " + String(i), "Off,Low,Medium,High", 2); break;
+      default: form.addRange("Level " + String(i), 0, 255, 1, 128);
+    }
+  }
+}
+
+/** Send one request through handleClient() and return everything written back */
+static std::string request(const std::string& target, const std::string& headers = "") {
+  auto conn = server.push("GET " + target + " HTTP/1.1\r\nHost: esp32\r\n" + headers + "\r\n");
+  form.handleClient();
+  return conn->out;
+}
+
+static std::string body(const std::string& response) {
+  size_t end = response.find("\r\n\r\n");
+  return end == std::string::npos ? std::string() : response.substr(end + 4);
+}
+
+static std::string gunzip(const std::string& data) {
+  z_stream z = {};
+  std::string out;
+  if (inflateInit2(&z, MAX_WBITS + 16) != Z_OK) return out;
+  z.next_in = (Bytef*)data.data();
+  z.avail_in = data.size();
+  char buf[4096];
+  int ret;
+  do {
+    z.next_out = (Bytef*)buf;
+    z.avail_out = sizeof(buf);
+    ret = inflate(&z, Z_NO_FLUSH);
+    out.append(buf, sizeof(buf) - z.avail_out);
+  } while (ret == Z_OK);
+  inflateEnd(&z);
+  return ret == Z_STREAM_END ? out : std::string();
+}
+
+/** Compare against golden/<name>, or rewrite it with --update */
+static void checkGolden(const char* name, const std::string& actual) {
+  std::string path = std::string(GOLDEN_DIR "/") + name;
+  if (updateGolden) {
+    std::ofstream(path, std::ios::binary) << actual;
+    printf("updated %s (%zu bytes)\n", path.c_str(), actual.size());
+    return;
+  }
+  std::ifstream in(path, std::ios::binary);
+  std::stringstream expected;
+  expected << in.rdbuf();
+  std::string want = expected.str();
+  if (want == actual) return;
+  size_t at = 0;
+  while (at < want.size() && at < actual.size() && want[at] == actual[at]) at++;
+  CHECK(false, "%s differs at byte %zu (golden %zu bytes, actual %zu bytes)", name, at, want.size(), actual.size());
+}
+
+static void testReferencePage() {
+  form.setFormBuilder(referenceForm);
+  std::string page = request("/");
+  checkGolden("reference_page.http", page);
+  CHECK(page.size() <= REFERENCE_PAGE_BUDGET, "reference page is %zu bytes, budget %d", page.size(), REFERENCE_PAGE_BUDGET);
+  CHECK(form.getLastResponseBytes() == page.size(), "getLastResponseBytes() %u, wire %zu",
+        (unsigned)form.getLastResponseBytes(), page.size());
+
+  std::string gz = request("/", "Accept-Encoding: gzip, deflate\r\n");
+  CHECK(gz.find("Content-Encoding: gzip\r\n") != std::string::npos, "compressed page has no Content-Encoding");
+  CHECK(gunzip(body(gz)) == body(page), "compressed page does not inflate to the plain page");
+  CHECK(gz.size() <= REFERENCE_PAGE_GZIP_BUDGET, "compressed reference page is %zu bytes, budget %d",
+        gz.size(), REFERENCE_PAGE_GZIP_BUDGET);
+  printf("reference page: %zu bytes, %zu compressed\n", page.size(), gz.size());
+
+  form.enableContentLength();
+  std::string sized = request("/");
+  form.enableContentLength(false);
+  CHECK(body(sized) == body(page), "sizing pass changed the page");
+  CHECK(sized.find("Content-Length: " + std::to_string(body(page).size()) + "\r\n") != std::string::npos,
+        "Content-Length does not match the body");
+}
+
+/**
+ * Load the page over a socket like a browser: read until the server's FIN,
+ * then close after closeAfterMs. Returns how long handleClient() took.
+ */
+static unsigned long lingerRequest(std::string& page, unsigned long closeAfterMs) {
+  int sv[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0) return 0;
+  std::string req = "GET / HTTP/1.1\r\nHost: esp32\r\n\r\n";
+  if (write(sv[1], req.data(), req.size()) != (ssize_t)req.size()) return 0;
+  server.adopt(sv[0]);
+  std::thread browser([&] {
+    char buf[4096];
+    ssize_t n;
+    while ((n = read(sv[1], buf, sizeof(buf))) > 0) page.append(buf, n);
+    delay(closeAfterMs);
+    close(sv[1]);
+  });
+  unsigned long start = millis();
+  form.handleClient();
+  unsigned long took = millis() - start;
+  browser.join();
+  return took;
+}
+
+/**
+ * The reference page through writev() into a socket whose send buffer holds
+ * only part of it, as lwIP's does: flushFragments() has to resume partial
+ * writes mid-fragment, and the browser must still get the golden bytes.
+ */
+static void testPartialWrites() {
+  form.setFormBuilder(referenceForm);
+  int sv[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0) return;
+  int size = 2048;
+  setsockopt(sv[0], SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+  fcntl(sv[0], F_SETFL, O_NONBLOCK);
+  std::string req = "GET / HTTP/1.1\r\nHost: esp32\r\n\r\n";
+  if (write(sv[1], req.data(), req.size()) != (ssize_t)req.size()) return;
+  server.adopt(sv[0]);
+
+  std::string page;
+  int queued = 0;
+  std::thread browser([&] {
+    delay(50);
+    ioctl(sv[1], FIONREAD, &queued);    // what the server got out before it had to wait
+    char buf[512];
+    ssize_t n;
+    while ((n = read(sv[1], buf, sizeof(buf))) > 0) page.append(buf, n);
+    close(sv[1]);
+  });
+  form.handleClient();
+  browser.join();
+  CHECK(queued > 0 && (size_t)queued < page.size(), "%d of %zu bytes fit the send buffer at once", queued, page.size());
+  checkGolden("reference_page.http", page);
+}
+
+/** After the page the write side is shut down, and the linger ends when the browser closes */
+static void testLingerClose() {
+  form.setFormBuilder(referenceForm);
+  std::string expected = body(request("/"));
+  form.setCloseLinger(2000);
+
+  std::string page;
+  unsigned long took = lingerRequest(page, 0);
+  CHECK(body(page) == expected, "page over a socket differs from the in-memory page");
+  CHECK(took < 1000, "handleClient() took %lu ms; the linger did not end when the browser closed", took);
+
+  // A browser that keeps its side open only holds the connection until the bound
+  form.setCloseLinger(100);
+  page.clear();
+  took = lingerRequest(page, 1000);
+  CHECK(took >= 100 && took < 1000, "linger bound of 100 ms took %lu ms", took);
+  form.setCloseLinger(3000);
+}
+
+/** The reference page and the length of the response after each write, with the given flush points */
+static std::vector<size_t> pageWrites(uint8_t points, std::string& page) {
+  form.setFlushPoints(points);
+  auto conn = server.push("GET / HTTP/1.1\r\nHost: esp32\r\n\r\n");
+  form.handleClient();
+  page = conn->out;
+  return conn->writes;
+}
+
+/**
+ * Each flush point ends a write at its place in the page: the writes
+ * before it are those without the point, plus exactly one boundary at
+ * it. Later writes are batched afresh from there. No byte changes.
+ */
+static void testFlushPoints() {
+  form.setFormBuilder(referenceForm);
+  std::string page, flushed;
+  std::vector<size_t> plain = pageWrites(0, page);
+  size_t headersEnd = page.find("\r\n\r\n") + 4;
+  size_t headEnd = page.find("</head>\n") + 8;
+
+  // Boundaries up to `end`, inclusive
+  auto upTo = [](const std::vector<size_t>& writes, size_t end) {
+    return std::vector<size_t>(writes.begin(), std::upper_bound(writes.begin(), writes.end(), end));
+  };
+  // Each case against the page with one point fewer
+  struct { uint8_t points; uint8_t fewer; size_t at; } cases[] = {
+    { FB_FLUSH_HEADERS, 0, headersEnd },
+    { FB_FLUSH_HEAD, 0, headEnd },
+    { FB_FLUSH_HEADERS | FB_FLUSH_HEAD, FB_FLUSH_HEADERS, headEnd },
+  };
+  for (const auto& c : cases) {
+    std::vector<size_t> expected = upTo(c.fewer ? pageWrites(c.fewer, flushed) : plain, c.at - 1);
+    expected.push_back(c.at);
+    std::vector<size_t> writes = pageWrites(c.points, flushed);
+    CHECK(flushed == page, "flush points 0x%x change the page", c.points);
+    CHECK(upTo(writes, c.at) == expected, "flush points 0x%x: writes up to byte %zu are not those without it plus one there",
+          c.points, c.at);
+  }
+  form.setFlushPoints(0);
+
+  // Nagle is off on client connections unless the sketch turns it back on
+  auto conn = server.push("GET / HTTP/1.1\r\n\r\n");
+  form.handleClient();
+  CHECK(conn->noDelay, "TCP_NODELAY is not set on the client connection");
+  form.setNoDelay(false);
+  conn = server.push("GET / HTTP/1.1\r\n\r\n");
+  form.handleClient();
+  CHECK(!conn->noDelay, "setNoDelay(false) left TCP_NODELAY set");
+  form.setNoDelay(true);
+}
+
+static void testLargeForm() {
+  form.setFormBuilder(largeForm);
+  std::string page = request("/");
+  std::string gz = request("/", "Accept-Encoding: gzip\r\n");
+  CHECK(page.size() <= LARGE_FORM_BUDGET, "100-field page is %zu bytes, budget %d", page.size(), LARGE_FORM_BUDGET);
+  CHECK(gunzip(body(gz)) == body(page), "compressed 100-field page does not inflate to the plain page");
+  CHECK(gz.size() <= LARGE_FORM_GZIP_BUDGET, "compressed 100-field page is %zu bytes, budget %d",
+        gz.size(), LARGE_FORM_GZIP_BUDGET);
+  printf("100-field page: %zu bytes, %zu compressed\n", page.size(), gz.size());
+}
+
+static std::string submitted;
+
+static void recordField(int fieldIndex, String value, bool changed) {
+  submitted += std::to_string(fieldIndex) + "=[" + value.c_str() + "] ";
+}
+
+static void recordMask(int fieldIndex, uint32_t mask, uint32_t changedBits) {
+  submitted += std::to_string(fieldIndex) + "=mask " + std::to_string(mask) + " ";
+}
+
+static std::string submit(const std::string& query) {
+  submitted.clear();
+  request("/ajax_inputs?" + query);
+  return submitted;
+}
+
+/** Slots of hidden fields are empty, including the last one before &nocache= */
+static void testHiddenFields() {
+  form.setFormBuilder([] {
+    form.addDropDown("Mode", "Station,AP", 0, true);
+    form.addText("SSID", "home");
+    form.addBitmask("Days", "Mon,Tue,Wed", 3);
+    form.showFieldsWhen(2, 3, 1, "Station");
+  });
+  form.setCallback(recordField);
+  request("/");
+
+  // Queries as the page script builds them
+  std::string got = submit("x1=AP__SEP____SEP__&nocache=523412.23");
+  CHECK(got == "1=[AP] ", "hidden last field: %s", got.c_str());
+  got = submit("x1=Station__SEP__x2=work__SEP__x3=5&nocache=0.5");
+  CHECK(got == "1=[Station] 2=[work] 3=[5] ", "all shown: %s", got.c_str());
+  got = submit("__SEP____SEP__&nocache=1");
+  CHECK(got == "", "all hidden: %s", got.c_str());
+
+  form.setBitmaskCallback(recordMask);
+  got = submit("x1=AP__SEP____SEP__&nocache=523412.23");
+  CHECK(got == "1=[AP] ", "hidden last bitmask: %s", got.c_str());
+  got = submit("x1=Station__SEP__x2=home__SEP__x3=6&nocache=7");
+  CHECK(got == "1=[Station] 2=[home] 3=mask 6 ", "shown bitmask: %s", got.c_str());
+  form.setBitmaskCallback(nullptr);
+  form.setCallback(nullptr);
+}
+
+#ifdef FORMBUILDER_ALLOC_STATS
+/** The same request with its output buffer reserved, so only the library's heap use is counted */
+static void requestUntracked(const std::string& target) {
+  auto conn = server.push("GET " + target + " HTTP/1.1\r\nHost: esp32\r\n\r\n");
+  conn->out.reserve(65536);
+  form.handleClient();
+}
+
+/** A page render and a submit stay inside their heap budgets */
+static void testAllocBudget() {
+  form.setFormBuilder(referenceForm);
+  form.setCallback(recordField);
+  const FormAllocStats& stats = form.getAllocStats();
+
+  form.setAllocBudget(REFERENCE_PAGE_ALLOCS, REFERENCE_PAGE_PEAK_BYTES);
+  requestUntracked("/");
+  printf("reference page: %u allocations, %u peak bytes\n", (unsigned)stats.totalAllocs, (unsigned)stats.totalPeakBytes);
+  CHECK(!stats.budgetExceeded, "reference page: %u allocations, %u peak bytes, budget %d and %d",
+        (unsigned)stats.totalAllocs, (unsigned)stats.totalPeakBytes, REFERENCE_PAGE_ALLOCS, REFERENCE_PAGE_PEAK_BYTES);
+
+  form.setAllocBudget(SUBMIT_ALLOCS, SUBMIT_PEAK_BYTES);
+  requestUntracked(REFERENCE_SUBMIT);
+  printf("submit: %u allocations, %u peak bytes\n", (unsigned)stats.totalAllocs, (unsigned)stats.totalPeakBytes);
+  CHECK(stats.allocCount[FB_PHASE_DECODE] > 0, "no decode allocations seen; is malloc wrapped?");
+  CHECK(!stats.budgetExceeded, "submit: %u allocations, %u peak bytes, budget %d and %d",
+        (unsigned)stats.totalAllocs, (unsigned)stats.totalPeakBytes, SUBMIT_ALLOCS, SUBMIT_PEAK_BYTES);
+  form.setAllocBudget(0, 0);
+  form.setCallback(nullptr);
+
+  // A block from before the request, freed during it, must not offset the request's own peak
+  static String* before = new String(std::string(4096, 'x').c_str());
+  form.setFormBuilder([] {
+    delete before;
+    before = nullptr;
+    form.addText("Name", String(std::string(200, 'y').c_str()));
+  });
+  requestUntracked("/");
+  CHECK(stats.totalPeakBytes >= 200, "peak %u bytes after freeing an older block", (unsigned)stats.totalPeakBytes);
+}
+#endif
+
+/** With a login, the diagnostic endpoints want the cookie like the form does */
+static void testLoginGate() {
+  static WiFiServer lockedServer(8443);
+  static FormBuilder locked;
+  locked.begin(&lockedServer);
+  locked.setFormBuilder([] { locked.addText("SSID", "home"); });
+  locked.enableMetrics();
+  locked.enableDebugEndpoints();
+  locked.enableLogin("open sesame");
+  auto get = [](const std::string& target, const std::string& headers) {
+    auto conn = lockedServer.push("GET " + target + " HTTP/1.1\r\n" + headers + "\r\n");
+    locked.handleClient();
+    return conn->out;
+  };
+
+  for (const char* path : {"/fb/metrics", "/fb/access", "/fb/access?json"}) {
+    std::string out = get(path, "");
+    CHECK(out.compare(0, 25, "HTTP/1.1 401 Unauthorized") == 0, "%s without a token: %.30s", path, out.c_str());
+  }
+
+  std::string form = "next=%2F&p=open+sesame";
+  auto login = lockedServer.push("POST /fb/login HTTP/1.1\r\nContent-Length: " + std::to_string(form.size()) +
+                                 "\r\n\r\n" + form);
+  locked.handleClient();
+  size_t at = login->out.find("Set-Cookie: fbt=");
+  CHECK(at != std::string::npos, "login set no cookie: %.40s", login->out.c_str());
+  if (at == std::string::npos) return;
+  std::string cookie = "Cookie: fbt=" + login->out.substr(at + 16, FB_TOKEN_LENGTH) + "\r\n";
+
+  std::string out = get("/fb/metrics", cookie);
+  CHECK(out.compare(0, 15, "HTTP/1.1 200 OK") == 0, "metrics with a token: %.30s", out.c_str());
+  CHECK(out.find("formbuilder_requests_total{route=\"metrics\",code=\"401\"} 1") != std::string::npos,
+        "refused scrape not counted");
+  out = get("/fb/access", cookie);
+  CHECK(out.compare(0, 15, "HTTP/1.1 200 OK") == 0, "access log with a token: %.30s", out.c_str());
+  out = get("/fb/metrics", "Cookie: fbt=" + std::string(FB_TOKEN_LENGTH, '0') + "\r\n");
+  CHECK(out.compare(0, 25, "HTTP/1.1 401 Unauthorized") == 0, "metrics with a forged token: %.30s", out.c_str());
+
+  // A submit without the cookie changes nothing: no field or complete callback runs
+  static bool completed = false;
+  locked.setCallback(recordField);
+  locked.setFormCompleteCallback([] { completed = true; });
+  submitted.clear();
+  out = get("/ajax_inputs?x1=away&nocache=0.5", "");
+  CHECK(out.compare(0, 25, "HTTP/1.1 401 Unauthorized") == 0, "submit without a token: %.30s", out.c_str());
+  CHECK(submitted.empty() && !completed, "submit without a token ran callbacks: %s", submitted.c_str());
+  out = get("/ajax_inputs?x1=away&nocache=0.5", cookie);
+  CHECK(out.compare(0, 15, "HTTP/1.1 200 OK") == 0, "submit with a token: %.30s", out.c_str());
+  CHECK(submitted == "1=[away] " && completed, "submit with a token ran [%s], complete %d", submitted.c_str(), completed);
+  locked.setCallback(nullptr);
+  locked.setFormCompleteCallback(nullptr);
+
+  // A wrong password starts the back-off; attempts during it are refused unchecked and counted
+  auto post = [](const std::string& body) {
+    auto conn = lockedServer.push("POST /fb/login HTTP/1.1\r\nContent-Length: " + std::to_string(body.size()) +
+                                  "\r\n\r\n" + body);
+    locked.handleClient();
+    return conn->out;
+  };
+  CHECK(post("next=%2F&p=guess").compare(0, 25, "HTTP/1.1 401 Unauthorized") == 0, "wrong password accepted");
+  CHECK(get("/fb/metrics", cookie).find("\nformbuilder_rate_limited_total 0\n") != std::string::npos,
+        "wrong password counted as rate limited");
+  CHECK(post(form).compare(0, 25, "HTTP/1.1 401 Unauthorized") == 0, "right password accepted during the back-off");
+  CHECK(get("/fb/metrics", cookie).find("\nformbuilder_rate_limited_total 1\n") != std::string::npos,
+        "refusal during the back-off not counted in formbuilder_rate_limited_total");
+}
+
+// serveStatic() fixtures: files written to a temporary directory, removed at exit
+static std::string staticDir;
+static std::vector<std::string> staticFiles;
+
+static void writeStaticFile(const std::string& name, const std::string& data, time_t mtime) {
+  std::string path = staticDir + name;
+  for (size_t at = staticDir.size() + 1; (at = path.find('/', at)) != std::string::npos; at++) {
+    if (mkdir(path.substr(0, at).c_str(), 0700) == 0) staticFiles.push_back(path.substr(0, at));
+  }
+  std::ofstream(path, std::ios::binary) << data;
+  utimbuf times = { mtime, mtime };
+  utime(path.c_str(), &times);
+  staticFiles.push_back(path);
+}
+
+static void removeStaticFiles() {
+  for (auto it = staticFiles.rbegin(); it != staticFiles.rend(); ++it) remove(it->c_str());
+  rmdir(staticDir.c_str());
+}
+
+static WiFiServer siteServer(8083);
+static FormBuilder site;
+
+static std::string getStatic(const std::string& target, const std::string& headers = "") {
+  auto conn = siteServer.push("GET " + target + " HTTP/1.1\r\n" + headers + "\r\n");
+  site.handleClient();
+  return conn->out;
+}
+
+static std::string header(const std::string& response, const std::string& name) {
+  size_t at = response.find("\r\n" + name + ": ");
+  if (at == std::string::npos || at > response.find("\r\n\r\n")) return "";
+  at += name.size() + 4;
+  return response.substr(at, response.find("\r\n", at) - at);
+}
+
+/** Files from a directory: streaming, validators, index files, traversal, prefix matching */
+static void testStaticFiles() {
+  char dir[] = "/tmp/fb_staticXXXXXX";
+  if (!mkdtemp(dir)) return;
+  staticDir = dir;
+  std::string big;
+  for (int i = 0; i < FORMBUILDER_FILE_BUFFER * 3 + 100; i++) big += (char)(i * 7 + i / 251);
+  writeStaticFile("/www/big.bin", big, 1700000000);
+  writeStaticFile("/www/index.html", "<p>home</p>", 1700000000);
+  writeStaticFile("/www/docs/index.html", "<p>docs</p>", 1700000000);
+  writeStaticFile("/secret.txt", "secret", 1700000000);
+  writeStaticFile("/www/theme.css", "body{}", 1700000000);
+  writeStaticFile("/www/files/theme.css", "decoy", 1700000000);
+  static fs::FS files(staticDir);
+  site.begin(&siteServer);
+  site.setFormBuilder([] { site.addText("SSID", "home"); });
+  site.serveStatic("/static", files, "/www", "max-age=60");
+  site.serveStatic("/assets/", files, "/www");
+
+  // Several FORMBUILDER_FILE_BUFFER chunks, each its own write, byte for byte
+  auto conn = siteServer.push("GET /static/big.bin HTTP/1.1\r\n\r\n");
+  site.handleClient();
+  size_t bodyStart = conn->out.find("\r\n\r\n") + 4;
+  CHECK(conn->out.compare(0, 15, "HTTP/1.1 200 OK") == 0, "big file: %.30s", conn->out.c_str());
+  CHECK(body(conn->out) == big, "big file body is %zu bytes, not the %zu on disk", body(conn->out).size(), big.size());
+  CHECK(header(conn->out, "Content-Length") == std::to_string(big.size()), "big file Content-Length %s",
+        header(conn->out, "Content-Length").c_str());
+  size_t chunks = 0, previous = bodyStart;
+  for (size_t end : conn->writes) {
+    if (end <= bodyStart) continue;
+    CHECK(end - previous <= FORMBUILDER_FILE_BUFFER, "file write of %zu bytes", end - previous);
+    previous = end;
+    chunks++;
+  }
+  CHECK(chunks == (big.size() + FORMBUILDER_FILE_BUFFER - 1) / FORMBUILDER_FILE_BUFFER,
+        "big file went out in %zu writes", chunks);
+
+  // ETag from size and modification time; a match gets 304 and no body
+  char etag[24];
+  snprintf(etag, sizeof(etag), "\"%x-%x\"", (unsigned)big.size(), 1700000000u);
+  CHECK(header(conn->out, "ETag") == etag, "ETag %s, expected %s", header(conn->out, "ETag").c_str(), etag);
+  CHECK(header(conn->out, "Cache-Control") == "max-age=60", "Cache-Control %s", header(conn->out, "Cache-Control").c_str());
+  std::string out = getStatic("/static/big.bin", "If-None-Match: " + std::string(etag) + "\r\n");
+  CHECK(out.compare(0, 25, "HTTP/1.1 304 Not Modified") == 0 && body(out).empty(), "matching ETag: %.30s", out.c_str());
+  writeStaticFile("/www/big.bin", big, 1700000001);
+  out = getStatic("/static/big.bin", "If-None-Match: " + std::string(etag) + "\r\n");
+  CHECK(out.compare(0, 15, "HTTP/1.1 200 OK") == 0 && header(out, "ETag") != etag, "ETag unchanged after a new mtime");
+
+  // Directories serve their index.html
+  for (const char* path : { "/static", "/static/", "/static?x=1", "/assets/" }) {
+    out = getStatic(path);
+    CHECK(body(out) == "<p>home</p>" && header(out, "Content-Type") == "text/html", "%s: %.30s", path, out.c_str());
+  }
+  CHECK(body(getStatic("/static/docs/")) == "<p>docs</p>", "/static/docs/ did not serve docs/index.html");
+  CHECK(getStatic("/static/docs").compare(0, 22, "HTTP/1.1 404 Not Found") == 0, "/static/docs without / served");
+
+  // Nothing outside the directory
+  for (const char* path : { "/static/../secret.txt", "/static/docs/../../secret.txt", "/assets/..%2fsecret.txt",
+                            "/static/missing.txt" }) {
+    out = getStatic(path);
+    CHECK(out.compare(0, 22, "HTTP/1.1 404 Not Found") == 0 && out.find("secret") == std::string::npos,
+          "%s: %.30s", path, out.c_str());
+  }
+
+  // A prefix matches whole path segments unless it ends in /; the mount
+  // would map /staticfiles/theme.css to www/files/theme.css
+  CHECK(body(getStatic("/static/theme.css")) == "body{}", "/static/theme.css not served");
+  CHECK(body(getStatic("/staticfiles/theme.css")) != "decoy", "/staticfiles matched /static");
+  CHECK(body(getStatic("/assets")) != "<p>home</p>", "/assets matched /assets/");
+  CHECK(body(getStatic("/assets/theme.css")) == "body{}", "file under the second mount not served");
+}
+
+/** Accept-Encoding picks the precompressed copy of a static file, and the ETag says which */
+static void testAcceptEncoding() {
+  if (staticDir.empty()) return;
+  writeStaticFile("/www/app.js", "plain", 1700000000);
+  writeStaticFile("/www/app.js.gz", "gzipped", 1700000000);
+  writeStaticFile("/www/app.js.br", "brotli", 1700000000);
+  writeStaticFile("/www/only-gz.js", "plain", 1700000000);
+  writeStaticFile("/www/only-gz.js.gz", "gzipped", 1700000000);
+
+  struct { const char* path; const char* accept; const char* body; const char* coding; } cases[] = {
+    { "/static/app.js", nullptr, "plain", "" },
+    { "/static/app.js", "gzip", "gzipped", "gzip" },
+    { "/static/app.js", "gzip, deflate, br", "brotli", "br" },          // br preferred over gzip
+    { "/static/app.js", "br;q=0.1, gzip;q=1.0", "brotli", "br" },       // whatever the q order
+    { "/static/app.js", "GZip", "gzipped", "gzip" },                    // tokens are case-insensitive
+    { "/static/app.js", "BR", "brotli", "br" },
+    { "/static/app.js", "gzip;q=0", "plain", "" },                      // q=0 refuses
+    { "/static/app.js", "gzip;q=0.000, br;Q=0.0", "plain", "" },
+    { "/static/app.js", "br;q=0, gzip", "gzipped", "gzip" },
+    { "/static/app.js", "gzip;q=0.001", "gzipped", "gzip" },            // small but not zero
+    { "/static/app.js", "*", "brotli", "br" },                          // wildcard: anything
+    { "/static/app.js", "br;q=0, *", "gzipped", "gzip" },               // anything not refused
+    { "/static/app.js", "*;q=0", "plain", "" },
+    { "/static/app.js", "identity, x-gzip, gzipx, brotli", "plain", "" },
+    { "/static/only-gz.js", "br, gzip", "gzipped", "gzip" },            // no .br on disk
+    { "/static/only-gz.js", "br", "plain", "" },
+  };
+  for (const auto& c : cases) {
+    std::string out = getStatic(c.path, c.accept ? "Accept-Encoding: " + std::string(c.accept) + "\r\n" : "");
+    // The validator of the file sent, tagged with its coding
+    char etag[32];
+    snprintf(etag, sizeof(etag), "\"%x-%x%s\"", (unsigned)strlen(c.body), 1700000000u,
+             *c.coding ? std::string(c.coding) == "br" ? "-br" : "-gz" : "");
+    CHECK(body(out) == c.body, "Accept-Encoding: %s got %s", c.accept ? c.accept : "(none)", body(out).c_str());
+    CHECK(header(out, "Content-Encoding") == c.coding, "Accept-Encoding: %s sent Content-Encoding %s",
+          c.accept ? c.accept : "(none)", header(out, "Content-Encoding").c_str());
+    CHECK(header(out, "ETag") == etag, "Accept-Encoding: %s: ETag %s, expected %s", c.accept ? c.accept : "(none)",
+          header(out, "ETag").c_str(), etag);
+    CHECK(header(out, "Vary") == "Accept-Encoding", "no Vary on %s", c.path);
+  }
+
+  // Each copy validates only against its own ETag
+  std::string gzTag = header(getStatic("/static/app.js", "Accept-Encoding: gzip\r\n"), "ETag");
+  std::string plainTag = header(getStatic("/static/app.js"), "ETag");
+  CHECK(getStatic("/static/app.js", "Accept-Encoding: gzip\r\nIf-None-Match: " + gzTag + "\r\n").compare(9, 3, "304") == 0,
+        "gzip ETag did not validate the gzip copy");
+  CHECK(getStatic("/static/app.js", "If-None-Match: " + gzTag + "\r\n").compare(9, 3, "200") == 0,
+        "gzip ETag validated the plain copy");
+  CHECK(getStatic("/static/app.js", "Accept-Encoding: br\r\nIf-None-Match: " + plainTag + "\r\n").compare(9, 3, "200") == 0,
+        "plain ETag validated the brotli copy");
+}
+
+/** Under a dispatcher the built-in CSS and JS go out gzipped to clients that accept it */
+static void testDispatcherAssets() {
+  static WiFiServer shared(8084);
+  static FormBuilder builder;
+  static FormDispatcher dispatcher;
+  builder.setFormBuilder([] { builder.addText("SSID", "home"); });
+  dispatcher.begin(&shared);
+  dispatcher.addBuilder(builder);
+  auto get = [](const char* path, const std::string& headers) {
+    auto conn = shared.push("GET " + std::string(path) + " HTTP/1.1\r\nConnection: close\r\n" + headers + "\r\n");
+    dispatcher.handleClient();
+    return conn->out;
+  };
+
+  for (const auto& asset : { std::make_pair(FB_ASSET_CSS_PATH, FB_STYLE), std::make_pair(FB_ASSET_JS_PATH, FB_SCRIPT) }) {
+    std::string plain = get(asset.first, "");
+    std::string gz = get(asset.first, "Accept-Encoding: gzip, deflate\r\n");
+    CHECK(body(plain) == asset.second && header(plain, "Content-Encoding").empty(), "%s plain copy differs", asset.first);
+    CHECK(header(gz, "Content-Encoding") == "gzip" && gunzip(body(gz)) == asset.second,
+          "%s gzip copy does not inflate to the asset", asset.first);
+    CHECK(body(gz).size() < body(plain).size(), "%s compressed to %zu of %zu bytes", asset.first, body(gz).size(),
+          body(plain).size());
+    CHECK(header(gz, "Content-Length") == std::to_string(body(gz).size()), "%s gzip Content-Length %s", asset.first,
+          header(gz, "Content-Length").c_str());
+    CHECK(header(gz, "ETag") == header(plain, "ETag").substr(0, 9) + "-gz\"", "%s gzip ETag %s", asset.first,
+          header(gz, "ETag").c_str());
+    CHECK(header(plain, "Vary") == "Accept-Encoding" && header(gz, "Vary") == "Accept-Encoding", "%s without Vary",
+          asset.first);
+    CHECK(get(asset.first, "Accept-Encoding: gzip\r\nIf-None-Match: " + header(gz, "ETag") + "\r\n").compare(9, 3, "304") == 0,
+          "%s gzip ETag did not validate", asset.first);
+    CHECK(get(asset.first, "Accept-Encoding: gzip;q=0\r\n") == plain, "%s gzip;q=0 was not sent plain", asset.first);
+  }
+}
+
+/** A DNS query: header, then one question unless `question` is given whole */
+static std::string dnsQuery(uint8_t flags, uint16_t questions, const std::string& question) {
+  std::string q = { 0x12, 0x34, (char)flags, 0, 0, (char)questions, 0, 0, 0, 0, 0, 0 };
+  return q + question;
+}
+
+/** A question for name, e.g. "\x07example\x03com", of the given type, class IN */
+static std::string dnsQuestion(const std::string& name, uint16_t type) {
+  return name + std::string(1, '\0') + (char)(type >> 8) + (char)type + std::string("\0\1", 2);
+}
+
+/** Everything the responder, over UDP loopback, gets wrong or right about one query */
+static void testCaptiveDNS() {
+  static FormCaptiveDNS dns;
+  IPAddress device(192, 168, 4, 1);
+  uint16_t port = 15353;
+  while (!dns.begin(device, port) && port < 15363) port++;
+  CHECK(dns.getQueries() == 0 && port < 15363, "no free UDP port for the responder");
+
+  int fd = socket(AF_INET, SOCK_DGRAM, 0);
+  sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  connect(fd, (sockaddr*)&addr, sizeof(addr));
+  auto ask = [&](const std::string& query) {
+    send(fd, query.data(), query.size(), 0);
+    dns.handleRequests();
+    char buf[1024];
+    pollfd p = { fd, POLLIN, 0 };
+    ssize_t n = poll(&p, 1, 50) > 0 ? recv(fd, buf, sizeof(buf), 0) : 0;
+    return std::string(buf, n > 0 ? n : 0);
+  };
+  const std::string name = "\x11" "connectivitycheck" "\x07" "gstatic" "\x03" "com";
+
+  // A: the question echoed, one answer with the device address
+  std::string query = dnsQuery(0x01, 1, dnsQuestion(name, 1));
+  std::string reply = ask(query);
+  CHECK(reply.size() == query.size() + 16, "A reply is %zu bytes", reply.size());
+  if (reply.size() == query.size() + 16) {
+    CHECK(reply.compare(0, 2, query, 0, 2) == 0, "A reply has another ID");
+    CHECK((uint8_t)reply[2] == 0x85 && reply[3] == 0, "A reply flags %02x %02x", (uint8_t)reply[2], (uint8_t)reply[3]);
+    CHECK(reply[5] == 1 && reply[7] == 1, "A reply counts %d questions, %d answers", reply[5], reply[7]);
+    CHECK(reply.compare(12, query.size() - 12, query, 12) == 0, "A reply does not echo the question");
+    CHECK(reply.substr(reply.size() - 4) == std::string("\xc0\xa8\x04\x01", 4), "A reply is not the device address");
+  }
+
+  // AAAA: NOERROR with no answer, so the client falls back to A at once
+  query = dnsQuery(0x01, 1, dnsQuestion(name, 28));
+  reply = ask(query);
+  CHECK(reply.size() == query.size() && reply[3] == 0 && reply[7] == 0,
+        "AAAA reply is %zu bytes, rcode %d, %d answers", reply.size(), reply.empty() ? -1 : reply[3], reply.size() > 7 ? reply[7] : -1);
+
+  // Another opcode, or not exactly one question: a bare NOTIMP header
+  for (const std::string& q : { dnsQuery(0x10, 1, dnsQuestion(name, 1)), dnsQuery(0x01, 2, dnsQuestion(name, 1) + dnsQuestion(name, 1)),
+                                dnsQuery(0x01, 0, "") }) {
+    reply = ask(q);
+    CHECK(reply.size() == 12 && (reply[3] & 0x0f) == 4 && reply[5] == 0, "opcode %d, %d questions: %zu-byte reply, rcode %d",
+          (q[2] >> 3) & 0x0f, q[5], reply.size(), reply.size() > 3 ? reply[3] & 0x0f : -1);
+  }
+
+  // Dropped without a reply: a compression pointer in the question name,
+  // a question cut short, a packet larger than the buffer
+  uint32_t answered = dns.getQueries();
+  CHECK(ask(dnsQuery(0x01, 1, dnsQuestion("\x03www\xc0\x0c", 1))).empty(), "compression pointer answered");
+  // read as a label length, the pointer would skip to a well-formed end
+  CHECK(ask(dnsQuery(0x01, 1, "\xc0\x0c" + std::string(191, 'x') + dnsQuestion("", 1))).empty(),
+        "compression pointer over padding answered");
+  CHECK(ask(dnsQuery(0x01, 1, name + std::string("\0\0", 2))).empty(), "truncated question answered");
+  CHECK(ask(dnsQuery(0x01, 1, dnsQuestion(name, 1)) + std::string(FORMCAPTIVEDNS_PACKET_SIZE, '\0')).empty(),
+        "oversized packet answered");
+  CHECK(dns.getQueries() == answered, "dropped packets counted as answered");
+  CHECK(ask(dnsQuery(0x01, 1, dnsQuestion(name, 1))).size() == query.size() + 16, "no answer after the dropped packets");
+
+  close(fd);
+  dns.stop();
+}
+
+/** In captive-portal mode a connectivity check is redirected, never served the form */
+static void testCaptiveProbe() {
+  static WiFiServer portalServer(8082);
+  static FormBuilder portal;
+  static int builds = 0;
+  portal.begin(&portalServer);
+  portal.setFormBuilder([] { builds++; portal.addText("SSID", "home"); });
+  portal.enableCaptivePortal();
+
+  auto conn = portalServer.push("GET /generate_204 HTTP/1.1\r\nHost: connectivitycheck.gstatic.com\r\n\r\n");
+  portal.handleClient();
+  CHECK(conn->out.compare(0, 18, "HTTP/1.1 302 Found") == 0, "probe answered %.30s", conn->out.c_str());
+  CHECK(conn->out.find("\r\nLocation: http://192.168.4.1/\r\n") != std::string::npos, "probe not sent to the device");
+  CHECK(body(conn->out).empty() && builds == 0, "probe rendered the form");
+}
+
+/** Under a dispatcher the slot gauges report its slots, not the builder's one client */
+static void testDispatcherSlots() {
+  static WiFiServer shared(8080);
+  static FormBuilder network;
+  static FormDispatcher dispatcher;
+  network.addForm("/net", "Network", [] { network.addText("SSID", "home"); }, nullptr);
+  network.enableMetrics();
+  dispatcher.begin(&shared);
+  dispatcher.addBuilder(network);
+
+  // Accepted together; the scrape is served first, while the others wait in their slots
+  auto metrics = shared.push("GET /fb/metrics HTTP/1.1\r\n\r\n");
+  shared.push("GET /net HTTP/1.1\r\n\r\n");
+  shared.push("GET /net HTTP/1.1\r\n\r\n");
+  dispatcher.handleClient();
+  std::string text = body(metrics->out);
+  CHECK(text.find("\nformbuilder_connection_slots " + std::to_string(FORMDISPATCHER_MAX_SLOTS) + "\n") != std::string::npos,
+        "formbuilder_connection_slots is not FORMDISPATCHER_MAX_SLOTS");
+  CHECK(text.find("\nformbuilder_connection_slots_in_use 3\n") != std::string::npos,
+        "formbuilder_connection_slots_in_use is not 3");
+
+  auto again = shared.push("GET /fb/metrics HTTP/1.1\r\n\r\n");
+  dispatcher.handleClient();
+  CHECK(body(again->out).find("\nformbuilder_connection_slots_in_use 1\n") != std::string::npos,
+        "formbuilder_connection_slots_in_use is not 1 after the others closed");
+
+  // A client that sends its request slowly holds up only its own slot
+  int sv[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0) return;
+  auto received = [&] {
+    std::string data;
+    char buf[4096];
+    ssize_t n;
+    while ((n = recv(sv[1], buf, sizeof(buf), MSG_DONTWAIT)) > 0) data.append(buf, n);
+    return data;
+  };
+  std::string css = std::string("GET ") + FB_ASSET_CSS_PATH + " HTTP/1.1\r\nHost: esp32\r\n\r\n";
+  CHECK(send(sv[1], css.data(), 20, MSG_NOSIGNAL) == 20, "send failed");
+  shared.adopt(sv[0]);
+  auto fast = shared.push("GET /net HTTP/1.1\r\n\r\n");
+  unsigned long start = millis();
+  dispatcher.handleClient();
+  unsigned long took = millis() - start;
+  CHECK(took < FORMBUILDER_READ_TIMEOUT / 2, "handleClient() waited %lu ms for a partial request", took);
+  CHECK(fast->out.compare(0, 12, "HTTP/1.1 200") == 0, "request behind a partial one was not served");
+  CHECK(fast->noDelay, "TCP_NODELAY is not set on a dispatched connection");
+  CHECK(received().empty(), "partial request was answered");
+
+  CHECK(send(sv[1], css.data() + 20, css.size() - 20, MSG_NOSIGNAL) == (ssize_t)(css.size() - 20), "send failed");
+  dispatcher.handleClient();
+  CHECK(received().compare(0, 12, "HTTP/1.1 200") == 0, "completed partial request was not served");
+
+  // The kept-alive connection keeps its slot while free ones remain
+  auto other = shared.push("GET /net HTTP/1.1\r\n\r\n");
+  dispatcher.handleClient();
+  CHECK(other->out.compare(0, 12, "HTTP/1.1 200") == 0, "new connection was not served");
+  send(sv[1], css.data(), css.size(), MSG_NOSIGNAL);
+  dispatcher.handleClient();
+  CHECK(received().compare(0, 12, "HTTP/1.1 200") == 0, "kept-alive connection lost its slot to a new one");
+  close(sv[1]);
+  dispatcher.handleClient();
+  CHECK(dispatcher.getActiveSlots() == 0, "%u slots in use after every client closed", dispatcher.getActiveSlots());
+}
+
+int main(int argc, char** argv) {
+  updateGolden = argc > 1 && strcmp(argv[1], "--update") == 0;
+  form.begin(&server);
+  form.setTitle("Reference");
+  form.enableCompression();
+
+  testReferencePage();
+  testPartialWrites();
+  testLingerClose();
+  testFlushPoints();
+  testLargeForm();
+  testHiddenFields();
+#ifdef FORMBUILDER_ALLOC_STATS
+  testAllocBudget();
+#endif
+  testLoginGate();
+  testStaticFiles();
+  testAcceptEncoding();
+  testCaptiveDNS();
+  testCaptiveProbe();
+  testDispatcherSlots();
+  testDispatcherAssets();
+
+  removeStaticFiles();
+
+  if (failures) {
+    printf("%d check(s) failed\n", failures);
+    return 1;
+  }
+  printf("all checks passed\n");
+  return 0;
+}
@@ -0,0 +1,226 @@
+/**
+ * loadgen.cpp - Concurrent browsers against the host build or a device
+ *
+ * Each simulated browser loads the form page and then submits it, over
+ * and over, each request on a connection of its own as the page does.
+ * Reports throughput, p50/p95/p99 of time to first byte, full page and
+ * submit acknowledgement, and the error rate. Times run from connect()
+ * to the first and to the last response byte.
+ *
+ * Without --device the reference form is served in-process on 127.0.0.1
+ * through the mock core, and the server's own latency histograms are
+ * printed after the client-side numbers. Any of the link options puts the
+ * simulated link of netsim.h between the browsers and the server.
+ *
+ *   ./loadgen [--clients N] [--cycles N] [--gzip] [--device IP[:port]]
+ *             [--latency MS] [--rate KBIT] [--mss BYTES] [--no-delayed-ack]
+ */
+
+#include "FormBuilder.h"
+#include "netsim.h"
+#include "reference_form.h"
+#include <algorithm>
+#include <arpa/inet.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+typedef std::chrono::steady_clock Clock;
+
+static WiFiServer server(0);
+static FormBuilder form;
+static sockaddr_in target = {};
+static bool gzip = false;
+
+struct Sample {
+  double firstByte;      // ms from connect() to the first response byte
+  double total;          // ms from connect() to the end of the response
+  bool ok;
+};
+
+struct Results {
+  std::vector<double> firstByte, page, submit;
+  unsigned requests = 0;
+  unsigned errors = 0;
+
+  void add(const Sample& sample, std::vector<double>& totals) {
+    requests++;
+    if (!sample.ok) {
+      errors++;
+      return;
+    }
+    firstByte.push_back(sample.firstByte);
+    totals.push_back(sample.total);
+  }
+};
+
+static double millisSince(Clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+/**
+ * One GET on its own connection, read until the server closes it
+ * @param expect Text the response must contain, or nullptr
+ */
+static Sample fetch(const std::string& path, const char* expect) {
+  Sample sample = { 0, 0, false };
+  Clock::time_point start = Clock::now();
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  timeval timeout = { 5, 0 };
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  if (connect(fd, (sockaddr*)&target, sizeof(target)) != 0) {
+    close(fd);
+    return sample;
+  }
+
+  std::string request = "GET " + path + " HTTP/1.1\r\nHost: esp32\r\n" +
+                        (gzip ? "Accept-Encoding: gzip, deflate\r\n" : "") + "\r\n";
+  std::string response;
+  ssize_t n = send(fd, request.data(), request.size(), MSG_NOSIGNAL);
+  if (n == (ssize_t)request.size()) {
+    char buf[4096];
+    while ((n = recv(fd, buf, sizeof(buf), 0)) > 0) {
+      if (response.empty()) sample.firstByte = millisSince(start);
+      response.append(buf, n);
+    }
+  }
+  sample.total = millisSince(start);
+  close(fd);
+
+  sample.ok = n == 0 && response.compare(0, 12, "HTTP/1.1 200") == 0 &&
+              (!expect || response.find(expect) != std::string::npos);
+  return sample;
+}
+
+static void browser(int cycles, Results& results) {
+  for (int i = 0; i < cycles; i++) {
+    results.add(fetch("/", gzip ? nullptr : "</html>"), results.page);
+    results.add(fetch(REFERENCE_SUBMIT, nullptr), results.submit);
+  }
+}
+
+static double percentile(std::vector<double>& values, int pct) {
+  if (values.empty()) return 0;
+  std::sort(values.begin(), values.end());
+  size_t rank = (values.size() * pct + 99) / 100;
+  return values[rank ? rank - 1 : 0];
+}
+
+static void printRow(const char* name, std::vector<double>& values) {
+  printf("%-12s %9.2f %9.2f %9.2f %9.2f\n", name, percentile(values, 50), percentile(values, 95),
+         percentile(values, 99), percentile(values, 100));
+}
+
+static void printServerRow(const char* name, const FormHistogram& hist) {
+  printf("%-12s %9.2f %9.2f %9.2f %9.2f\n", name, hist.percentile(50) / 1000.0, hist.percentile(95) / 1000.0,
+         hist.percentile(99) / 1000.0, hist.maxMicros / 1000.0);
+}
+
+static bool parseDevice(const char* arg) {
+  std::string host = arg;
+  uint16_t port = 80;
+  size_t colon = host.find(':');
+  if (colon != std::string::npos) {
+    port = atoi(host.c_str() + colon + 1);
+    host.resize(colon);
+  }
+  target.sin_family = AF_INET;
+  target.sin_port = htons(port);
+  return inet_pton(AF_INET, host.c_str(), &target.sin_addr) == 1;
+}
+
+int main(int argc, char** argv) {
+  int clients = 4;
+  int cycles = 50;
+  const char* device = nullptr;
+  NetProfile profile;
+  bool simulate = false;
+  for (int i = 1; i < argc; i++) {
+    if (profile.parseOption(i, argc, argv)) simulate = true;
+    else if (strcmp(argv[i], "--clients") == 0 && i + 1 < argc) clients = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--cycles") == 0 && i + 1 < argc) cycles = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--device") == 0 && i + 1 < argc) device = argv[++i];
+    else if (strcmp(argv[i], "--gzip") == 0) gzip = true;
+    else {
+      printf("usage: %s [--clients N] [--cycles N] [--gzip] [--device IP[:port]]"
+             " [--latency MS] [--rate KBIT] [--mss BYTES] [--no-delayed-ack]\n", argv[0]);
+      return 2;
+    }
+  }
+
+  // The host build serves from a thread of its own, like loop() on the device
+  std::atomic<bool> serving(true);
+  std::thread serverThread;
+  if (device) {
+    if (!parseDevice(device)) {
+      printf("bad device address %s\n", device);
+      return 2;
+    }
+  } else {
+    uint16_t port = server.listen();
+    if (!port) {
+      perror("listen");
+      return 1;
+    }
+    parseDevice(("127.0.0.1:" + std::to_string(port)).c_str());
+    form.begin(&server);
+    form.setTitle("Reference");
+    form.setFormBuilder([] { addReferenceFields(form); });
+    form.enableCompression();
+    serverThread = std::thread([&] {
+      while (serving) {
+        form.handleClient();
+        std::this_thread::yield();
+      }
+    });
+  }
+
+  NetSim link(profile, target);
+  if (simulate) {
+    uint16_t port = link.start();
+    if (!port) {
+      perror("link");
+      return 1;
+    }
+    parseDevice(("127.0.0.1:" + std::to_string(port)).c_str());
+    profile.print();
+  }
+
+  std::vector<Results> results(clients);
+  std::vector<std::thread> browsers;
+  Clock::time_point start = Clock::now();
+  for (int i = 0; i < clients; i++) browsers.emplace_back(browser, cycles, std::ref(results[i]));
+  for (std::thread& t : browsers) t.join();
+  double seconds = millisSince(start) / 1000;
+
+  Results all;
+  for (Results& r : results) {
+    all.firstByte.insert(all.firstByte.end(), r.firstByte.begin(), r.firstByte.end());
+    all.page.insert(all.page.end(), r.page.begin(), r.page.end());
+    all.submit.insert(all.submit.end(), r.submit.begin(), r.submit.end());
+    all.requests += r.requests;
+    all.errors += r.errors;
+  }
+
+  printf("%d clients x %d cycles against %s: %u requests in %.2f s, %.1f requests/s, %.1f page loads/s\n",
+         clients, cycles, device ? device : "the host build", all.requests, seconds,
+         all.requests / seconds, all.page.size() / seconds);
+  printf("errors %u (%.1f%%)\n", all.errors, all.requests ? 100.0 * all.errors / all.requests : 0);
+  printf("%-12s %9s %9s %9s %9s   (ms)\n", "", "p50", "p95", "p99", "max");
+  printRow("first byte", all.firstByte);
+  printRow("page", all.page);
+  printRow("submit", all.submit);
+
+  if (!device) {
+    serving = false;
+    serverThread.join();
+    const FormLatencyStats& lat = form.getLatencyStats();
+    printf("server side, from accept(), bucket upper bounds: %u requests, %u errors\n",
+           (unsigned)lat.requests, (unsigned)lat.errors);
+    printServerRow("first byte", lat.firstByte);
+    printServerRow("page", lat.page);
+    printServerRow("submit", lat.submit);
+  }
+  return all.errors ? 1 : 0;
+}
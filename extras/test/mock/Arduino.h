@@ -0,0 +1,107 @@
+#pragma once
+// Host stand-in for the parts of the Arduino core FormBuilder uses; String wraps std::string
+#include <string>
+#include <cstring>
+#include <cstdlib>
+#include <cstdint>
+#include <cstdio>
+#include <cstddef>
+typedef uint8_t byte;
+#define PROGMEM
+#define HEX 16
+#define DEC 10
+#define F(x) (x)
+unsigned long millis(); unsigned long micros(); void yield(); void delay(unsigned long);
+class String {
+public:
+  std::string s;
+  String() {}
+  String(const char* c) : s(c ? c : "") {}
+  String(const std::string& x) : s(x) {}
+  String(char c) : s(1, c) {}
+  String(int v, unsigned char base = 10) { char b[40]; if (base == 16) snprintf(b, 40, "%x", v); else snprintf(b, 40, "%d", v); s = b; }
+  String(unsigned int v, unsigned char base = 10) { char b[40]; snprintf(b, 40, base==16?"%x":"%u", v); s = b; }
+  String(long v, unsigned char base = 10) : String((int)v, base) {}
+  String(unsigned long v, unsigned char base = 10) : String((unsigned)v, base) {}
+  String(double v, unsigned int dp = 2) { char b[40]; snprintf(b, 40, "%.*f", dp, v); s = b; }
+  unsigned int length() const { return s.size(); }
+  const char* c_str() const { return s.c_str(); }
+  char charAt(unsigned int i) const { return i < s.size() ? s[i] : 0; }
+  char operator[](unsigned int i) const { return charAt(i); }
+  int indexOf(char c, int from = 0) const { auto p = s.find(c, from < 0 ? 0 : from); return p == std::string::npos ? -1 : (int)p; }
+  int indexOf(const String& c, int from = 0) const { auto p = s.find(c.s, from < 0 ? 0 : from); return p == std::string::npos ? -1 : (int)p; }
+  int lastIndexOf(char c) const { auto p = s.rfind(c); return p == std::string::npos ? -1 : (int)p; }
+  int lastIndexOf(const String& c, unsigned int from) const { auto p = s.rfind(c.s, from); return p == std::string::npos ? -1 : (int)p; }
+  String substring(unsigned int a) const { return a >= s.size() ? String() : String(s.substr(a)); }
+  String substring(unsigned int a, unsigned int b) const { if (a > b) std::swap(a, b); if (a >= s.size()) return String(); return String(s.substr(a, b - a)); }
+  bool startsWith(const String& p) const { return s.compare(0, p.s.size(), p.s) == 0; }
+  bool endsWith(const String& p) const { return s.size() >= p.s.size() && s.compare(s.size() - p.s.size(), p.s.size(), p.s) == 0; }
+  bool equalsIgnoreCase(const String& o) const { return strcasecmp(s.c_str(), o.s.c_str()) == 0; }
+  void trim() { size_t a = s.find_first_not_of(" \t\r\n"); if (a == std::string::npos) { s.clear(); return; } size_t b = s.find_last_not_of(" \t\r\n"); s = s.substr(a, b - a + 1); }
+  void toUpperCase() { for (auto& c : s) c = toupper(c); }
+  void toLowerCase() { for (auto& c : s) c = tolower(c); }
+  long toInt() const { return atol(s.c_str()); }
+  bool reserve(unsigned int n) { s.reserve(n); return true; }
+  bool concat(const char* c, unsigned int n) { s.append(c, n); return true; }
+  bool concat(char c) { s += c; return true; }
+  bool concat(const String& c) { s += c.s; return true; }
+  String& operator+=(const String& o) { s += o.s; return *this; }
+  String& operator+=(const char* o) { s += o; return *this; }
+  String& operator+=(char o) { s += o; return *this; }
+  String& operator+=(int o) { s += std::to_string(o); return *this; }
+  String& operator+=(unsigned long o) { s += std::to_string(o); return *this; }
+  bool operator==(const String& o) const { return s == o.s; }
+  bool operator==(const char* o) const { return s == o; }
+  bool operator!=(const String& o) const { return s != o.s; }
+  bool operator!=(const char* o) const { return s != o; }
+  void remove(unsigned int i, unsigned int n) { s.erase(i, n); }
+  void replace(const String& a, const String& b) { size_t p = 0; while ((p = s.find(a.s, p)) != std::string::npos) { s.replace(p, a.s.size(), b.s); p += b.s.size(); } }
+};
+inline String operator+(const String& a, const String& b) { return String(a.s + b.s); }
+inline String operator+(const String& a, const char* b) { return String(a.s + b); }
+inline String operator+(const char* a, const String& b) { return String(a + b.s); }
+inline String operator+(const String& a, char b) { return String(a.s + b); }
+class Print {
+public:
+  virtual ~Print() {}
+  virtual size_t write(uint8_t c) = 0;
+  virtual size_t write(const uint8_t* b, size_t n) { size_t r = 0; while (n--) r += write(*b++); return r; }
+  size_t write(const char* s) { return write((const uint8_t*)s, strlen(s)); }
+  size_t write(const char* s, size_t n) { return write((const uint8_t*)s, n); }
+  size_t print(const String& s) { return write((const uint8_t*)s.c_str(), s.length()); }
+  size_t print(const char* s) { return write(s); }
+  size_t print(char c) { return write((uint8_t)c); }
+  size_t print(int v) { return print(String(v)); }
+  size_t print(unsigned int v) { return print(String(v)); }
+  size_t print(long v) { return print(String(v)); }
+  size_t print(unsigned long v) { return print(String(v)); }
+  size_t print(double v, int d = 2) { return print(String(v, d)); }
+  size_t println() { return write("\r\n"); }
+  template <typename T> size_t println(const T& v) { size_t n = print(v); return n + println(); }
+  size_t printf(const char* fmt, ...) __attribute__((format(printf, 2, 3)));
+  virtual void flush() {}
+};
+class Stream : public Print {
+public:
+  virtual int available() = 0; virtual int read() = 0; virtual int peek() = 0;
+  String readStringUntil(char t) { String r; int c; while ((c = read()) >= 0 && c != t) r += (char)c; return r; }
+  size_t readBytesUntil(char t, char* b, size_t n) { size_t i = 0; int c; while (i < n && (c = read()) >= 0 && c != t) b[i++] = c; return i; }
+  size_t readBytes(char* b, size_t n) { size_t i = 0; int c; while (i < n && (c = read()) >= 0) b[i++] = c; return i; }
+  int read(uint8_t* b, size_t n) { return readBytes((char*)b, n); }
+  void setTimeout(unsigned long) {}
+};
+class IPAddress { public: uint8_t b[4] = {0,0,0,0}; IPAddress() {} IPAddress(uint8_t a, uint8_t c, uint8_t d, uint8_t e) { b[0]=a;b[1]=c;b[2]=d;b[3]=e; } IPAddress(uint32_t v) { memcpy(b, &v, 4); } uint8_t operator[](int i) const { return b[i]; } operator uint32_t() const { uint32_t v; memcpy(&v, b, 4); return v; } String toString() const { char s[16]; snprintf(s,16,"%u.%u.%u.%u",b[0],b[1],b[2],b[3]); return String(s);} };
+class Client : public Stream {
+public:
+  virtual int connect(IPAddress, uint16_t) = 0; virtual int connect(const char*, uint16_t) = 0;
+  virtual uint8_t connected() = 0; virtual void stop() = 0; virtual operator bool() = 0;
+  virtual int read(uint8_t* b, size_t n) { return Stream::read(b, n); } using Stream::read;
+  using Print::write;
+};
+class HardwareSerial : public Stream { public: size_t write(uint8_t) override { return 1; } int available() override { return 0; } int read() override { return -1; } int peek() override { return -1; } void begin(int) {} };
+extern HardwareSerial Serial;
+struct EspClass { uint32_t getFreeHeap(); uint32_t getMinFreeHeap(); uint32_t getMaxAllocHeap(); uint32_t getCycleCount(); };
+extern EspClass ESP;
+uint32_t getCpuFrequencyMhz();
+uint32_t esp_random();
+void esp_fill_random(void*, size_t);
@@ -0,0 +1,29 @@
+#pragma once
+#include "Arduino.h"
+#include <cstdio>
+#include <memory>
+#include <sys/stat.h>
+// Host stand-in for the Arduino FS API, backed by a real directory
+#define FILE_READ "r"
+namespace fs {
+class File {
+  std::shared_ptr<FILE> f; size_t sz = 0; time_t mt = 0; bool dir = false;
+public:
+  File() {}
+  File(const std::string& p) { struct stat st; if (stat(p.c_str(), &st) != 0) return; dir = S_ISDIR(st.st_mode); sz = st.st_size; mt = st.st_mtime; if (!dir) f.reset(fopen(p.c_str(), "rb"), [](FILE* x) { if (x) fclose(x); }); }
+  explicit operator bool() const { return (bool)f || dir; }
+  size_t size() const { return sz; } time_t getLastWrite() { return mt; } bool isDirectory() { return dir; }
+  int read(uint8_t* b, size_t n) { return f ? (int)fread(b, 1, n, f.get()) : -1; }
+  void close() { f.reset(); }
+};
+class FS {
+  std::string base;
+public:
+  FS(const std::string& b) : base(b) {}
+  File open(const char* path, const char* mode = FILE_READ) { return File(base + path); }
+  File open(const String& path, const char* mode = FILE_READ) { return open(path.c_str(), mode); }
+  bool exists(const char* path) { struct stat st; return stat((base + path).c_str(), &st) == 0; }
+  bool exists(const String& path) { return exists(path.c_str()); }
+};
+}
+using fs::FS; using fs::File;
@@ -0,0 +1,97 @@
+#pragma once
+#include "Arduino.h"
+#include <memory>
+#include <vector>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// One connection. In memory by default: the request the test queued and the
+// bytes the library wrote back. With a socket in fd, reads and writes go to
+// the socket instead, as they would through lwIP.
+struct MockConn {
+  std::string in;
+  size_t pos = 0;
+  std::string out;
+  bool open = true;
+  std::vector<size_t> writes;    // in memory: the length of out after each write
+  int fd = -1;
+  bool noDelay = false;
+};
+
+class WiFiClient : public Client {
+public:
+  std::shared_ptr<MockConn> c;
+  WiFiClient() {}
+  explicit WiFiClient(std::shared_ptr<MockConn> conn) : c(conn) {}
+  int connect(IPAddress, uint16_t) override { return 0; }
+  int connect(const char*, uint16_t) override { return 0; }
+  size_t write(uint8_t b) override { return write(&b, 1); }
+  size_t write(const uint8_t* b, size_t n) override {
+    if (!c || !c->open) return 0;
+    if (c->fd < 0) {
+      c->out.append((const char*)b, n);
+      c->writes.push_back(c->out.size());
+      return n;
+    }
+    // Like lwIP, block until the stack has taken all of it or the peer is gone
+    size_t sent = 0;
+    while (sent < n) {
+      ssize_t r = send(c->fd, b + sent, n - sent, MSG_NOSIGNAL);
+      if (r > 0) { sent += r; continue; }
+      pollfd p = { c->fd, POLLOUT, 0 };
+      if (r < 0 && (errno == EAGAIN || errno == EINTR) && poll(&p, 1, 1000) > 0) continue;
+      break;
+    }
+    return sent;
+  }
+  using Print::write;
+  int available() override {
+    if (!c || !c->open) return 0;
+    if (c->fd < 0) return c->in.size() - c->pos;
+    int n = 0;
+    return ioctl(c->fd, FIONREAD, &n) == 0 ? n : 0;
+  }
+  int read() override { uint8_t b; return read(&b, 1) == 1 ? b : -1; }
+  int read(uint8_t* b, size_t n) override {
+    if (c && c->open && c->fd >= 0) { ssize_t r = recv(c->fd, b, n, MSG_DONTWAIT); return r > 0 ? (int)r : -1; }
+    size_t i = 0;
+    while (i < n && available()) b[i++] = c->in[c->pos++];
+    return i;
+  }
+  int peek() override {
+    if (c && c->open && c->fd >= 0) { uint8_t b; return recv(c->fd, &b, 1, MSG_PEEK | MSG_DONTWAIT) == 1 ? b : -1; }
+    return available() ? (uint8_t)c->in[c->pos] : -1;
+  }
+  void flush() override {}
+  void stop() override {
+    if (c && c->open && c->fd >= 0) close(c->fd);
+    if (c) c->open = false;
+    c.reset();
+  }
+  // In memory, the peer is gone once its request has been read; a socket is
+  // connected until the peer closes it
+  uint8_t connected() override {
+    if (!c || !c->open) return false;
+    if (c->fd < 0) return c->pos < c->in.size();
+    char b;
+    ssize_t r = recv(c->fd, &b, 1, MSG_PEEK | MSG_DONTWAIT);
+    return r > 0 || (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK));
+  }
+  operator bool() override { return (bool)c; }
+  int fd() const { return c && c->open ? c->fd : -1; }
+  int setNoDelay(bool enable) {
+    if (!c) return -1;
+    c->noDelay = enable;
+    int value = enable;
+    return c->fd >= 0 ? setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &value, sizeof(value)) : 0;
+  }
+  bool getNoDelay() { return c && c->noDelay; }
+  IPAddress remoteIP() const { return IPAddress(192, 168, 4, 2); }
+  uint16_t remotePort() const { return 5555; }
+  IPAddress localIP() const { return IPAddress(192, 168, 4, 1); }
+};
@@ -0,0 +1,50 @@
+#pragma once
+#include "WiFiClient.h"
+#include <deque>
+
+// Connections are queued by the test with push() or adopt() and accepted by
+// the library. After listen(), real TCP connections on 127.0.0.1 are
+// accepted too, for the load generator.
+class WiFiServer {
+public:
+  std::deque<std::shared_ptr<MockConn>> pending;
+  WiFiServer(uint16_t port = 80) : _port(port) {}
+  ~WiFiServer() { if (_listenFd >= 0) close(_listenFd); }
+  void begin() {}
+  void stop() {}
+  void setNoDelay(bool) {}
+  bool hasClient() {
+    if (pending.empty() && _listenFd >= 0) {
+      int fd = ::accept(_listenFd, nullptr, nullptr);
+      if (fd >= 0) adopt(fd);
+    }
+    return !pending.empty();
+  }
+  WiFiClient accept() { if (!hasClient()) return WiFiClient(); auto c = pending.front(); pending.pop_front(); return WiFiClient(c); }
+  WiFiClient available() { return accept(); }
+  std::shared_ptr<MockConn> push(const std::string& request) { auto c = std::make_shared<MockConn>(); c->in = request; pending.push_back(c); return c; }
+  // A connected socket, e.g. one end of a socketpair(); the test keeps the other end
+  std::shared_ptr<MockConn> adopt(int fd) { auto c = std::make_shared<MockConn>(); c->fd = fd; pending.push_back(c); return c; }
+  // Listen on 127.0.0.1 at the constructor's port, or any free port for 0
+  // @return The port listened on, 0 on failure
+  uint16_t listen() {
+    _listenFd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    int one = 1;
+    setsockopt(_listenFd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(_port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t length = sizeof(addr);
+    if (bind(_listenFd, (sockaddr*)&addr, sizeof(addr)) != 0 || ::listen(_listenFd, 16) != 0 ||
+        getsockname(_listenFd, (sockaddr*)&addr, &length) != 0) {
+      close(_listenFd);
+      _listenFd = -1;
+      return 0;
+    }
+    return _port = ntohs(addr.sin_port);
+  }
+private:
+  uint16_t _port;
+  int _listenFd = -1;
+};
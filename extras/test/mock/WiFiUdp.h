@@ -0,0 +1,70 @@
+#pragma once
+#include "Arduino.h"
+#include <errno.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// UDP over a real non-blocking socket on 127.0.0.1, so a test can talk to
+// the library with its own socket. Like the ESP32 core, a received datagram
+// is read from a buffer of one frame; parsePacket() reports its full length.
+class WiFiUDP : public Stream {
+public:
+  ~WiFiUDP() { stop(); }
+  uint8_t begin(uint16_t port) {
+    stop();
+    _fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (_fd < 0 || bind(_fd, (sockaddr*)&addr, sizeof(addr)) != 0) {
+      stop();
+      return 0;
+    }
+    return 1;
+  }
+  void stop() {
+    if (_fd >= 0) close(_fd);
+    _fd = -1;
+  }
+  int parsePacket() {
+    _rxLength = _rxPos = 0;
+    if (_fd < 0) return 0;
+    socklen_t length = sizeof(_from);
+    ssize_t n = recvfrom(_fd, _rx, sizeof(_rx), MSG_TRUNC, (sockaddr*)&_from, &length);
+    if (n <= 0) return 0;
+    _rxLength = n < (ssize_t)sizeof(_rx) ? n : sizeof(_rx);
+    return n;
+  }
+  int available() override { return _rxLength - _rxPos; }
+  int read() override { return _rxPos < _rxLength ? _rx[_rxPos++] : -1; }
+  int read(uint8_t* b, size_t n) {
+    size_t i = 0;
+    while (i < n && _rxPos < _rxLength) b[i++] = _rx[_rxPos++];
+    return i;
+  }
+  int peek() override { return _rxPos < _rxLength ? _rx[_rxPos] : -1; }
+  IPAddress remoteIP() const { return IPAddress((uint32_t)_from.sin_addr.s_addr); }
+  uint16_t remotePort() const { return ntohs(_from.sin_port); }
+  int beginPacket(IPAddress ip, uint16_t port) {
+    _tx.clear();
+    _to = {};
+    _to.sin_family = AF_INET;
+    _to.sin_port = htons(port);
+    _to.sin_addr.s_addr = (uint32_t)ip;
+    return _fd >= 0;
+  }
+  size_t write(uint8_t b) override { return write(&b, 1); }
+  size_t write(const uint8_t* b, size_t n) override { _tx.append((const char*)b, n); return n; }
+  using Print::write;
+  int endPacket() { return sendto(_fd, _tx.data(), _tx.size(), 0, (sockaddr*)&_to, sizeof(_to)) == (ssize_t)_tx.size(); }
+private:
+  int _fd = -1;
+  uint8_t _rx[1460];
+  int _rxLength = 0;
+  int _rxPos = 0;
+  sockaddr_in _from = {};
+  sockaddr_in _to = {};
+  std::string _tx;
+};
@@ -0,0 +1,10 @@
+#pragma once
+#include "version.h"
+
+// The mbedTLS 2.x SHA-256 API the library uses, implemented in sha256.cpp
+typedef struct { uint32_t state[8]; uint64_t total; unsigned char buffer[64]; } mbedtls_sha256_context;
+void mbedtls_sha256_init(mbedtls_sha256_context* ctx);
+void mbedtls_sha256_free(mbedtls_sha256_context* ctx);
+int mbedtls_sha256_starts_ret(mbedtls_sha256_context* ctx, int is224);
+int mbedtls_sha256_update_ret(mbedtls_sha256_context* ctx, const unsigned char* input, size_t length);
+int mbedtls_sha256_finish_ret(mbedtls_sha256_context* ctx, unsigned char output[32]);
@@ -0,0 +1,4 @@
+#pragma once
+#define MBEDTLS_VERSION_MAJOR 2
+#include <stddef.h>
+#include <stdint.h>
@@ -0,0 +1,49 @@
+// Host implementations behind the mock Arduino and ESP headers
+#include "Arduino.h"
+#include <chrono>
+#include <cstdarg>
+#include <new>
+#include <thread>
+
+HardwareSerial Serial;
+EspClass ESP;
+
+unsigned long micros() {
+  using namespace std::chrono;
+  return duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+}
+unsigned long millis() { return micros() / 1000; }
+void yield() {}
+void delay(unsigned long ms) { std::this_thread::sleep_for(std::chrono::milliseconds(ms)); }
+
+uint32_t EspClass::getFreeHeap() { return 200000; }
+uint32_t EspClass::getMinFreeHeap() { return 150000; }
+uint32_t EspClass::getMaxAllocHeap() { return 100000; }
+uint32_t EspClass::getCycleCount() { return micros() * 240; }
+uint32_t getCpuFrequencyMhz() { return 240; }
+uint32_t esp_random() { return rand(); }
+void esp_fill_random(void* buf, size_t len) { for (size_t i = 0; i < len; i++) ((uint8_t*)buf)[i] = rand(); }
+
+size_t Print::printf(const char* fmt, ...) {
+  char buf[512];
+  va_list args;
+  va_start(args, fmt);
+  int n = vsnprintf(buf, sizeof(buf), fmt, args);
+  va_end(args);
+  if (n < 0) return 0;
+  return write((const uint8_t*)buf, (size_t)n < sizeof(buf) ? n : sizeof(buf) - 1);
+}
+
+#ifdef FORMBUILDER_ALLOC_STATS
+// String is a std::string here, which allocates inside libstdc++ where
+// --wrap=malloc does not reach; route it through malloc() in this file
+void* operator new(size_t size) {
+  if (void* p = malloc(size)) return p;
+  throw std::bad_alloc();
+}
+void* operator new[](size_t size) { return operator new(size); }
+void operator delete(void* p) noexcept { free(p); }
+void operator delete[](void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+void operator delete[](void* p, size_t) noexcept { free(p); }
+#endif
@@ -0,0 +1,220 @@
+/**
+ * netsim.h - TCP proxy that makes loopback behave like a busy access point
+ *
+ * Sits between the browsers of loadgen or tti and the server, and passes
+ * each connection through a simulated link in both directions:
+ *
+ * - latency: one-way delay added to every segment
+ * - rate: link bandwidth, shared by all connections in each direction
+ * - mss: data is cut into segments of at most this size, each written
+ *   on its own, so the peer reads a response in segment-sized pieces
+ * - delayed ACK: the proxy acknowledges the server's segments lazily, as
+ *   a phone's stack does, so a server whose writes wait for an ACK
+ *   (Nagle) stalls the way it does on a real link
+ *
+ * Runs on a thread of its own; start() returns the port to connect to.
+ */
+
+#pragma once
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct NetProfile {
+  unsigned latencyMs = 20;     // one-way, each direction
+  unsigned rateKbps = 2000;    // 0 for no limit
+  unsigned mss = 1460;
+  bool delayedAck = true;
+
+  /** Take a --latency, --rate, --mss or --no-delayed-ack option at argv[i] */
+  bool parseOption(int& i, int argc, char** argv) {
+    if (strcmp(argv[i], "--no-delayed-ack") == 0) { delayedAck = false; return true; }
+    if (i + 1 >= argc) return false;
+    if (strcmp(argv[i], "--latency") == 0) latencyMs = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--rate") == 0) rateKbps = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--mss") == 0) mss = std::max(1, atoi(argv[++i]));
+    else return false;
+    return true;
+  }
+
+  void print() const {
+    printf("link: %u ms one way, %u kbit/s, %u-byte segments, %s ACKs\n",
+           latencyMs, rateKbps, mss, delayedAck ? "delayed" : "immediate");
+  }
+};
+
+class NetSim {
+public:
+  NetSim(const NetProfile& profile, const sockaddr_in& target) : _profile(profile), _target(target) {}
+  ~NetSim() { stop(); }
+
+  /** Listen on 127.0.0.1 and start forwarding; returns the port, 0 on failure */
+  uint16_t start() {
+    _listenFd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t length = sizeof(addr);
+    if (bind(_listenFd, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(_listenFd, 16) != 0 ||
+        getsockname(_listenFd, (sockaddr*)&addr, &length) != 0) {
+      return 0;
+    }
+    _linkFree[0] = _linkFree[1] = Clock::now();
+    _running = true;
+    _thread = std::thread([this] { run(); });
+    return ntohs(addr.sin_port);
+  }
+
+  void stop() {
+    if (!_running.exchange(false)) return;
+    _thread.join();
+    for (auto& conn : _connections) {
+      close(conn->pipes[0].from);
+      close(conn->pipes[1].from);
+    }
+    _connections.clear();
+    close(_listenFd);
+  }
+
+private:
+  typedef std::chrono::steady_clock Clock;
+
+  // Data due at the far end at a given time; empty data carries the FIN
+  struct Segment {
+    Clock::time_point due;
+    std::string data;
+  };
+
+  // One direction of a connection: pipes[0] client to server, pipes[1] back
+  struct Pipe {
+    int from, to;
+    std::deque<Segment> queue;
+    bool readDone = false;
+    bool writeDone = false;
+  };
+
+  struct Connection {
+    Pipe pipes[2];
+  };
+
+  NetProfile _profile;
+  sockaddr_in _target;
+  int _listenFd = -1;
+  std::atomic<bool> _running{false};
+  std::thread _thread;
+  std::vector<std::unique_ptr<Connection>> _connections;
+  Clock::time_point _linkFree[2];    // when each direction of the link is idle again
+
+  void acceptConnection() {
+    int client = accept(_listenFd, nullptr, nullptr);
+    if (client < 0) return;
+    int server = socket(AF_INET, SOCK_STREAM, 0);
+    if (connect(server, (sockaddr*)&_target, sizeof(_target)) != 0) {
+      close(client);
+      close(server);
+      return;
+    }
+    // Segments are cut here, so the kernel must not join them again
+    int one = 1;
+    setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    setsockopt(server, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    auto conn = std::unique_ptr<Connection>(new Connection);
+    conn->pipes[0].from = client;
+    conn->pipes[0].to = server;
+    conn->pipes[1].from = server;
+    conn->pipes[1].to = client;
+    _connections.push_back(std::move(conn));
+  }
+
+  /** Queue data read from one side behind what the link is already carrying */
+  void schedule(int direction, Pipe& pipe, const char* data, size_t length) {
+    Clock::time_point now = Clock::now();
+    size_t at = 0;
+    do {
+      size_t n = std::min<size_t>(length - at, _profile.mss);
+      Clock::time_point& linkFree = _linkFree[direction];
+      if (linkFree < now) linkFree = now;
+      if (_profile.rateKbps) linkFree += std::chrono::microseconds(n * 8000 / _profile.rateKbps);
+      pipe.queue.push_back({ linkFree + std::chrono::milliseconds(_profile.latencyMs), std::string(data + at, n) });
+      at += n;
+    } while (at < length);
+  }
+
+  void readPipe(int direction, Pipe& pipe) {
+    char buf[16384];
+    ssize_t n = recv(pipe.from, buf, sizeof(buf), MSG_DONTWAIT);
+    if (n < 0 && (errno == EAGAIN || errno == EINTR)) return;
+    if (n <= 0) {
+      pipe.readDone = true;
+      schedule(direction, pipe, "", 0);
+      return;
+    }
+    // Linux leaves quick-ACK mode on its own; put it back into delayed mode after each read
+    if (direction == 1 && _profile.delayedAck) {
+      int zero = 0;
+      setsockopt(pipe.from, IPPROTO_TCP, TCP_QUICKACK, &zero, sizeof(zero));
+    }
+    schedule(direction, pipe, buf, n);
+  }
+
+  void deliver(Pipe& pipe, Clock::time_point now) {
+    while (!pipe.writeDone && !pipe.queue.empty() && pipe.queue.front().due <= now) {
+      const std::string& data = pipe.queue.front().data;
+      if (data.empty() || send(pipe.to, data.data(), data.size(), MSG_NOSIGNAL) != (ssize_t)data.size()) {
+        shutdown(pipe.to, SHUT_WR);
+        pipe.writeDone = true;
+      }
+      pipe.queue.pop_front();
+    }
+  }
+
+  void run() {
+    while (_running) {
+      std::vector<pollfd> fds = { { _listenFd, POLLIN, 0 } };
+      Clock::time_point now = Clock::now();
+      Clock::time_point next = now + std::chrono::milliseconds(10);
+      for (auto& conn : _connections) {
+        for (Pipe& pipe : conn->pipes) {
+          if (!pipe.readDone) fds.push_back({ pipe.from, POLLIN, 0 });
+          if (!pipe.queue.empty() && pipe.queue.front().due < next) next = pipe.queue.front().due;
+        }
+      }
+      int wait = std::chrono::duration_cast<std::chrono::milliseconds>(next - now).count();
+      poll(fds.data(), fds.size(), wait > 0 ? wait : 0);
+
+      if (fds[0].revents & POLLIN) acceptConnection();
+      now = Clock::now();
+      for (size_t i = 0; i < _connections.size(); i++) {
+        Connection& conn = *_connections[i];
+        for (int direction = 0; direction < 2; direction++) {
+          Pipe& pipe = conn.pipes[direction];
+          if (!pipe.readDone) {
+            for (const pollfd& p : fds) {
+              if (p.fd == pipe.from && p.revents) readPipe(direction, pipe);
+            }
+          }
+          deliver(pipe, now);
+        }
+        if (conn.pipes[0].writeDone && conn.pipes[1].writeDone) {
+          close(conn.pipes[0].from);
+          close(conn.pipes[1].from);
+          _connections.erase(_connections.begin() + i--);
+        }
+      }
+    }
+  }
+};
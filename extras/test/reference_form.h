@@ -0,0 +1,30 @@
+/**
+ * reference_form.h - The reference form of the README's Page Size table
+ *
+ * One field of each type. Shared by host_test and the load generator so
+ * the golden page and the measured page are the same.
+ */
+
+#pragma once
+#include "FormBuilder.h"
+
+static void addReferenceFields(FormBuilder& form) {
+  form.addSubheading("Network");
+  form.addText("Name", "dev");
+  form.addPassword("Pass", "pw");
+  form.addDropDown("Mode", "Station,AP", 1, true);
+  form.addDropDownRange("Hour", 0, 23, 5);
+  form.addColorPicker("Color", 0x2563EB);
+  form.addNumber("Num", 0, 10, 1, 3);
+  form.addRange("Bright", 0, 100, 1, 75);
+  form.addTime("Off", 2300);
+  form.addCheckbox("Sleep", true);
+  form.addRadio("Radio", "A,B,C", 2);
+  form.addBitmask("Days", "Mon,Tue,Wed,Thu,Fri,Sat,Sun", 0x1f);
+  form.addHidden("0");
+}
+
+// A submit of the reference form as its page script sends it
+#define REFERENCE_SUBMIT "/ajax_inputs?x1=dev__SEP__x2=pw__SEP__x3=Station__SEP__x4=7__SEP__x5=%23ff0000" \
+                         "__SEP__x6=4__SEP__x7=50__SEP__x8=0630__SEP__x9=false__SEP__x10=1__SEP__x11=3"  \
+                         "__SEP__x12=0&nocache=0.5"
@@ -0,0 +1,298 @@
+/**
+ * tti.cpp - Time to interactive of the form page over a simulated link
+ *
+ * Loads the reference form like a browser through the proxy in netsim.h:
+ * the page, then the stylesheet and script it links, if any. The page is
+ * interactive once all of them have arrived. Each server configuration
+ * is loaded several times and the medians printed: time to first byte,
+ * to the end of the document head (first paint), to the end of the page,
+ * and to interactive, all from connect(). Rows with Nagle turned back on
+ * (setNoDelay(false)) and with flush points show what each costs or saves.
+ *
+ * Without --device the configurations are served in-process from the
+ * host build; with it, the board's page is loaded plain and gzipped.
+ *
+ *   ./tti [--runs N] [--latency MS] [--rate KBIT] [--mss BYTES]
+ *         [--no-delayed-ack] [--device IP[:port]]
+ */
+
+#include "FormBuilder.h"
+#include "FormDispatcher.h"
+#include "netsim.h"
+#include "reference_form.h"
+#include <mutex>
+#include <zlib.h>
+
+typedef std::chrono::steady_clock Clock;
+
+static WiFiServer pageServer(0), sharedServer(0);
+static FormBuilder standalone, dispatched;
+static FormDispatcher dispatcher;
+static uint16_t proxyPort;
+static std::mutex serving;    // held by the server thread while it serves
+
+/** One way the page can be served and loaded */
+struct Config {
+  const char* name;
+  bool dispatched;     // through the FormDispatcher, with Content-Length and keep-alive
+  bool gzip;           // the browser accepts gzip
+  bool cached;         // the browser already holds the linked stylesheet and script
+  bool nagle;          // setNoDelay(false)
+  uint8_t flushPoints;
+};
+
+static const Config CONFIGS[] = {
+  { "plain", false, false, false, false, 0 },
+  { "plain, Nagle on", false, false, false, true, 0 },
+  { "plain, FB_FLUSH_HEADERS", false, false, false, false, FB_FLUSH_HEADERS },
+  { "plain, FB_FLUSH_HEAD", false, false, false, false, FB_FLUSH_HEAD },
+  { "gzip", false, true, false, false, 0 },
+  { "dispatcher, keep-alive, cold cache", true, false, false, false, 0 },
+  { "dispatcher, keep-alive, Nagle on", true, false, false, true, 0 },
+  { "dispatcher, keep-alive, warm cache", true, false, true, false, 0 },
+};
+
+struct Load {
+  double firstByte = 0;
+  double headEnd = 0;
+  double pageEnd = 0;
+  double interactive = 0;
+  size_t bytes = 0;
+  bool ok = false;
+};
+
+static double millisSince(Clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+static int connectProxy() {
+  sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(proxyPort);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  timeval timeout = { 10, 0 };
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  if (connect(fd, (sockaddr*)&addr, sizeof(addr)) != 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+/**
+ * Send a GET and read its response as a browser would: to Content-Length,
+ * or to the server's FIN. Page timings go to `load` when it is given.
+ * @param html Receives the body, inflated if it was gzipped
+ * @param keepOpen Receives whether the connection can take another request
+ */
+static bool get(int fd, const std::string& path, bool gzip, Clock::time_point start, Load* load,
+                size_t& bytes, std::string& html, bool& keepOpen) {
+  std::string request = "GET " + path + " HTTP/1.1\r\nHost: esp32\r\n" +
+                        (gzip ? "Accept-Encoding: gzip, deflate\r\n" : "") + "\r\n";
+  if (send(fd, request.data(), request.size(), MSG_NOSIGNAL) != (ssize_t)request.size()) return false;
+
+  std::string head;
+  bool inBody = false, gzipped = false, hasLength = false, closing = false;
+  size_t length = 0, received = 0;
+  z_stream z = {};
+  bool zDone = false;
+  char buf[4096];
+  while (!(inBody && hasLength && received >= length) && !zDone) {
+    ssize_t n = recv(fd, buf, sizeof(buf), 0);
+    if (n <= 0) break;
+    if (load && bytes == 0) load->firstByte = millisSince(start);
+    bytes += n;
+
+    const char* data = buf;
+    if (!inBody) {
+      head.append(buf, n);
+      size_t end = head.find("\r\n\r\n");
+      if (end == std::string::npos) continue;
+      std::string lower = head.substr(0, end + 2);
+      for (char& c : lower) c = tolower(c);
+      size_t at = lower.find("\r\ncontent-length:");
+      hasLength = at != std::string::npos;
+      if (hasLength) length = strtoul(lower.c_str() + at + 17, nullptr, 10);
+      gzipped = lower.find("\r\ncontent-encoding: gzip") != std::string::npos;
+      closing = lower.find("\r\nconnection: close") != std::string::npos;
+      if (gzipped && inflateInit2(&z, MAX_WBITS + 16) != Z_OK) return false;
+      inBody = true;
+      data = buf + n - (head.size() - end - 4);
+      n = head.size() - end - 4;
+    }
+    received += n;
+    if (gzipped) {
+      char out[16384];
+      z.next_in = (Bytef*)data;
+      z.avail_in = n;
+      do {
+        z.next_out = (Bytef*)out;
+        z.avail_out = sizeof(out);
+        int ret = inflate(&z, Z_NO_FLUSH);
+        html.append(out, sizeof(out) - z.avail_out);
+        if (ret == Z_STREAM_END) zDone = true;
+        if (ret != Z_OK) break;
+      } while (z.avail_out == 0);
+    } else {
+      html.append(data, n);
+    }
+    if (load && load->headEnd == 0 && html.find("</head>") != std::string::npos) load->headEnd = millisSince(start);
+  }
+  if (gzipped) inflateEnd(&z);
+  keepOpen = hasLength && !closing;
+  return head.compare(0, 12, "HTTP/1.1 200") == 0 && (!hasLength || received >= length);
+}
+
+/** Stylesheets and scripts the page links, in document order */
+static std::vector<std::string> linkedAssets(const std::string& html) {
+  std::vector<std::string> paths;
+  for (const char* marker : { "<link rel=\"stylesheet\" href=\"", "<script src=\"" }) {
+    size_t at = 0;
+    while ((at = html.find(marker, at)) != std::string::npos) {
+      at += strlen(marker);
+      paths.push_back(html.substr(at, html.find('"', at) - at));
+    }
+  }
+  return paths;
+}
+
+/**
+ * Load the page, then its assets: the first on the page's connection if
+ * it was kept open, the others on new connections in parallel
+ */
+static Load loadPage(const Config& config) {
+  Load load;
+  Clock::time_point start = Clock::now();
+  int fd = connectProxy();
+  if (fd < 0) return load;
+  std::string html;
+  bool keepOpen = false;
+  load.ok = get(fd, "/", config.gzip, start, &load, load.bytes, html, keepOpen) &&
+            html.find("</html>") != std::string::npos;
+  load.pageEnd = millisSince(start);
+
+  std::vector<std::string> assets = config.cached ? std::vector<std::string>() : linkedAssets(html);
+  std::vector<std::thread> parallel;
+  std::vector<size_t> bytes(assets.size());
+  std::atomic<bool> assetsOk(true);
+  auto fetch = [&](size_t i, bool reuse) {
+    int conn = reuse ? fd : connectProxy();
+    std::string body;
+    bool open;
+    if (conn < 0 || !get(conn, assets[i], config.gzip, start, nullptr, bytes[i], body, open)) assetsOk = false;
+    if (!reuse && conn >= 0) close(conn);
+  };
+  for (size_t i = keepOpen ? 1 : 0; i < assets.size(); i++) parallel.emplace_back(fetch, i, false);
+  if (keepOpen && !assets.empty()) fetch(0, true);
+  for (std::thread& t : parallel) t.join();
+  close(fd);
+
+  load.interactive = millisSince(start);
+  for (size_t b : bytes) load.bytes += b;
+  load.ok = load.ok && assetsOk;
+  return load;
+}
+
+static double median(std::vector<double> values) {
+  std::sort(values.begin(), values.end());
+  return values.empty() ? 0 : values[values.size() / 2];
+}
+
+static bool measure(const Config& config, int runs) {
+  std::vector<double> firstByte, headEnd, pageEnd, interactive;
+  size_t bytes = 0;
+  for (int i = 0; i < runs; i++) {
+    Load load = loadPage(config);
+    if (!load.ok) {
+      printf("%-36s failed\n", config.name);
+      return false;
+    }
+    firstByte.push_back(load.firstByte);
+    headEnd.push_back(load.headEnd);
+    pageEnd.push_back(load.pageEnd);
+    interactive.push_back(load.interactive);
+    bytes = load.bytes;
+  }
+  printf("%-36s %10.1f %10.1f %10.1f %12.1f %8zu\n", config.name, median(firstByte), median(headEnd),
+         median(pageEnd), median(interactive), bytes);
+  return true;
+}
+
+int main(int argc, char** argv) {
+  NetProfile profile;
+  int runs = 5;
+  const char* device = nullptr;
+  for (int i = 1; i < argc; i++) {
+    if (profile.parseOption(i, argc, argv)) continue;
+    if (strcmp(argv[i], "--runs") == 0 && i + 1 < argc) runs = std::max(1, atoi(argv[++i]));
+    else if (strcmp(argv[i], "--device") == 0 && i + 1 < argc) device = argv[++i];
+    else {
+      printf("usage: %s [--runs N] [--latency MS] [--rate KBIT] [--mss BYTES] [--no-delayed-ack]"
+             " [--device IP[:port]]\n", argv[0]);
+      return 2;
+    }
+  }
+
+  sockaddr_in pageAddr = {}, sharedAddr = {};
+  pageAddr.sin_family = sharedAddr.sin_family = AF_INET;
+  pageAddr.sin_addr.s_addr = sharedAddr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  std::atomic<bool> running(true);
+  std::thread serverThread;
+  if (device) {
+    std::string host = device;
+    size_t colon = host.find(':');
+    pageAddr.sin_port = htons(colon == std::string::npos ? 80 : atoi(host.c_str() + colon + 1));
+    if (colon != std::string::npos) host.resize(colon);
+    if (inet_pton(AF_INET, host.c_str(), &pageAddr.sin_addr) != 1) {
+      printf("bad device address %s\n", device);
+      return 2;
+    }
+  } else {
+    pageAddr.sin_port = htons(pageServer.listen());
+    sharedAddr.sin_port = htons(sharedServer.listen());
+    standalone.begin(&pageServer);
+    standalone.setTitle("Reference");
+    standalone.setFormBuilder([] { addReferenceFields(standalone); });
+    standalone.enableCompression();
+    dispatched.setTitle("Reference");
+    dispatched.setFormBuilder([] { addReferenceFields(dispatched); });
+    dispatched.enableContentLength();
+    dispatcher.begin(&sharedServer);
+    dispatcher.addBuilder(dispatched);
+    serverThread = std::thread([&] {
+      while (running) {
+        {
+          std::lock_guard<std::mutex> lock(serving);
+          standalone.handleClient();
+          dispatcher.handleClient();
+        }
+        std::this_thread::yield();
+      }
+    });
+  }
+
+  profile.print();
+  printf("%-36s %10s %10s %10s %12s %8s   (ms, median of %d)\n", "", "first byte", "head end", "page end",
+         "interactive", "bytes", runs);
+  int failed = 0;
+  for (const Config& config : CONFIGS) {
+    if (device && (config.dispatched || config.nagle || config.flushPoints)) continue;
+    if (!device) {
+      std::lock_guard<std::mutex> lock(serving);
+      for (FormBuilder* builder : { &standalone, &dispatched }) {
+        builder->setNoDelay(!config.nagle);
+        builder->setFlushPoints(config.flushPoints);
+      }
+    }
+    NetSim link(profile, config.dispatched ? sharedAddr : pageAddr);
+    proxyPort = link.start();
+    if (!measure(config, runs)) failed++;
+  }
+
+  if (!device) {
+    running = false;
+    serverThread.join();
+  }
+  return failed ? 1 : 0;
+}